@@ -0,0 +1,148 @@
+/*
+ * bench.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Decimate.hpp"
+#include "SigProc.hpp"
+#include "utils.hpp"
+
+namespace {
+
+// make a 32-bit filterbank file with random data
+void MakeBenchFile(const std::string& path, const int nchans,
+    const int nsamples) {
+  SigProcHeader header;
+  header.source_name = "bench";
+  header.rawdatafile = "bench";
+  header.data_type = 1;
+  header.nbits = 32;
+  header.nifs = 1;
+  header.nchans = nchans;
+  header.nsamples = nsamples;
+  header.tsamp = 64.0e-6;
+  header.fch1 = 2300.0;
+  header.foff = -0.1;
+
+  SigProc out(path, header);
+
+  std::vector<float> spectra(1024 * (size_t)nchans);
+  for (int t0 = 0; t0 < nsamples; t0 += 1024) {
+    size_t len = std::min(1024, nsamples - t0);
+    for (size_t i = 0; i < len * (size_t)nchans; ++i)
+      spectra[i] = (float)rand() / (float)RAND_MAX;
+
+    size_t nbytes = len * (size_t)nchans * sizeof(float);
+    off64_t off = out.HeaderSize() + (size_t)t0 * (size_t)nchans
+        * sizeof(float);
+    if ((size_t)pwrite64(out.FD(), spectra.data(), nbytes, off) != nbytes)
+      throw std::runtime_error("Failed to write bench file");
+  }
+}
+
+double Seconds(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()
+      - start).count();
+}
+
+} // namespace [unnamed]
+
+int main(int argc, char ** argv) {
+  if (argc < 2) {
+    printf("Usage: %s FILE [NCHANS NSAMPLES] [BATCH_SIZE]\n", argv[0]);
+    printf("Creates FILE with NCHANS x NSAMPLES random values if it does not "
+        "exist and times reading and writing it in channel batches of "
+        "BATCH_SIZE\n");
+    return 1;
+  }
+
+  std::string path(argv[1]);
+
+  if (access(path.c_str(), F_OK) != 0) {
+    if (argc < 4) {
+      printf("Need NCHANS and NSAMPLES to create '%s'\n", path.c_str());
+      return 1;
+    }
+    printf("Creating bench file '%s'\n", path.c_str());
+    MakeBenchFile(path, parse_int(argv[2]), parse_int(argv[3]));
+  }
+
+  const SigProc inp(path);
+  size_t nchans = inp.Header().nchans;
+  size_t nsamples = inp.Header().nsamples;
+  size_t batch = argc > 4 ? parse_int(argv[4]) : nchans / 8;
+  batch = std::max(std::min(batch, nchans), (size_t)1);
+
+  printf("%lu channels, %lu samples, batches of %lu channels\n", nchans,
+      nsamples, batch);
+
+  std::vector<float> buf(batch * nsamples);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t c = 0; c < nchans; c += batch) {
+    size_t num = std::min(batch, nchans - c);
+    inp.GetChannels(buf.data(), c, num);
+  }
+  double sec = Seconds(start);
+
+  double mb = (double)inp.Header().Data_size() / (1024.0 * 1024.0);
+  printf("GetChannels: %8.3f s, %10.1f MB/s\n", sec, mb / sec);
+
+  {
+    const SigProc mapped(path, true);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < nchans; c += batch) {
+      size_t num = std::min(batch, nchans - c);
+      mapped.GetChannels(buf.data(), c, num);
+    }
+    sec = Seconds(start);
+  }
+
+  printf("GetChannels (mmap): %8.3f s, %10.1f MB/s\n", sec, mb / sec);
+
+  std::string out_path = path + ".bench_out";
+  {
+    SigProc out(out_path, inp.Header());
+
+    start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < nchans; c += batch) {
+      size_t num = std::min(batch, nchans - c);
+      out.SetChannels(c, buf.data(), num);
+    }
+    sec = Seconds(start);
+  }
+  unlink(out_path.c_str());
+
+  printf("SetChannels: %8.3f s, %10.1f MB/s\n", sec, mb / sec);
+
+  // average the last batch we read with the SIMD and the scalar kernels
+  double buf_mb = (double)buf.size() * sizeof(float) / (1024.0 * 1024.0);
+  std::vector<float> avg(buf.size() / 2);
+  for (size_t factor : { 2, 4, 6, 8, 16, 32 }) {
+    size_t num_out = buf.size() / factor;
+
+    start = std::chrono::steady_clock::now();
+    decimate(buf.data(), avg.data(), num_out, factor);
+    double simd_sec = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    decimate_scalar(buf.data(), avg.data(), num_out, factor);
+    double scalar_sec = Seconds(start);
+
+    printf("Decimate by %2lu: %8.3f s, %10.1f MB/s (scalar %8.3f s, "
+        "%10.1f MB/s)\n", factor, simd_sec, buf_mb / simd_sec, scalar_sec,
+        buf_mb / scalar_sec);
+  }
+
+  return 0;
+}
@@ -22,7 +22,8 @@
 const char *argp_program_bug_address = "<jonas@lippuner.ca>";
 
 /* Program documentation. */
-static char doc[] = "mkfb -- Make filterbank files from dada files";
+static char doc[] = "mkfb -- Make filterbank files from dada files. A "
+    "filterbank file that is a named pipe is streamed into the pipe.";
 
 /* A description of the arguments we accept. */
 static char args_doc[] = "CONF_FILE INPUT_DIR OUTPUT_DIR";
@@ -39,6 +40,8 @@ struct arguments {
   char * pulsars_file;
 
   bool batch, monitor;
+  bool direct_io;
+  bool drop_behind;
 
   int scan_num;
   int num_skip;
@@ -49,6 +52,8 @@ struct arguments {
 
 #define ARG_SKIP 1
 #define ARG_NUM 2
+#define ARG_DIRECT_IO 3
+#define ARG_DROP_BEHIND 4
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
@@ -65,6 +70,10 @@ static argp_option options[] = {
   {"scan-num",  'n', "SCAN_NUMBER",   0,  "The scan number to process" },
   {"skip", ARG_SKIP, "NUM",           0,  "Skip this many dada files" },
   {"num",   ARG_NUM, "NUM",           0,  "Process this many dada files" },
+  {"direct-io", ARG_DIRECT_IO, 0,     0,  "Write the filterbank files with "
+      "direct I/O, bypassing the page cache" },
+  {"drop-behind", ARG_DROP_BEHIND, 0, 0, "Drop the filterbank data from the "
+      "page cache once it is on disk" },
   { 0 }
 };
 
@@ -102,6 +111,12 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     args->num_proc = parse_int(arg);
     args->set_num_proc = true;
     break;
+  case ARG_DIRECT_IO:
+    args->direct_io = true;
+    break;
+  case ARG_DROP_BEHIND:
+    args->drop_behind = true;
+    break;
 
   case ARGP_KEY_ARG:
     if (state->arg_num >= 3)
@@ -176,6 +191,8 @@ void ProcessScan(const int scan_num, const ScanFile * const pScans,
   }
 
   MakeFilterbank make(config);
+  make.SetDirectIO(args.direct_io);
+  make.SetDropBehind(args.drop_behind);
   output += "/" + tag;
 
   if (args.monitor)
@@ -198,6 +215,8 @@ int main(int argc, char ** argv) {
 
   args.batch = false;
   args.monitor = false;
+  args.direct_io = false;
+  args.drop_behind = false;
 
   args.scan_num = 0;
   args.num_skip = 0;
@@ -5,7 +5,21 @@
  *      Author: jlippuner
  */
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// POSIX
+#include <unistd.h>
 
 #include "SigProcUtil.hpp"
 #include "RFIMask.hpp"
@@ -18,11 +32,16 @@ const char *argp_program_bug_address = "<jonas@lippuner.ca>";
 
 /* Program documentation. */
 static char doc[] = "prepfil -- Prepares sigproc filterbank files for "
-    "further processing. Supported actions are averaging samples, correcting "
-    "bandpass, removing the baseline, and barycentering.";
+    "further processing. Supported actions are averaging samples and "
+    "channels, correcting bandpass, removing the baseline, and barycentering. "
+    "INPUT and OUTPUT can be - for stdin and stdout or named pipes, which are "
+    "streamed spectrum by spectrum, so they can't have their bandpass "
+    "corrected, baseline removed, or be barycentered. With OUTPUT on stdout, "
+    "everything else goes to stderr. With --manifest, many files are processed "
+    "in one run.";
 
 /* A description of the arguments we accept. */
-static char args_doc[] = "INPUT OUTPUT\nFILE";
+static char args_doc[] = "INPUT OUTPUT\nFILE\n--in-place FILE\n--manifest=LIST";
 
 #define NO_GPU 1
 #define MAX_MEM 2
@@ -32,24 +51,55 @@ static char args_doc[] = "INPUT OUTPUT\nFILE";
 #define HEADER_DEC 6
 #define HEADER_FCH1 7
 #define HEADER_SRC_NAME 8
+#define MMAP 9
+#define NO_SCRATCH 10
+#define SCRATCH_DIR 11
+#define CHANNEL_MAJOR 12
+#define TIME_MAJOR 13
+#define OUT_BITS 14
+#define OUT_SCALE 15
+#define OUT_OFFSET 16
+#define DIRECT_IO 17
+#define THREADS 18
+#define BP_SMOOTHER 19
+#define MANIFEST 20
+#define JOBS 21
+#define IN_PLACE 22
+#define AVG_CHANS 23
 
 /* Used by main to communicate with parse_opt. */
 struct arguments {
   char *args[2]; // INPUT and OUTPUT
   int arg_num;
   int avg;
+  int avg_chans;
   double bp_min;
   double bp_smooth;
+  char * bp_smoother;
   double baseline;
   char *obs;
   bool no_gpu;
+  int threads;
   long int max_mem;
   double max_mem_frac;
   char * mask;
+  bool mmap;
+  bool direct_io;
+  bool no_scratch;
+  char * scratch_dir;
+  bool channel_major;
+  bool time_major;
+  int out_bits;
+  double out_scale, out_offset;
+  bool set_out_scale, set_out_offset;
 
   double ra, dec, fch1;
   char * src_name;
   bool set_ra, set_dec, set_fch1, set_src_name;
+
+  char * manifest;
+  int jobs;
+  bool in_place;
 };
 
 /* Parse a single option. */
@@ -62,12 +112,18 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'a':
     args->avg = parse_int(arg);
     break;
+  case AVG_CHANS:
+    args->avg_chans = parse_int(arg);
+    break;
   case 'p':
     args->bp_min = arg ? parse_double(arg) : 2.0;
     break;
   case 's':
     args->bp_smooth = parse_double(arg);
     break;
+  case BP_SMOOTHER:
+    args->bp_smoother = arg;
+    break;
   case 'b':
     args->baseline = parse_double(arg);
     break;
@@ -77,6 +133,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case NO_GPU:
     args->no_gpu = true;
     break;
+  case THREADS:
+    args->threads = parse_int(arg);
+    break;
   case MAX_MEM:
     args->max_mem = parse_long_int(arg);
     break;
@@ -86,6 +145,35 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case MASK:
     args->mask = arg;
     break;
+  case MMAP:
+    args->mmap = true;
+    break;
+  case DIRECT_IO:
+    args->direct_io = true;
+    break;
+  case NO_SCRATCH:
+    args->no_scratch = true;
+    break;
+  case SCRATCH_DIR:
+    args->scratch_dir = arg;
+    break;
+  case CHANNEL_MAJOR:
+    args->channel_major = true;
+    break;
+  case TIME_MAJOR:
+    args->time_major = true;
+    break;
+  case OUT_BITS:
+    args->out_bits = parse_int(arg);
+    break;
+  case OUT_SCALE:
+    args->out_scale = parse_double(arg);
+    args->set_out_scale = true;
+    break;
+  case OUT_OFFSET:
+    args->out_offset = parse_double(arg);
+    args->set_out_offset = true;
+    break;
   case HEADER_RA:
     args->ra = parse_double(arg);
     args->set_ra = true;
@@ -102,6 +190,15 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     args->src_name = arg;
     args->set_src_name = true;
     break;
+  case MANIFEST:
+    args->manifest = arg;
+    break;
+  case JOBS:
+    args->jobs = parse_int(arg);
+    break;
+  case IN_PLACE:
+    args->in_place = true;
+    break;
 
   case ARGP_KEY_ARG:
     if (state->arg_num >= 2)
@@ -111,7 +208,7 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     break;
 
   case ARGP_KEY_END:
-    if (state->arg_num < 1)
+    if ((state->arg_num < 1) && (args->manifest == nullptr))
       argp_usage(state); // too few args
     break;
 
@@ -128,19 +225,59 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 /* The options we understand. */
 static argp_option options[] = {
   {"average",  'a', "NUM", 0,  "Average NUM samples" },
+  {"average-channels", AVG_CHANS, "NUM", 0, "Average NUM adjacent channels, "
+      "leaving out zeroed channels and masked samples. The number of channels "
+      "of INPUT must be a multiple of NUM." },
   {"bandpass", 'p', "MIN", OPTION_ARG_OPTIONAL,
       "Do bandpass correction using MIN minutes of data to estimate bandpass "
       "(default MIN = 2)" },
   {"bandpass_smooth",  's', "NUM", 0,
-      "Smooth bandpass with smoothing constant NUM (measured in samples)" },
+      "Smooth bandpass with smoothing constant NUM, which is the variance of "
+      "the Gaussian in channels^2 or the window width in channels for the "
+      "median and Savitzky-Golay smoothers" },
+  {"bandpass-smoother", BP_SMOOTHER, "METHOD", 0, "Smooth the bandpass with "
+      "METHOD = gauss (Gaussian, default), median (running median), or savgol "
+      "(Savitzky-Golay filter of order 2)" },
   {"baseline", 'b', "SEC", 0,
       "Remove baseline by removing all frequencies lower than 1 / SEC seconds"},
   {"obs",      'o', "CODE", 0, "Observatory CODE for barycentering" },
   {"no-gpu",   NO_GPU, 0,     0, "Don't use GPU for baseline removal" },
+  {"threads",  THREADS, "NUM", 0, "Process the channels with NUM threads "
+      "(default is one per core)" },
   {"max-mem",  MAX_MEM, "SIZE_MB", 0, "Use at most SIZE_MB megabytes of memory" },
   {"max-mem-frac", MAX_MEM_FRAC, "PERCENT", 0,
       "Use at most PERCENT % of the total system memory" },
   {"mask",     MASK, "FILE", 0, "Use the RFI mask MASK" },
+  {"mmap",     MMAP, 0,      0, "Memory map the input file and read the data "
+      "straight from the page cache" },
+  {"direct-io", DIRECT_IO, 0, 0, "Read and write the data with direct I/O, "
+      "bypassing the page cache, so that processing a huge file doesn't evict "
+      "everything else from memory (the input is still read through the page "
+      "cache with --mmap)" },
+  {"no-scratch", NO_SCRATCH, 0, 0, "If the input has to be processed in "
+      "several batches, don't split it into scratch files first but read the "
+      "entire input once per batch (needs less disk space)" },
+  {"in-place", IN_PLACE, 0, 0, "Process FILE in place instead of writing "
+      "OUTPUT, so that no second copy of it is needed (not with averaging, and "
+      "--out-bits must be the bits per value of FILE). Progress is kept in "
+      "FILE.journal, if processing is interrupted, run the same command again "
+      "to finish it" },
+  {"scratch-dir", SCRATCH_DIR, "DIR", 0, "Put scratch files into DIR "
+      "(default is next to OUTPUT)" },
+  {"channel-major", CHANNEL_MAJOR, 0, 0, "Write OUTPUT with the data stored "
+      "channel by channel, so that later processing of OUTPUT doesn't need to "
+      "transpose it (default is the layout of INPUT)" },
+  {"time-major", TIME_MAJOR, 0, 0, "Write OUTPUT with the data stored "
+      "spectrum by spectrum, as standard SIGPROC filterbank files do" },
+  {"out-bits", OUT_BITS, "NUM", 0, "Write OUTPUT with NUM = 8, 16, or 32 bits "
+      "per value (default 32). 8 and 16-bit values are round(value * SCALE + "
+      "OFFSET), the SCALE and OFFSET of each channel are written to "
+      "OUTPUT.scales" },
+  {"out-scale", OUT_SCALE, "SCALE", 0, "Use SCALE for all channels of 8 and "
+      "16-bit output (default is to scale each channel automatically, such "
+      "that +-6 standard deviations around its mean fill the integer range)" },
+  {"out-offset", OUT_OFFSET, "OFFSET", 0, "Use OFFSET for all channels of 8 "
+      "and 16-bit output (default 0 if SCALE is given)" },
   {"ra",  HEADER_RA, "HHMMSS.SSS", 0, "Set the source RA in the new header "
       "to HHMMSS.SSS"},
   {"dec", HEADER_DEC, "DDMMSS.SSS", 0, "Set the source DEC in the new header "
@@ -148,6 +285,14 @@ static argp_option options[] = {
   {"fch1",HEADER_FCH1, "MHz", 0, "Set fch1 in the new header to MHz"},
   {"src-name",HEADER_SRC_NAME, "NAME", 0, "Set source name in the new header "
       "to NAME (will be truncated to 79 characters"},
+  {"manifest", MANIFEST, "LIST", 0, "Process all the files in LIST in one "
+      "run, which shares FFTW plans, RFI masks, and barycentering results "
+      "between them. Each line of LIST is INPUT OUTPUT [OPTION...], where the "
+      "options are added to those on the command line. Empty lines and lines "
+      "starting with # are skipped, file names cannot contain spaces" },
+  {"jobs",     JOBS, "NUM", 0, "With --manifest, process NUM files at the "
+      "same time, splitting the memory and the cores between them (default "
+      "1)" },
   { 0 }
 };
 
@@ -157,98 +302,262 @@ static struct argp argp = { options, parse_opt, args_doc, doc };
 #pragma GCC diagnostic pop
 
 
-int main(int argc, char **argv) {
-  arguments args;
-
-  args.arg_num = 0;
-  args.avg = 1;
-  args.bp_min = 0.0;
-  args.bp_smooth = 0.0;
-  args.baseline = 0.0;
-  args.obs = nullptr;
-  args.no_gpu = false;
-  args.max_mem = 0;
-  args.max_mem_frac = 0.0;
-  args.mask = nullptr;
-  args.ra = 0.0;
-  args.dec = 0.0;
-  args.fch1 = 0.0;
-  args.src_name = nullptr;
-  args.set_ra = false;
-  args.set_dec = false;
-  args.set_fch1 = false;
-  args.set_src_name = false;
+static void init_arguments(arguments * const args) {
+  args->arg_num = 0;
+  args->avg = 1;
+  args->avg_chans = 1;
+  args->bp_min = 0.0;
+  args->bp_smooth = 0.0;
+  args->bp_smoother = nullptr;
+  args->baseline = 0.0;
+  args->obs = nullptr;
+  args->no_gpu = false;
+  args->threads = 0;
+  args->max_mem = 0;
+  args->max_mem_frac = 0.0;
+  args->mask = nullptr;
+  args->mmap = false;
+  args->direct_io = false;
+  args->no_scratch = false;
+  args->scratch_dir = nullptr;
+  args->channel_major = false;
+  args->time_major = false;
+  args->out_bits = 32;
+  args->out_scale = 1.0;
+  args->out_offset = 0.0;
+  args->set_out_scale = false;
+  args->set_out_offset = false;
+  args->ra = 0.0;
+  args->dec = 0.0;
+  args->fch1 = 0.0;
+  args->src_name = nullptr;
+  args->set_ra = false;
+  args->set_dec = false;
+  args->set_fch1 = false;
+  args->set_src_name = false;
+  args->manifest = nullptr;
+  args->jobs = 1;
+  args->in_place = false;
+}
 
-  argp_parse(&argp, argc, argv, 0, 0, &args);
+/* What to do with the files of the arguments. */
+struct actions {
+  bool do_processing, mod_header, convert;
+  SigProcUtil::BandpassSmoothing smoother;
+  std::string smoother_name;
+};
 
-//  printf("avg = %i, bp = %f, base = %f\n", args.avg, args.bp_min, args.baseline);
-  
-//  printf("args.mask == %s\n", args.mask);
-  
-  bool do_processing = !((args.avg == 1) && (args.bp_min == 0.0)
-      && (args.baseline == 0.0) && (args.obs == nullptr) && (args.mask == nullptr));
-  bool mod_header = args.set_ra || args.set_dec || args.set_fch1
+// Work out what to do from the arguments, returns false (after saying why) if
+// they don't make sense
+static bool get_actions(const arguments& args, actions * const todo) {
+  todo->do_processing = !((args.avg == 1) && (args.avg_chans == 1)
+      && (args.bp_min == 0.0)
+      && (args.baseline == 0.0) && (args.obs == nullptr) && (args.mask == nullptr)
+      && (args.out_bits == 32));
+  todo->mod_header = args.set_ra || args.set_dec || args.set_fch1
       || args.set_src_name;
+  todo->convert = !todo->do_processing
+      && (args.channel_major || args.time_major);
 
-  if (!do_processing && !mod_header) {
-    printf("No action specified, exiting.\n");
-    return 0;
+  if (args.channel_major && args.time_major) {
+    printf("Cannot write OUTPUT in both channel-major and time-major layout\n");
+    return false;
   }
 
-  if (do_processing && (args.arg_num != 2)) {
+  if (!todo->do_processing && !todo->mod_header && !todo->convert)
+    return true;
+
+  if (args.in_place) {
+    if ((args.arg_num != 1) || !todo->do_processing) {
+      printf("Can only process a single FILE in place\n");
+      return false;
+    }
+
+    if (args.avg > 1) {
+      printf("Cannot average samples in place\n");
+      return false;
+    }
+
+    if (args.avg_chans > 1) {
+      printf("Cannot average channels in place\n");
+      return false;
+    }
+  } else if ((todo->do_processing || todo->convert) && (args.arg_num != 2)) {
     printf("Cannot do requested processing without an INPUT and OUTPUT file "
         "specified\n");
-    return 1;
+    return false;
+  }
+
+  // the header is changed in a second pass over the file
+  if (todo->mod_header && (args.arg_num > 0)
+      && (SigProc::IsStream(args.args[0])
+      || SigProc::IsStream(args.args[args.arg_num - 1]))) {
+    printf("Cannot modify the header of a stream\n");
+    return false;
+  }
+
+  if ((args.out_bits != 8) && (args.out_bits != 16) && (args.out_bits != 32)) {
+    printf("Can only write 8, 16, or 32-bit output\n");
+    return false;
+  }
+
+  if (args.avg_chans < 1) {
+    printf("Cannot average a non-positive number of channels\n");
+    return false;
+  }
+
+  if (args.threads < 0) {
+    printf("Cannot use a negative number of threads\n");
+    return false;
   }
 
   if ((args.bp_smooth > 0.0) && (args.bp_min == 0.0)) {
     printf("Cannot smooth bandpass if bandpass correction is not requested.\n");
-    return 1;
+    return false;
   }
 
-  SigProcUtil util(args.max_mem * 1024, args.max_mem_frac, !args.no_gpu);
+  todo->smoother = SigProcUtil::BandpassSmoothing::Gaussian;
+  todo->smoother_name = "Gaussian";
+  if (args.bp_smoother != nullptr) {
+    std::string method(args.bp_smoother);
+    if (method == "median") {
+      todo->smoother = SigProcUtil::BandpassSmoothing::Median;
+      todo->smoother_name = "running median";
+    } else if (method == "savgol") {
+      todo->smoother = SigProcUtil::BandpassSmoothing::SavitzkyGolay;
+      todo->smoother_name = "Savitzky-Golay filter";
+    } else if (method != "gauss") {
+      printf("Unknown bandpass smoother '%s'\n", method.c_str());
+      return false;
+    }
+  }
 
-  if (do_processing) {
+  return true;
+}
+
+/* The RFI masks used by the files of a manifest, each one is only read once.
+   The key is the file name and the header fields the mask is checked
+   against. */
+typedef std::tuple<std::string, double, double, double, int, double, int64_t>
+    mask_key;
+
+struct mask_cache {
+  std::mutex mutex;
+  std::map<mask_key, std::shared_ptr<const RFIMask>> masks;
+
+  std::shared_ptr<const RFIMask> Get(const std::string& file,
+      const SigProcHeader& header) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& mask = masks[mask_key(file, header.tstart, header.foff, header.fch1,
+        header.nchans, header.tsamp, header.nsamples)];
+    if (mask == nullptr)
+      mask = std::make_shared<const RFIMask>(file, header);
+
+    return mask;
+  }
+};
+
+// Do what todo says with the files of args. If it isn't 0, the memory is
+// limited to mem_limit_kB (on top of the limits in args). Unless verbose, only
+// warnings and results are printed. The masks come from masks if it isn't
+// nullptr.
+static void run(const arguments& args, const actions& todo,
+    const size_t mem_limit_kB, const int num_threads, const bool verbose,
+    mask_cache * const masks) {
+  SigProcUtil util(args.max_mem * 1024, args.max_mem_frac, !args.no_gpu);
+  if ((mem_limit_kB > 0) && ((args.max_mem == 0)
+      || (mem_limit_kB < (size_t)args.max_mem * 1024)))
+    util.SetAbsoluteMemLimit_kB(mem_limit_kB);
+  util.SetUseScratch(!args.no_scratch);
+  if (args.scratch_dir != nullptr)
+    util.SetScratchDir(std::string(args.scratch_dir));
+  util.SetOutputBits(args.out_bits);
+  util.SetDirectIO(args.direct_io);
+  util.SetNumThreads(num_threads);
+  util.SetBandpassSmoothing(todo.smoother);
+  util.SetNumChannelsToAverage(args.avg_chans);
+  util.SetShowProgress(verbose);
+  if (args.set_out_scale || args.set_out_offset)
+    util.SetOutputScaling(args.out_scale, args.out_offset);
+  if (args.channel_major)
+    util.SetOutputLayout(SigProcUtil::OutputLayout::ChannelMajor);
+  if (args.time_major)
+    util.SetOutputLayout(SigProcUtil::OutputLayout::TimeMajor);
+
+  if (todo.do_processing) {
     std::string in_file(args.args[0]);
-    std::string out_file(args.args[1]);
+    std::string out_file(args.args[args.arg_num - 1]);
     std::string mask_file = args.mask == nullptr ? "" : std::string(args.mask);
     std::string obs = "";
-
-    printf(" Input file: %s\n", in_file.c_str());
-    printf("Output file: %s\n", out_file.c_str());
-    printf("  Mask file: %s\n", mask_file != "" ? mask_file.c_str() : "<none>");
-
-    printf("\nPerforming the following actions:\n");
-    if (args.avg > 1)
-      printf("  Averaging %i samples\n", args.avg);
-    if (args.bp_min > 0.0)
-      printf("  Bandpass correction using %.2f minutes to measure bandpass\n",
-          args.bp_min);
-    if (args.bp_smooth > 0.0)
-      printf("  Smoothing bandpass with constant %.2f\n", args.bp_smooth);
-    if (args.baseline > 0.0)
-      printf("  Removing baseline using smoothing length of %.2f seconds\n",
-          args.baseline);
-    if (args.obs != nullptr) {
+    if (args.obs != nullptr)
       obs = std::string(args.obs);
-      printf("  Barycentering using observatory code %s\n", args.obs);
+
+    if (verbose) {
+      printf(" Input file: %s\n", in_file.c_str());
+      printf("Output file: %s\n", args.in_place ? "<in place>"
+          : out_file.c_str());
+      printf("  Mask file: %s\n",
+          mask_file != "" ? mask_file.c_str() : "<none>");
+
+      printf("\nPerforming the following actions:\n");
+      if (args.avg > 1)
+        printf("  Averaging %i samples\n", args.avg);
+      if (args.bp_min > 0.0)
+        printf("  Bandpass correction using %.2f minutes to measure bandpass\n",
+            args.bp_min);
+      if (args.bp_smooth > 0.0)
+        printf("  Smoothing bandpass with %s, constant %.2f\n",
+            todo.smoother_name.c_str(), args.bp_smooth);
+      if (args.baseline > 0.0)
+        printf("  Removing baseline using smoothing length of %.2f seconds\n",
+            args.baseline);
+      if (args.avg_chans > 1)
+        printf("  Averaging %i channels\n", args.avg_chans);
+      if (args.obs != nullptr)
+        printf("  Barycentering using observatory code %s\n", args.obs);
+      if ((args.out_bits != 32) && (args.set_out_scale || args.set_out_offset))
+        printf("  Writing %i-bit output with scale %.4e and offset %.4e\n",
+            args.out_bits, args.out_scale, args.out_offset);
+      else if (args.out_bits != 32)
+        printf("  Writing %i-bit output with automatic scaling\n",
+            args.out_bits);
+      printf("\n");
     }
-    printf("\n");
 
-    const SigProc inp(in_file);
+    SigProc inp(in_file, args.mmap && !args.in_place);
+    inp.SetDirectIO(args.direct_io);
 
     size_t num_bp = args.bp_min * 60.0 / inp.Header().tsamp;
 
-    if (mask_file != "") {
+    if ((mask_file != "") && (masks != nullptr)) {
+      util.SetMask(masks->Get(mask_file, inp.Header()));
+    } else if (mask_file != "") {
       RFIMask mask(mask_file, inp.Header());
       util.SetMask(mask);
     }
 
-    util.Process(inp, out_file, args.avg, num_bp, args.bp_smooth,
-        args.baseline, obs);
+    if (args.in_place)
+      util.ProcessInPlace(in_file, num_bp, args.bp_smooth, args.baseline, obs);
+    else
+      util.Process(inp, out_file, args.avg, num_bp, args.bp_smooth,
+          args.baseline, obs);
+  }
+
+  if (todo.convert) {
+    std::string in_file(args.args[0]);
+    std::string out_file(args.args[1]);
+
+    if (verbose) {
+      printf(" Input file: %s\n", in_file.c_str());
+      printf("Output file: %s\n\n", out_file.c_str());
+    }
+
+    SigProc inp(in_file, args.mmap);
+    inp.SetDirectIO(args.direct_io);
+    util.ConvertLayout(inp, out_file, args.channel_major);
   }
 
-  if (mod_header) {
+  if (todo.mod_header) {
     std::string in_file, out_file;
 
     if (args.arg_num == 1) {
@@ -257,7 +566,7 @@ int main(int argc, char **argv) {
     } else {
       out_file = std::string(args.args[1]);
 
-      if (do_processing)
+      if (todo.do_processing || todo.convert)
         in_file = out_file;
       else
         in_file = std::string(args.args[0]);
@@ -277,6 +586,221 @@ int main(int argc, char **argv) {
 
     util.ModifyHeader(in_file, out_file, header);
   }
+}
+
+// Process the files of the manifest in args.manifest, args.jobs at a time. Each
+// line is parsed like a command line made of the options in argv followed by
+// the words of the line. All lines are checked before anything is processed.
+static int run_manifest(int argc, char **argv, const arguments& args) {
+  std::ifstream istm(args.manifest);
+  if (istm.fail()) {
+    printf("Could not open manifest '%s'\n", args.manifest);
+    return 1;
+  }
+
+  if (args.arg_num > 0) {
+    printf("Cannot give INPUT or OUTPUT together with --manifest\n");
+    return 1;
+  }
+
+  if (args.jobs < 1) {
+    printf("Need at least 1 job\n");
+    return 1;
+  }
+
+  // The parsed arguments point into these strings, so they must not change
+  // once the lines are parsed. Errors are reported with the name
+  // MANIFEST:LINE, which argp takes from the first word.
+  std::vector<std::vector<std::string>> words;
+  std::vector<int> line_nums;
+
+  std::string manifest_name(args.manifest);
+  manifest_name = manifest_name.substr(manifest_name.find_last_of('/') + 1);
+
+  std::string line;
+  for (int line_num = 1; std::getline(istm, line); ++line_num) {
+    std::istringstream line_stm(line);
+    std::vector<std::string> line_words;
+    std::string word;
+    while (line_stm >> word)
+      line_words.push_back(word);
+
+    if ((line_words.size() == 0) || (line_words[0][0] == '#'))
+      continue;
+
+    line_words.insert(line_words.begin(),
+        manifest_name + ":" + std::to_string(line_num));
+    words.push_back(line_words);
+    line_nums.push_back(line_num);
+  }
+
+  const size_t num_files = words.size();
+  if (num_files == 0) {
+    printf("No files in manifest '%s', exiting.\n", args.manifest);
+    return 0;
+  }
+
+  std::vector<arguments> file_args(num_files);
+  std::vector<actions> file_todo(num_files);
+
+  for (size_t i = 0; i < num_files; ++i) {
+    std::vector<char*> file_argv;
+    file_argv.push_back(&words[i][0][0]);
+    for (int a = 1; a < argc; ++a)
+      file_argv.push_back(argv[a]);
+    for (size_t w = 1; w < words[i].size(); ++w)
+      file_argv.push_back(&words[i][w][0]);
+
+    init_arguments(&file_args[i]);
+    argp_parse(&argp, file_argv.size(), file_argv.data(), 0, 0, &file_args[i]);
+
+    if (!get_actions(file_args[i], &file_todo[i])) {
+      printf("(line %i of manifest '%s')\n", line_nums[i], args.manifest);
+      return 1;
+    }
+
+    if (file_args[i].arg_num == 0) {
+      printf("Line %i of manifest '%s' has no INPUT\n", line_nums[i],
+          args.manifest);
+      return 1;
+    }
+
+    if (std::string(file_args[i].args[file_args[i].arg_num - 1]) == "-") {
+      printf("Cannot write OUTPUT to stdout in line %i of manifest '%s'\n",
+          line_nums[i], args.manifest);
+      return 1;
+    }
+
+    if (!file_todo[i].do_processing && !file_todo[i].mod_header
+        && !file_todo[i].convert) {
+      printf("No action specified in line %i of manifest '%s'\n",
+          line_nums[i], args.manifest);
+      return 1;
+    }
+  }
+
+  const size_t num_jobs = std::min((size_t)args.jobs, num_files);
+
+  // The memory is split evenly between the jobs, out of what the command line
+  // allows. Each job also checks the memory that is available when it starts,
+  // so the jobs together never use more than that either.
+  SigProcUtil util;
+  size_t total_kB, avail_kB;
+  util.Meminfo(&total_kB, &avail_kB);
+
+  size_t budget_kB = 0.8 * (double)avail_kB;
+  if (args.max_mem > 0)
+    budget_kB = std::min(budget_kB, (size_t)args.max_mem * 1024);
+  if (args.max_mem_frac > 0.0)
+    budget_kB = std::min(budget_kB,
+        (size_t)(args.max_mem_frac * (double)total_kB));
+
+  const size_t mem_per_job_kB = num_jobs > 1 ? budget_kB / num_jobs : 0;
+
+  // the same for the cores, unless a line says how many threads to use
+  const int threads_per_job = std::max(
+      (int)std::thread::hardware_concurrency() / (int)num_jobs, 1);
+
+  printf("Processing %lu files with %lu job%s\n", num_files, num_jobs,
+      num_jobs > 1 ? "s" : "");
+  if (num_jobs > 1)
+    printf("Using %lu MB of memory and %i threads per job\n",
+        mem_per_job_kB / 1024, threads_per_job);
+
+  mask_cache masks;
+  std::atomic<size_t> next_file(0);
+  std::atomic<size_t> num_failed(0);
+  std::mutex print_mutex;
+
+  auto job = [&]() {
+    for (size_t i = next_file++; i < num_files; i = next_file++) {
+      const auto& file = file_args[i];
+      const int num_threads = ((num_jobs > 1) && (file.threads == 0))
+          ? threads_per_job : file.threads;
+
+      {
+        std::lock_guard<std::mutex> lock(print_mutex);
+        printf("%s[%lu/%lu] %s%s\n", num_jobs > 1 ? "" : "\n", i + 1,
+            num_files, file.args[file.arg_num - 1],
+            num_jobs > 1 ? ": started" : "");
+        fflush(stdout);
+      }
+
+      try {
+        run(file, file_todo[i], mem_per_job_kB, num_threads, num_jobs == 1,
+            &masks);
+
+        if (num_jobs > 1) {
+          std::lock_guard<std::mutex> lock(print_mutex);
+          printf("[%lu/%lu] %s: done\n", i + 1, num_files,
+              file.args[file.arg_num - 1]);
+          fflush(stdout);
+        }
+      } catch (std::exception& ex) {
+        ++num_failed;
+        std::lock_guard<std::mutex> lock(print_mutex);
+        printf("[%lu/%lu] %s: failed: %s\n", i + 1, num_files,
+            file.args[file.arg_num - 1], ex.what());
+        fflush(stdout);
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t j = 1; j < num_jobs; ++j)
+    threads.push_back(std::thread(job));
+  job();
+  for (auto& t : threads)
+    t.join();
+
+  if (num_failed > 0) {
+    printf("%lu of %lu files failed\n", (size_t)num_failed, num_files);
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  arguments args;
+  init_arguments(&args);
+
+  argp_parse(&argp, argc, argv, 0, 0, &args);
+
+  if (args.manifest != nullptr)
+    return run_manifest(argc, argv, args);
+
+  actions todo;
+  if (!get_actions(args, &todo))
+    return 1;
+
+  if (!todo.do_processing && !todo.mod_header && !todo.convert) {
+    printf("No action specified, exiting.\n");
+    return 0;
+  }
+
+  // With OUTPUT on stdout, the data goes to a copy of stdout and everything we
+  // print goes to stderr instead
+  std::string data_name;
+  if ((args.arg_num == 2) && (std::string(args.args[1]) == "-")) {
+    const int data_fd = dup(STDOUT_FILENO);
+    if ((data_fd == -1) || (dup2(STDERR_FILENO, STDOUT_FILENO) == -1)) {
+      perror("Failure in main");
+      return 1;
+    }
+
+    // stdout was a pipe, so it is fully buffered, but it goes to stderr now
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    data_name = "/dev/fd/" + std::to_string(data_fd);
+    if (!SigProc::IsStream(data_name)) {
+      printf("Can only write OUTPUT to stdout if it is a pipe\n");
+      return 1;
+    }
+    args.args[1] = &data_name[0];
+  }
+
+  run(args, todo, 0, args.threads, true, nullptr);
 
   return 0;
 }
@@ -0,0 +1,284 @@
+/*
+ * AsyncIO.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "AsyncIO.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// POSIX
+#ifndef _LARGEFILE64_SOURCE
+  #define _LARGEFILE64_SOURCE 1
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr size_t AsyncIO::DefaultQueueDepth;
+constexpr size_t AsyncIO::ChunkSize;
+constexpr size_t AsyncIO::DirectAlignment;
+
+namespace {
+
+class ThreadPoolIO;
+
+// a request of a ThreadPoolIO
+struct PoolRequest {
+  bool write; // a read otherwise
+  int fd;
+  char * buf;
+  size_t len;
+  off64_t off;
+  ThreadPoolIO * owner;
+};
+
+// The threads that carry out the requests of all ThreadPoolIOs with blocking
+// pread and pwrite. There is a single pool for the whole process, which is
+// started the first time a ThreadPoolIO needs it, so that every open file
+// doesn't come with threads of its own.
+class IOThreads {
+public:
+  static IOThreads& Get() {
+    static IOThreads threads(AsyncIO::DefaultQueueDepth);
+    return threads;
+  }
+
+  ~IOThreads() {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop = true;
+    }
+    mWork.notify_all();
+
+    for (auto& t : mThreads)
+      t.join();
+  }
+
+  void Push(const PoolRequest& req) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mQueue.push_back(req);
+    }
+    mWork.notify_one();
+  }
+
+private:
+  IOThreads(const size_t num_threads) :
+      mStop(false) {
+    for (size_t i = 0; i < num_threads; ++i)
+      mThreads.emplace_back(&IOThreads::Worker, this);
+  }
+
+  void Worker();
+
+  std::vector<std::thread> mThreads;
+  std::deque<PoolRequest> mQueue;
+
+  std::mutex mMutex;
+  std::condition_variable mWork;
+  bool mStop;
+};
+
+// Queues its requests in the shared pool of threads and keeps track of its own
+// requests, so that Wait only waits for them and only reports their errors. At
+// most queueDepth requests are in flight at once.
+class ThreadPoolIO : public AsyncIO {
+public:
+  ThreadPoolIO(const size_t queueDepth) :
+      mQueueDepth(std::max(queueDepth, (size_t)1)),
+      mNumPending(0),
+      mThreads(IOThreads::Get()) {}
+
+  ~ThreadPoolIO() {
+    // the threads must be done with our requests before we are gone
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mNumPending == 0; });
+  }
+
+  void Flush() {
+    // the threads pick up the requests right away
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mNumPending == 0; });
+
+    if (mError != "") {
+      std::string err = mError;
+      mError = "";
+      throw std::runtime_error(err);
+    }
+  }
+
+  std::string Name() const {
+    return "thread pool";
+  }
+
+  // Called by the threads once a request is done, err is empty if it worked.
+  // We notify while holding the lock, since once the last request is done,
+  // the destructor may run as soon as we let go of it.
+  void Complete(const std::string& err) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if ((err != "") && (mError == ""))
+      mError = err;
+    --mNumPending;
+    mDone.notify_all();
+  }
+
+protected:
+  void Submit(const Op op, const int fd, char * const buf, const size_t len,
+      const off64_t off) {
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mDone.wait(lock, [this] { return mNumPending < mQueueDepth; });
+      ++mNumPending;
+    }
+
+    mThreads.Push({ op == Op::Write, fd, buf, len, off, this });
+  }
+
+private:
+  const size_t mQueueDepth;
+  size_t mNumPending; // queued or in progress
+
+  IOThreads& mThreads;
+
+  std::mutex mMutex;
+  std::condition_variable mDone;
+
+  std::string mError; // first error since the last Wait
+};
+
+// returns an error message if the request failed
+std::string execute(const PoolRequest& req) {
+  size_t done = 0;
+
+  while (done < req.len) {
+    ssize_t n = !req.write ?
+        pread64(req.fd, req.buf + done, req.len - done, req.off + done) :
+        pwrite64(req.fd, req.buf + done, req.len - done, req.off + done);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return std::string(!req.write ? "Failed to read: " :
+          "Failed to write: ") + strerror(errno);
+    }
+
+    if (n == 0)
+      return "Unexpected end of file";
+
+    done += n;
+  }
+
+  return "";
+}
+
+void IOThreads::Worker() {
+  while (true) {
+    PoolRequest req;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mWork.wait(lock, [this] { return mStop || (mQueue.size() > 0); });
+
+      if (mQueue.size() == 0)
+        return;
+
+      req = mQueue.front();
+      mQueue.pop_front();
+    }
+
+    req.owner->Complete(execute(req));
+  }
+}
+
+} // namespace [unnamed]
+
+std::unique_ptr<AsyncIO> AsyncIO::Create(const size_t queueDepth) {
+  auto io = CreateUring(queueDepth);
+  if (io == nullptr)
+    io = CreateThreadPool(queueDepth);
+
+  return io;
+}
+
+std::unique_ptr<AsyncIO> AsyncIO::CreateThreadPool(const size_t queueDepth) {
+  return std::unique_ptr<AsyncIO>(new ThreadPoolIO(queueDepth));
+}
+
+void AsyncIO::Read(const int fd, void * const buf, const size_t len,
+    const off64_t off) {
+  for (size_t done = 0; done < len; done += ChunkSize) {
+    Submit(Op::Read, fd, (char*)buf + done, std::min(ChunkSize, len - done),
+        off + done);
+  }
+}
+
+void AsyncIO::Write(const int fd, const void * const buf, const size_t len,
+    const off64_t off) {
+  for (size_t done = 0; done < len; done += ChunkSize) {
+    Submit(Op::Write, fd, (char*)buf + done, std::min(ChunkSize, len - done),
+        off + done);
+  }
+}
+
+void AsyncIO::ReadDirect(const int fd, const int directFD, void * const buf,
+    const size_t len, const off64_t off) {
+  SubmitDirect(Op::Read, fd, directFD, (char*)buf, len, off);
+}
+
+void AsyncIO::WriteDirect(const int fd, const int directFD,
+    const void * const buf, const size_t len, const off64_t off) {
+  SubmitDirect(Op::Write, fd, directFD, (char*)buf, len, off);
+}
+
+int AsyncIO::OpenDirect(const int fd, const bool readOnly) {
+  // opening the /proc link gives us a new open file description, so the
+  // O_DIRECT flag doesn't affect fd
+  std::string path = "/proc/self/fd/" + std::to_string(fd);
+  int directFD = open64(path.c_str(),
+      (readOnly ? O_RDONLY : O_RDWR) | O_DIRECT);
+
+  if (directFD == -1) {
+    perror("Failure in AsyncIO::OpenDirect");
+    throw std::runtime_error("Failed to open file for direct I/O");
+  }
+
+  return directFD;
+}
+
+void AsyncIO::SubmitDirect(const Op op, const int fd, const int directFD,
+    char * const buf, const size_t len, const off64_t off) {
+  const off64_t end = off + (off64_t)len;
+  const off64_t align = (off64_t)DirectAlignment;
+
+  // the aligned part [first, last)
+  off64_t first = (off + align - 1) / align * align;
+  off64_t last = end / align * align;
+
+  if (first >= last) {
+    // there is no aligned part
+    first = last = end;
+  }
+
+  auto submit = [&](const int this_fd, const off64_t from, const off64_t to) {
+    for (off64_t o = from; o < to; o += ChunkSize) {
+      size_t n = std::min((off64_t)ChunkSize, to - o);
+      Submit(op, this_fd, buf + (o - off), n, o);
+    }
+  };
+
+  submit(fd, off, first);
+  submit(directFD, first, last);
+  submit(fd, last, end);
+}
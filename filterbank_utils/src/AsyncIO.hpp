@@ -0,0 +1,150 @@
+/*
+ * AsyncIO.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef ASYNCIO_HPP_
+#define ASYNCIO_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+#include <sys/types.h>
+
+// Asynchronous positioned reads and writes. Read and Write queue a request and
+// return right away, the request is carried out in the background and the
+// buffer must stay valid (and untouched) until Wait returns. Queued requests
+// are started at the latest when the queue is full or Flush or Wait is called,
+// so that a backend can submit many requests at once. Large requests are split
+// into chunks of ChunkSize bytes, so that up to the queue depth chunks are in
+// flight at once and the storage sees a deep queue even if we only submit a
+// single big request. Wait blocks until all requests submitted so far have
+// completed and throws if any of them failed.
+class AsyncIO {
+public:
+  static constexpr size_t DefaultQueueDepth = 32;
+  static constexpr size_t ChunkSize = 1024 * 1024; // 1 MB
+
+  // Direct I/O (O_DIRECT) bypasses the page cache, but the file offset, the
+  // length and the address of the buffer must be multiples of this
+  static constexpr size_t DirectAlignment = 4096;
+
+  // use io_uring if the kernel supports it and fall back to a pool of threads
+  // doing blocking reads and writes otherwise
+  static std::unique_ptr<AsyncIO> Create(
+      const size_t queueDepth = DefaultQueueDepth);
+
+  static std::unique_ptr<AsyncIO> CreateThreadPool(
+      const size_t queueDepth = DefaultQueueDepth);
+
+  // implemented in AsyncIO_URING.cpp or AsyncIO_NO_URING.cpp, returns nullptr
+  // if io_uring is not available
+  static std::unique_ptr<AsyncIO> CreateUring(
+      const size_t queueDepth = DefaultQueueDepth);
+
+  virtual ~AsyncIO() {}
+
+  // read exactly len bytes at offset off, reading past the end of the file is
+  // an error
+  void Read(const int fd, void * const buf, const size_t len,
+      const off64_t off);
+
+  // write exactly len bytes at offset off
+  void Write(const int fd, const void * const buf, const size_t len,
+      const off64_t off);
+
+  // Like Read and Write, but the part of the request between the first and the
+  // last multiple of DirectAlignment in the file goes through directFD, which
+  // is the same file opened with O_DIRECT (see OpenDirect). Only the unaligned
+  // head and tail go through fd and the page cache. For this to work, the
+  // buffer must be placed at DirectOffset(off) bytes past an aligned address.
+  void ReadDirect(const int fd, const int directFD, void * const buf,
+      const size_t len, const off64_t off);
+
+  void WriteDirect(const int fd, const int directFD, const void * const buf,
+      const size_t len, const off64_t off);
+
+  static size_t DirectOffset(const off64_t off) {
+    return (size_t)off % DirectAlignment;
+  }
+
+  // open the file of fd again with O_DIRECT, throws if the file system
+  // doesn't support direct I/O
+  static int OpenDirect(const int fd, const bool readOnly);
+
+  // start all queued requests without waiting for them
+  virtual void Flush() = 0;
+
+  virtual void Wait() = 0;
+
+  // name of the backend
+  virtual std::string Name() const = 0;
+
+protected:
+  enum class Op {
+    Read,
+    Write
+  };
+
+  // queue a single request of at most ChunkSize bytes, blocks if the queue is
+  // full
+  virtual void Submit(const Op op, const int fd, char * const buf,
+      const size_t len, const off64_t off) = 0;
+
+private:
+  void SubmitDirect(const Op op, const int fd, const int directFD,
+      char * const buf, const size_t len, const off64_t off);
+};
+
+// heap buffer that is aligned for direct I/O
+class AlignedBuffer {
+public:
+  AlignedBuffer(const size_t size = 0) :
+      mpData(nullptr),
+      mSize(0) {
+    Resize(size);
+  }
+
+  ~AlignedBuffer() {
+    free(mpData);
+  }
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  // the content is not preserved
+  void Resize(const size_t size) {
+    free(mpData);
+    mpData = nullptr;
+    mSize = 0;
+
+    if (size == 0)
+      return;
+
+    if (posix_memalign((void**)&mpData, AsyncIO::DirectAlignment, size) != 0)
+      throw std::bad_alloc();
+    mSize = size;
+  }
+
+  char * Data() {
+    return mpData;
+  }
+
+  const char * Data() const {
+    return mpData;
+  }
+
+  size_t Size() const {
+    return mSize;
+  }
+
+private:
+  char * mpData;
+  size_t mSize;
+};
+
+#endif // ASYNCIO_HPP_
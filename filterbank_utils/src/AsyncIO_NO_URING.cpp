@@ -0,0 +1,11 @@
+/*
+ * AsyncIO_NO_URING.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "AsyncIO.hpp"
+
+std::unique_ptr<AsyncIO> AsyncIO::CreateUring(const size_t /*queueDepth*/) {
+  return nullptr;
+}
@@ -0,0 +1,296 @@
+/*
+ * AsyncIO_URING.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "AsyncIO.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// POSIX
+#ifndef _LARGEFILE64_SOURCE
+  #define _LARGEFILE64_SOURCE 1
+#endif
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// we talk to the kernel directly instead of depending on liburing
+int io_uring_setup(const unsigned entries, io_uring_params * const params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int io_uring_enter(const int fd, const unsigned to_submit,
+    const unsigned min_complete, const unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+      nullptr, 0);
+}
+
+class UringIO : public AsyncIO {
+public:
+  // throws if the kernel doesn't support io_uring (or we are not allowed to
+  // use it)
+  UringIO(const size_t queueDepth) :
+      mRingFD(-1),
+      mEntries(0),
+      mpSQRing(nullptr),
+      mpCQRing(nullptr),
+      mpSQEs(nullptr),
+      mSQRingSize(0),
+      mCQRingSize(0),
+      mNumInFlight(0),
+      mNumToSubmit(0) {
+    try {
+      Init(queueDepth);
+    } catch (...) {
+      Cleanup();
+      throw;
+    }
+  }
+
+  ~UringIO() {
+    // we can't unmap the buffers while the kernel may still use them
+    try {
+      while (mNumInFlight > 0)
+        Reap(1);
+    } catch (...) {
+      // nothing we can do about it here
+    }
+
+    Cleanup();
+  }
+
+  void Flush() {
+    while (mNumToSubmit > 0)
+      Enter(0);
+  }
+
+  void Wait() {
+    while (mNumInFlight > 0)
+      Reap(1);
+
+    if (mError != "") {
+      std::string err = mError;
+      mError = "";
+      throw std::runtime_error(err);
+    }
+  }
+
+  std::string Name() const {
+    return "io_uring";
+  }
+
+protected:
+  void Submit(const Op op, const int fd, char * const buf, const size_t len,
+      const off64_t off) {
+    // wait for a free slot
+    while (mFreeSlots.size() == 0)
+      Reap(1);
+
+    unsigned slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+    ++mNumInFlight;
+
+    mRequests[slot] = { op, fd, buf, len, off };
+    Push(slot);
+  }
+
+private:
+  struct Request {
+    Op op;
+    int fd;
+    char * buf;
+    size_t len;
+    off64_t off;
+  };
+
+  void Init(const size_t queueDepth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    mRingFD = io_uring_setup((unsigned)std::max(queueDepth, (size_t)1),
+        &params);
+    if (mRingFD < 0)
+      throw std::runtime_error("io_uring_setup failed");
+
+    // IORING_OP_READ and IORING_OP_WRITE came with the same kernel (5.6) as
+    // this feature flag
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+      throw std::runtime_error("io_uring too old");
+
+    mEntries = params.sq_entries;
+
+    // map the submission and completion rings and the submission entries
+    mSQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    mCQRingSize = params.cq_off.cqes
+        + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+      mSQRingSize = mCQRingSize = std::max(mSQRingSize, mCQRingSize);
+
+    mpSQRing = Map(mSQRingSize, IORING_OFF_SQ_RING);
+    mpCQRing = single_mmap ? mpSQRing : Map(mCQRingSize, IORING_OFF_CQ_RING);
+    mpSQEs = (io_uring_sqe*)Map(params.sq_entries * sizeof(io_uring_sqe),
+        IORING_OFF_SQES);
+
+    mpSQTail = (unsigned*)(mpSQRing + params.sq_off.tail);
+    mSQMask = *(unsigned*)(mpSQRing + params.sq_off.ring_mask);
+    mpSQArray = (unsigned*)(mpSQRing + params.sq_off.array);
+
+    mpCQHead = (unsigned*)(mpCQRing + params.cq_off.head);
+    mpCQTail = (unsigned*)(mpCQRing + params.cq_off.tail);
+    mCQMask = *(unsigned*)(mpCQRing + params.cq_off.ring_mask);
+    mpCQEs = (io_uring_cqe*)(mpCQRing + params.cq_off.cqes);
+
+    mRequests.resize(mEntries);
+    for (unsigned i = 0; i < mEntries; ++i)
+      mFreeSlots.push_back(mEntries - 1 - i);
+  }
+
+  void Cleanup() {
+    if (mpSQEs != nullptr)
+      munmap(mpSQEs, mEntries * sizeof(io_uring_sqe));
+    if ((mpCQRing != nullptr) && (mpCQRing != mpSQRing))
+      munmap(mpCQRing, mCQRingSize);
+    if (mpSQRing != nullptr)
+      munmap(mpSQRing, mSQRingSize);
+    if (mRingFD >= 0)
+      close(mRingFD);
+  }
+
+  char * Map(const size_t size, const off64_t offset) {
+    void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, mRingFD, offset);
+
+    if (ptr == MAP_FAILED) {
+      perror("Failure in UringIO::Map");
+      throw std::runtime_error("Failed to map io_uring");
+    }
+
+    return (char*)ptr;
+  }
+
+  // put the request in the given slot into the submission queue, there is
+  // always space since we have at most mEntries requests in flight
+  void Push(const unsigned slot) {
+    const Request& req = mRequests[slot];
+
+    unsigned tail = *mpSQTail;
+    unsigned idx = tail & mSQMask;
+
+    io_uring_sqe * sqe = mpSQEs + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req.op == Op::Read ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = req.fd;
+    sqe->addr = (unsigned long long)req.buf;
+    sqe->len = (unsigned)req.len;
+    sqe->off = (unsigned long long)req.off;
+    sqe->user_data = slot;
+
+    mpSQArray[idx] = idx;
+    __atomic_store_n(mpSQTail, tail + 1, __ATOMIC_RELEASE);
+    ++mNumToSubmit;
+  }
+
+  // submit the queued requests and wait for min_complete completions with a
+  // single system call
+  void Enter(const unsigned min_complete) {
+    int ret = io_uring_enter(mRingFD, mNumToSubmit, min_complete,
+        min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+
+    if (ret >= 0) {
+      mNumToSubmit -= std::min((unsigned)ret, mNumToSubmit);
+    } else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+      perror("Failure in UringIO::Enter");
+      throw std::runtime_error("Failed to submit I/O requests");
+    }
+  }
+
+  // wait for at least min_complete completions (unless some are already
+  // there) and process all completions that are available
+  void Reap(const unsigned min_complete) {
+    unsigned head = *mpCQHead;
+
+    if ((mNumToSubmit > 0)
+        || (head == __atomic_load_n(mpCQTail, __ATOMIC_ACQUIRE)))
+      Enter(head == __atomic_load_n(mpCQTail, __ATOMIC_ACQUIRE) ?
+          min_complete : 0);
+
+    while (head != __atomic_load_n(mpCQTail, __ATOMIC_ACQUIRE)) {
+      io_uring_cqe cqe = mpCQEs[head & mCQMask];
+      ++head;
+      __atomic_store_n(mpCQHead, head, __ATOMIC_RELEASE);
+
+      Complete((unsigned)cqe.user_data, cqe.res);
+    }
+  }
+
+  void Complete(const unsigned slot, const int res) {
+    Request& req = mRequests[slot];
+
+    if ((res == -EINTR) || (res == -EAGAIN)) {
+      Push(slot);
+      return;
+    }
+
+    if ((res > 0) && ((size_t)res < req.len)) {
+      // short read or write, submit the rest
+      req.buf += res;
+      req.len -= res;
+      req.off += res;
+      Push(slot);
+      return;
+    }
+
+    if ((res <= 0) && (mError == "")) {
+      if (res == 0)
+        mError = "Unexpected end of file";
+      else
+        mError = std::string(req.op == Op::Read ? "Failed to read: " :
+            "Failed to write: ") + strerror(-res);
+    }
+
+    mFreeSlots.push_back(slot);
+    --mNumInFlight;
+  }
+
+  int mRingFD;
+  unsigned mEntries;
+
+  char * mpSQRing, * mpCQRing;
+  io_uring_sqe * mpSQEs;
+  size_t mSQRingSize, mCQRingSize;
+
+  unsigned * mpSQTail, * mpSQArray;
+  unsigned mSQMask;
+
+  unsigned * mpCQHead, * mpCQTail;
+  unsigned mCQMask;
+  io_uring_cqe * mpCQEs;
+
+  std::vector<Request> mRequests;
+  std::vector<unsigned> mFreeSlots;
+  size_t mNumInFlight;
+  unsigned mNumToSubmit; // in the submission queue, but not submitted yet
+
+  std::string mError; // first error since the last Wait
+};
+
+} // namespace [unnamed]
+
+std::unique_ptr<AsyncIO> AsyncIO::CreateUring(const size_t queueDepth) {
+  try {
+    return std::unique_ptr<AsyncIO>(new UringIO(queueDepth));
+  } catch (std::runtime_error&) {
+    return nullptr;
+  }
+}
@@ -7,13 +7,19 @@
 
 #include "Barycenter.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <limits.h>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <unistd.h>
+#include <vector>
 
 // this is all copied from PRESTA and adapted a bit
 
@@ -48,13 +54,14 @@ size_t chkfread(void *data, size_t type, size_t number, FILE * stream) {
   return num;
 }
 
-int read_resid_rec(FILE * file, double *toa, double *obsf)
+int read_resid_rec(FILE * file, double *toa, double *obsf, int *use_ints)
 /* This routine reads a single record (i.e. 1 TOA) from */
 /* the file resid2.tmp which is written by TEMPO.       */
 /* It returns 1 if successful, 0 if unsuccessful.       */
+/* *use_ints must be -1 for the first record of a file */
+/* so that the size of the block markers is detected.   */
 {
-  static int firsttime = 1, use_ints = 0;
-  static double d[9];
+  double d[9];
 
   // The default Fortran binary block marker has changed
   // several times in recent versions of g77 and gfortran.
@@ -63,7 +70,7 @@ int read_resid_rec(FILE * file, double *toa, double *obsf)
   // So here we try to auto-detect what is going on.
   // The current version should be OK on 32- and 64-bit systems
 
-  if (firsttime) {
+  if (*use_ints < 0) {
     int ii;
     long long ll;
     double dd;
@@ -72,6 +79,7 @@ int read_resid_rec(FILE * file, double *toa, double *obsf)
     chkfread(&dd, sizeof(double), 1, file);
     if (0)
       printf("(long long) index = %lld  (MJD = %17.10f)\n", ll, dd);
+    *use_ints = 0;
     if (ll != 72 || dd < 40000.0 || dd > 70000.0) { // 9 * doubles
       rewind(file);
       chkfread(&ii, sizeof(int), 1, file);
@@ -79,16 +87,15 @@ int read_resid_rec(FILE * file, double *toa, double *obsf)
       if (0)
         printf("(int) index = %d    (MJD = %17.10f)\n", ii, dd);
       if (ii == 72 && (dd > 40000.0 && dd < 70000.0)) {
-        use_ints = 1;
+        *use_ints = 1;
       } else {
         throw std::runtime_error("Error: Can't read the TEMPO residuals "
             "correctly!");
       }
     }
     rewind(file);
-    firsttime = 0;
   }
-  if (use_ints) {
+  if (*use_ints) {
     int ii;
     chkfread(&ii, sizeof(int), 1, file);
   } else {
@@ -110,7 +117,7 @@ int read_resid_rec(FILE * file, double *toa, double *obsf)
   }
   *toa = d[0];
   *obsf = d[4];
-  if (use_ints) {
+  if (*use_ints) {
     int ii;
     return chkfread(&ii, sizeof(int), 1, file);
   } else {
@@ -119,8 +126,36 @@ int read_resid_rec(FILE * file, double *toa, double *obsf)
   }
 }
 
+// The barycentric times TEMPO computed so far, for the topocentric times
+// tstart + i * step of the start MJD, step, RA, DEC, observatory, and
+// ephemeris of the key. The times of each TOA don't depend on the others, so a
+// result can be reused for any number of times up to its length, e.g. for the
+// files of all the bands and polarizations of a scan.
+typedef std::tuple<double, double, std::string, std::string, std::string,
+    std::string> TempoKey;
+
+// Each TEMPO run has its own temporary directory, so different keys run
+// concurrently. tempo_mutex only guards the map, and a thread that needs a key
+// TEMPO is already running for waits on the mutex of that key, then reuses the
+// result if it is long enough.
+struct TempoResult {
+  std::mutex mutex;
+  std::vector<double> times;
+};
+
+std::mutex tempo_mutex;
+std::map<TempoKey, std::unique_ptr<TempoResult>> tempo_results;
+
+TempoResult& get_tempo_result(const TempoKey& key) {
+  std::lock_guard<std::mutex> lock(tempo_mutex);
+  auto& result = tempo_results[key];
+  if (!result)
+    result.reset(new TempoResult());
+  return *result;
 }
 
+} // namespace [unnamed]
+
 void Barycenter::GetBarycenterTimes(const double * const topoTimes,
     double * const baryTimes, const size_t N, const char * const raStr,
     const char * const decStr, const char * const obs,
@@ -129,64 +164,57 @@ void Barycenter::GetBarycenterTimes(const double * const topoTimes,
   if (mkdtemp(tmpdir) == nullptr) {
     throw std::runtime_error("Could not create temp dir");
   }
-  auto origdir = getcwd(nullptr, 0);
-  chdir(tmpdir);
-
-  try {
-    FILE * outfile = fopen("bary.in", "w");
-    if (outfile == nullptr)
-      throw std::runtime_error("Could not create /tmp/bary.in");
-
-    fprintf(outfile, "C  Header Section\n"
-        "  HEAD                    \n"
-        "  PSR                 bary\n"
-        "  NPRNT                  2\n"
-        "  P0                   1.0 1\n"
-        "  P1                   0.0\n"
-        "  CLK            UTC(NIST)\n"
-        "  PEPOCH           %19.13f\n"
-        "  COORD              J2000\n"
-        "  RA                    %s\n"
-        "  DEC                   %s\n"
-        "  DM                   0.0\n"
-        "  EPHEM                 %s\n"
-        "C  TOA Section (uses ITAO Format)\n"
-        "C  First 8 columns must have + or -!\n"
-        "  TOA\n", topoTimes[0], raStr, decStr, ephem);
-
-    for (size_t i = 0; i < N; i++) {
-      fprintf(outfile, "topocen+ %19.13f  0.00     0.0000  0.000000  %s\n",
-          topoTimes[i], obs);
-    }
-
+  // run TEMPO in tmpdir without changing the working directory of the
+  // process, which other threads may depend on
+  const std::string dir(tmpdir);
+
+  FILE * outfile = fopen((dir + "/bary.in").c_str(), "w");
+  if (outfile == nullptr)
+    throw std::runtime_error("Could not create " + dir + "/bary.in");
+
+  fprintf(outfile, "C  Header Section\n"
+      "  HEAD                    \n"
+      "  PSR                 bary\n"
+      "  NPRNT                  2\n"
+      "  P0                   1.0 1\n"
+      "  P1                   0.0\n"
+      "  CLK            UTC(NIST)\n"
+      "  PEPOCH           %19.13f\n"
+      "  COORD              J2000\n"
+      "  RA                    %s\n"
+      "  DEC                   %s\n"
+      "  DM                   0.0\n"
+      "  EPHEM                 %s\n"
+      "C  TOA Section (uses ITAO Format)\n"
+      "C  First 8 columns must have + or -!\n"
+      "  TOA\n", topoTimes[0], raStr, decStr, ephem);
+
+  for (size_t i = 0; i < N; i++) {
     fprintf(outfile, "topocen+ %19.13f  0.00     0.0000  0.000000  %s\n",
-        topoTimes[N - 1] + 10.0 / (3600.0 * 24.0), obs);
-    fprintf(outfile, "topocen+ %19.13f  0.00     0.0000  0.000000  %s\n",
-        topoTimes[N - 1] + 20.0 / (3600.0 * 24.0), obs);
-    fclose(outfile);
-
-    std::string cmd = "tempo bary.in > /dev/null";
-    if (system(cmd.c_str()) == -1) {
-      throw std::runtime_error("Running TEMPO failed");
-    }
+        topoTimes[i], obs);
+  }
 
-    FILE * fin = fopen("resid2.tmp", "rb");
-    if (fin == nullptr)
-      throw std::runtime_error("Could not read resid2.tmp");
+  fprintf(outfile, "topocen+ %19.13f  0.00     0.0000  0.000000  %s\n",
+      topoTimes[N - 1] + 10.0 / (3600.0 * 24.0), obs);
+  fprintf(outfile, "topocen+ %19.13f  0.00     0.0000  0.000000  %s\n",
+      topoTimes[N - 1] + 20.0 / (3600.0 * 24.0), obs);
+  fclose(outfile);
 
-    double dummy;
-    for (size_t i = 0; i < N; i++) {
-      read_resid_rec(fin, baryTimes + i, &dummy);
-    }
-    fclose(fin);
-  } catch (std::exception& ex) {
-    chdir(origdir);
-    free(origdir);
-    throw ex;
+  std::string cmd = "cd " + dir + " && tempo bary.in > /dev/null";
+  if (system(cmd.c_str()) == -1) {
+    throw std::runtime_error("Running TEMPO failed");
   }
 
-  chdir(origdir);
-  free(origdir);
+  FILE * fin = fopen((dir + "/resid2.tmp").c_str(), "rb");
+  if (fin == nullptr)
+    throw std::runtime_error("Could not read " + dir + "/resid2.tmp");
+
+  double dummy;
+  int use_ints = -1;
+  for (size_t i = 0; i < N; i++) {
+    read_resid_rec(fin, baryTimes + i, &dummy, &use_ints);
+  }
+  fclose(fin);
 }
 
 /* Simple linear interpolation macro */
@@ -200,7 +228,7 @@ Barycenter::Barycenter(const double tsampInSec, const double tstartMJD,
     const size_t num, const double ra, const double dec,
     const std::string obs) {
   const double barycenterStep = 20.0;
-  int numbarypts =
+  int64_t numbarypts =
       (tsampInSec * (double)num * 1.1 / barycenterStep + 5.5) + 1;
 
   /* What ephemeris will we use?  (Default is DE405) */
@@ -215,33 +243,45 @@ Barycenter::Barycenter(const double tsampInSec, const double tstartMJD,
   std::vector<double> ttoa(numbarypts);
 
   const double secPerDay = 3600.0 * 24.0;
-  for (int i = 0; i < numbarypts; ++i)
+  for (int64_t i = 0; i < numbarypts; ++i)
     ttoa[i] = tstartMJD + barycenterStep * i / secPerDay;
 
-  /* Call TEMPO for the barycentering */
-  GetBarycenterTimes(ttoa.data(), btoa.data(), numbarypts, RAStr.c_str(), 
-      DecStr.c_str(), obs.c_str(), ephem);
+  /* Call TEMPO for the barycentering, unless it already did */
+  {
+    auto& result = get_tempo_result(TempoKey(tstartMJD, barycenterStep, RAStr,
+        DecStr, obs, ephem));
+    std::lock_guard<std::mutex> lock(result.mutex);
+
+    if (result.times.size() >= (size_t)numbarypts) {
+      std::copy(result.times.begin(), result.times.begin() + numbarypts,
+          btoa.begin());
+    } else {
+      GetBarycenterTimes(ttoa.data(), btoa.data(), numbarypts, RAStr.c_str(),
+          DecStr.c_str(), obs.c_str(), ephem);
+      result.times = btoa;
+    }
+  }
 
   mBaryStartMJD = btoa[0];
 
   /* Convert the bary TOAs to differences from the topo TOAs in  */
   /* units of bin length (dsdt) rounded to the nearest integer.  */
   double dtmp = (btoa[0] - ttoa[0]);
-  for (int i = 0; i < numbarypts; ++i)
+  for (int64_t i = 0; i < numbarypts; ++i)
     btoa[i] = ((btoa[i] - ttoa[i]) - dtmp) * secPerDay / tsampInSec;
 
-  int numdiffbins = abs(NEAREST_LONG(btoa[numbarypts - 1])) + 1;
+  int64_t numdiffbins = std::abs(NEAREST_LONG(btoa[numbarypts - 1])) + 1;
   mDiffbins.resize(numdiffbins);
-  int * diffbinptr = nullptr;
+  int64_t * diffbinptr = nullptr;
 
   /* Find the points where we need to add or remove bins */
 
-  int oldbin = 0, currentbin;
+  int64_t oldbin = 0, currentbin;
   double lobin, hibin, calcpt;
 
   diffbinptr = mDiffbins.data();
 
-  for (int i = 1; i < numbarypts; ++i) {
+  for (int64_t i = 1; i < numbarypts; ++i) {
     currentbin = NEAREST_LONG(btoa[i]);
     if (currentbin != oldbin) {
       if (currentbin > 0) {
@@ -264,14 +304,14 @@ Barycenter::Barycenter(const double tsampInSec, const double tstartMJD,
       oldbin = currentbin;
     }
   }
-  *diffbinptr = (int)num; /* Used as a marker */
+  *diffbinptr = (int64_t)num; /* Used as a marker */
 }
 
 void Barycenter::DoBarycenterCorrection(const float * const datIn,
     float * const datOut, const size_t numOut) {
-  int num = (int)numOut;
+  const int64_t num = (int64_t)numOut;
   /* The number of data points to work with at a time */
-  int worklen = 8 * 1024;
+  int64_t worklen = 8 * 1024;
   if (worklen > num)
     worklen = num;
   worklen = (worklen / 1024) * 1024;
@@ -279,21 +319,21 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
   /* Allocate our data array */
   std::vector<float> outdata(worklen);
 
-  int numread = 0;
-  int numadded = 0;
-  int numremoved = 0;
+  int64_t numread = 0;
+  int64_t numadded = 0;
+  int64_t numremoved = 0;
 
-  int totwrote = 0;
-  int datawrote = 0;
-  int numtowrite = 0;
+  int64_t totwrote = 0;
+  int64_t datawrote = 0;
+  int64_t numtowrite = 0;
 
-  int inputIdx = 0;
-  int outputIdx = 0;
+  int64_t inputIdx = 0;
+  int64_t outputIdx = 0;
 
-  int * diffbinptr = mDiffbins.data();
+  int64_t * diffbinptr = mDiffbins.data();
 
   do { /* Loop to read and write the data */
-    int numwritten = 0;
+    int64_t numwritten = 0;
 
     numread = worklen;
     if (inputIdx + numread > num)
@@ -306,7 +346,7 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
 
     /* Determine the approximate local average */
     double block_avg = 0.0;
-    for (int i = 0; i < numread; ++i)
+    for (int64_t i = 0; i < numread; ++i)
       block_avg += outdata[i];
     block_avg /= (double)numread;
 
@@ -315,7 +355,7 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
     /* OR write the amount of data up to cmd->numout or */
     /* the next bin that will be added or removed.      */
 
-    numtowrite = abs(*diffbinptr) - datawrote;
+    numtowrite = std::abs(*diffbinptr) - datawrote;
     /* FIXME: numtowrite+totwrote can wrap! */
     if ((totwrote + numtowrite) > num)
       numtowrite = num - totwrote;
@@ -329,10 +369,10 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
     totwrote += numtowrite;
     numwritten += numtowrite;
 
-    if ((datawrote == abs(*diffbinptr)) && (numwritten != numread)
+    if ((datawrote == std::abs(*diffbinptr)) && (numwritten != numread)
         && (totwrote < num)) { /* Add/remove a bin */
       float favg;
-      int skip, nextdiffbin;
+      int64_t skip, nextdiffbin;
 
       skip = numtowrite;
 
@@ -360,8 +400,8 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
         numtowrite = numread - numwritten;
         if ((totwrote + numtowrite) > num)
           numtowrite = num - totwrote;
-        nextdiffbin = abs(*diffbinptr) - datawrote;
-        if ((int)numtowrite > nextdiffbin)
+        nextdiffbin = std::abs(*diffbinptr) - datawrote;
+        if (numtowrite > nextdiffbin)
           numtowrite = nextdiffbin;
 
         memcpy(datOut + outputIdx, outdata.data() + skip,
@@ -389,7 +429,7 @@ void Barycenter::DoBarycenterCorrection(const float * const datIn,
 
   // pad with 0's if necessary
   if (num > totwrote) {
-    int numPad = num - totwrote;
+    int64_t numPad = num - totwrote;
     memset(datOut + outputIdx, 0, numPad * sizeof(float));
   }
 }
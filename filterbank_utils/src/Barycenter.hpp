@@ -8,6 +8,7 @@
 #ifndef SRC_BARYCENTER_HPP_
 #define SRC_BARYCENTER_HPP_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -30,7 +31,8 @@ public:
   }
 
 private:
-  std::vector<int> mDiffbins;
+  // sample indices where a bin is added (> 0) or removed (< 0)
+  std::vector<int64_t> mDiffbins;
   double mBaryStartMJD;
 };
 
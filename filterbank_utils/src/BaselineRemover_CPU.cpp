@@ -9,24 +9,65 @@
 
 #include <cmath>
 #include <cstring>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 
 #include <fftw3.h>
 
+namespace {
+
+struct Plans {
+  fftwf_plan r2c, c2r;
+};
+
+// The plans for each length are created once and shared by all
+// BaselineRemovers, which run them on their own buffers. The FFTW planner is
+// not thread-safe, so only one thread at a time may create plans. The plans
+// are destroyed at exit, when no BaselineRemover uses them anymore.
+struct PlanCache {
+  ~PlanCache() {
+    for (auto& p : plans) {
+      fftwf_destroy_plan(p.second.r2c);
+      fftwf_destroy_plan(p.second.c2r);
+    }
+  }
+
+  std::mutex mutex;
+  std::map<size_t, Plans> plans;
+};
+
+PlanCache plan_cache;
+
+Plans get_plans(const size_t N_pad, float * const dat_real,
+    fftwf_complex * const dat_complex) {
+  std::lock_guard<std::mutex> lock(plan_cache.mutex);
+
+  auto itr = plan_cache.plans.find(N_pad);
+  if (itr != plan_cache.plans.end())
+    return itr->second;
+
+  Plans p;
+  p.r2c = fftwf_plan_dft_r2c_1d(N_pad, dat_real, dat_complex, FFTW_ESTIMATE);
+  p.c2r = fftwf_plan_dft_c2r_1d(N_pad, dat_complex, dat_real, FFTW_ESTIMATE);
+  plan_cache.plans[N_pad] = p;
+
+  return p;
+}
+
+} // namespace [unnamed]
+
 struct CPU_Impl : public Impl {
   CPU_Impl(const size_t N_pad, const size_t out_size) {
     dat_real = (float*)fftw_malloc(out_size);
     dat_complex = (fftwf_complex*)dat_real;
 
-    plan_r2c = fftwf_plan_dft_r2c_1d(N_pad, dat_real, dat_complex,
-        FFTW_ESTIMATE);
-    plan_c2r = fftwf_plan_dft_c2r_1d(N_pad, dat_complex, dat_real,
-        FFTW_ESTIMATE);
+    auto p = get_plans(N_pad, dat_real, dat_complex);
+    plan_r2c = p.r2c;
+    plan_c2r = p.c2r;
   }
 
   ~CPU_Impl() {
-    fftwf_destroy_plan(plan_r2c);
-    fftwf_destroy_plan(plan_c2r);
     fftw_free(dat_real);
   }
 
@@ -63,7 +104,7 @@ void BaselineRemover::CPU_Process_batch(float * const data,
     for (size_t i = 0; i < mN; ++i)
       impl->dat_real[i] -= mean;
 
-    fftwf_execute(impl->plan_r2c);
+    fftwf_execute_dft_r2c(impl->plan_r2c, impl->dat_real, impl->dat_complex);
 
     // apply high pass filter
     for (size_t i = 0; i < mNum_out; ++i) {
@@ -74,7 +115,7 @@ void BaselineRemover::CPU_Process_batch(float * const data,
       impl->dat_complex[i][1] *= mult;
     }
 
-    fftwf_execute(impl->plan_c2r);
+    fftwf_execute_dft_c2r(impl->plan_c2r, impl->dat_complex, impl->dat_real);
 
     memcpy(data + c * mN, impl->dat_real, mN * sizeof(float));
   }
@@ -0,0 +1,225 @@
+/*
+ * BitPacking.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "BitPacking.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define BITPACKING_X86 1
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+void unpack_scalar(const unsigned char * const in, const size_t first_value,
+    float * const out, const size_t num_values, const int nbits) {
+  if (nbits == 8) {
+    const unsigned char * const src = in + first_value;
+    for (size_t i = 0; i < num_values; ++i)
+      out[i] = (float)src[i];
+  } else if (nbits == 16) {
+    const unsigned char * const src = in + 2 * first_value;
+    for (size_t i = 0; i < num_values; ++i) {
+      uint16_t v;
+      memcpy(&v, src + 2 * i, sizeof(v));
+      out[i] = (float)v;
+    }
+  } else {
+    const unsigned int mask = (1u << nbits) - 1;
+    for (size_t i = 0; i < num_values; ++i) {
+      size_t bit = (first_value + i) * nbits;
+      out[i] = (float)((in[bit / 8] >> (bit % 8)) & mask);
+    }
+  }
+}
+
+// The scale and offset of value i are scale[i * STEP] and offset[i * STEP], so
+// STEP = 0 uses the same scale and offset for all values
+template<size_t STEP>
+void quantize_scalar(const float * const in, const float * const scale,
+    const float * const offset, unsigned char * const out,
+    const size_t num_values, const int nbits) {
+  const float max_val = (float)((1u << nbits) - 1);
+
+  for (size_t i = 0; i < num_values; ++i) {
+    float v = in[i] * scale[i * STEP] + offset[i * STEP];
+    // written such that NaN becomes 0
+    v = v > 0.0f ? v : 0.0f;
+    v = std::min(v, max_val);
+
+    unsigned int q = (unsigned int)std::lrint(v);
+    if (nbits == 8) {
+      out[i] = (unsigned char)q;
+    } else {
+      uint16_t w = (uint16_t)q;
+      memcpy(out + 2 * i, &w, sizeof(w));
+    }
+  }
+}
+
+#ifdef BITPACKING_X86
+
+// Unpack num_values values starting at a byte boundary in groups of 8 values,
+// returns the number of values unpacked (a multiple of 8). The 8 values of a
+// group with nbits <= 4 fit into nbits bytes, which we broadcast to all lanes
+// and shift lane i right by i * nbits.
+__attribute__((target("avx2")))
+size_t unpack_avx2(const unsigned char * const in, float * const out,
+    const size_t num_values, const int nbits) {
+  const size_t num_groups = num_values / 8;
+
+  if (nbits == 8) {
+    for (size_t g = 0; g < num_groups; ++g) {
+      __m128i bytes = _mm_loadl_epi64((const __m128i*)(in + 8 * g));
+      __m256i ints = _mm256_cvtepu8_epi32(bytes);
+      _mm256_storeu_ps(out + 8 * g, _mm256_cvtepi32_ps(ints));
+    }
+  } else if (nbits == 16) {
+    for (size_t g = 0; g < num_groups; ++g) {
+      __m128i words = _mm_loadu_si128((const __m128i*)(in + 16 * g));
+      __m256i ints = _mm256_cvtepu16_epi32(words);
+      _mm256_storeu_ps(out + 8 * g, _mm256_cvtepi32_ps(ints));
+    }
+  } else {
+    const __m256i shifts = _mm256_mullo_epi32(
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(nbits));
+    const __m256i mask = _mm256_set1_epi32((1 << nbits) - 1);
+
+    for (size_t g = 0; g < num_groups; ++g) {
+      uint32_t packed = 0;
+      memcpy(&packed, in + nbits * g, nbits);
+
+      __m256i ints = _mm256_srlv_epi32(_mm256_set1_epi32((int)packed), shifts);
+      ints = _mm256_and_si256(ints, mask);
+      _mm256_storeu_ps(out + 8 * g, _mm256_cvtepi32_ps(ints));
+    }
+  }
+
+  return 8 * num_groups;
+}
+
+// Quantize groups of 8 values, returns the number of values quantized (a
+// multiple of 8). The clamping is done on the floats, since the conversion to
+// int32 overflows for large values. _mm256_max_ps returns its second operand if
+// either one is NaN, so NaN becomes 0.
+template<size_t STEP>
+__attribute__((target("avx2")))
+size_t quantize_avx2(const float * const in, const float * const scale,
+    const float * const offset, unsigned char * const out,
+    const size_t num_values, const int nbits) {
+  const size_t num_groups = num_values / 8;
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max_val = _mm256_set1_ps((float)((1u << nbits) - 1));
+
+  for (size_t g = 0; g < num_groups; ++g) {
+    __m256 s = STEP == 0 ? _mm256_set1_ps(scale[0])
+        : _mm256_loadu_ps(scale + 8 * g);
+    __m256 o = STEP == 0 ? _mm256_set1_ps(offset[0])
+        : _mm256_loadu_ps(offset + 8 * g);
+
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(in + 8 * g), s), o);
+    v = _mm256_min_ps(_mm256_max_ps(v, zero), max_val);
+
+    // round to nearest even like lrint
+    __m256i ints = _mm256_cvtps_epi32(v);
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(ints),
+        _mm256_extracti128_si256(ints, 1));
+
+    if (nbits == 8) {
+      _mm_storel_epi64((__m128i*)(out + 8 * g),
+          _mm_packus_epi16(words, words));
+    } else {
+      _mm_storeu_si128((__m128i*)(out + 16 * g), words);
+    }
+  }
+
+  return 8 * num_groups;
+}
+
+bool have_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+#endif // BITPACKING_X86
+
+void quantize_dispatch(const float * const in, const float * const scale,
+    const float * const offset, const bool per_value, unsigned char * out,
+    const size_t num_values, const int nbits) {
+  if (!is_quantized_nbits(nbits))
+    throw std::invalid_argument("Cannot quantize to " + std::to_string(nbits)
+        + " bits");
+
+  size_t done = 0;
+
+#ifdef BITPACKING_X86
+  if (have_avx2()) {
+    if (per_value)
+      done = quantize_avx2<1>(in, scale, offset, out, num_values, nbits);
+    else
+      done = quantize_avx2<0>(in, scale, offset, out, num_values, nbits);
+  }
+#endif
+
+  const size_t step = per_value ? done : 0;
+  if (per_value)
+    quantize_scalar<1>(in + done, scale + step, offset + step,
+        out + done * nbits / 8, num_values - done, nbits);
+  else
+    quantize_scalar<0>(in + done, scale, offset, out + done * nbits / 8,
+        num_values - done, nbits);
+}
+
+} // namespace [unnamed]
+
+void unpack_to_float(const void * const in, const size_t first_value,
+    float * const out, const size_t num_values, const int nbits) {
+  if (!is_packed_nbits(nbits))
+    throw std::invalid_argument("Cannot unpack " + std::to_string(nbits)
+        + "-bit data");
+
+  const unsigned char * const src = (const unsigned char*)in;
+
+#ifdef BITPACKING_X86
+  if (have_avx2()) {
+    // unpack the values before the first byte boundary one by one
+    const size_t per_byte = nbits < 8 ? 8 / nbits : 1;
+    size_t head = (per_byte - first_value % per_byte) % per_byte;
+    head = head < num_values ? head : num_values;
+    unpack_scalar(src, first_value, out, head, nbits);
+
+    size_t start = first_value + head;
+    size_t done = head + unpack_avx2(src + start * nbits / 8, out + head,
+        num_values - head, nbits);
+
+    unpack_scalar(src, first_value + done, out + done, num_values - done,
+        nbits);
+    return;
+  }
+#endif
+
+  unpack_scalar(src, first_value, out, num_values, nbits);
+}
+
+void quantize_from_float(const float * const in, const float scale,
+    const float offset, void * const out, const size_t num_values,
+    const int nbits) {
+  quantize_dispatch(in, &scale, &offset, false, (unsigned char*)out,
+      num_values, nbits);
+}
+
+void quantize_from_float(const float * const in, const float * const scales,
+    const float * const offsets, void * const out, const size_t num_values,
+    const int nbits) {
+  quantize_dispatch(in, scales, offsets, true, (unsigned char*)out, num_values,
+      nbits);
+}
@@ -0,0 +1,43 @@
+/*
+ * BitPacking.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef BITPACKING_HPP_
+#define BITPACKING_HPP_
+
+#include <cstddef>
+
+// true if we know how to unpack nbits-bit sigproc data (1, 2, 4, 8, 16 bits)
+inline bool is_packed_nbits(const int nbits) {
+  return (nbits == 1) || (nbits == 2) || (nbits == 4) || (nbits == 8)
+      || (nbits == 16);
+}
+
+// Unpack num_values unsigned nbits-bit integers into floats. Values with fewer
+// than 8 bits are packed into bytes with the first value in the least
+// significant bits, as SIGPROC does. Unpacking starts at value first_value
+// relative to in, so that we can start in the middle of a byte. Uses AVX2 if
+// the CPU supports it.
+void unpack_to_float(const void * const in, const std::size_t first_value,
+    float * const out, const std::size_t num_values, const int nbits);
+
+// true if we know how to quantize floats to nbits-bit sigproc data (8, 16 bits)
+inline bool is_quantized_nbits(const int nbits) {
+  return (nbits == 8) || (nbits == 16);
+}
+
+// Quantize num_values floats to unsigned nbits-bit integers as
+// round(in[i] * scale + offset), clamped to the range of the integer type (NaN
+// becomes 0). Uses AVX2 if the CPU supports it.
+void quantize_from_float(const float * const in, const float scale,
+    const float offset, void * const out, const std::size_t num_values,
+    const int nbits);
+
+// same as above, but with a separate scale and offset for each value
+void quantize_from_float(const float * const in, const float * const scales,
+    const float * const offsets, void * const out, const std::size_t num_values,
+    const int nbits);
+
+#endif // BITPACKING_HPP_
@@ -0,0 +1,210 @@
+/*
+ * Decimate.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Decimate.hpp"
+
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define DECIMATE_X86 1
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+// The kernels are templates on the factor F, F = 0 is the generic kernel that
+// uses the factor passed at run time.
+
+template<size_t F>
+void decimate_scalar_kernel(const float * const in, float * const out,
+    const size_t num_out, const size_t factor) {
+  const size_t f = F > 0 ? F : factor;
+
+  for (size_t t = 0; t < num_out; ++t) {
+    double sum = 0.0;
+    for (size_t i = 0; i < f; ++i)
+      sum += in[t * f + i];
+    out[t] = sum / (double)f;
+  }
+}
+
+#ifdef DECIMATE_X86
+
+// The SIMD kernels compute a vector of W outputs (W = 4 doubles for AVX2, 8 for
+// AVX-512) at a time. If the factor is a multiple of W, the values of each
+// output are summed vertically into a vector of W partial sums, and the W
+// vectors of the W outputs are reduced by log2(W) levels of adding adjacent
+// pairs. Otherwise, the factor divides W and the W * factor values of the W
+// outputs are loaded into factor vectors, which are reduced by log2(factor)
+// such levels. Each level keeps the order of the values, so the result ends up
+// in the order of the outputs. Returns the number of outputs done.
+
+// [a0 + a1, a2 + a3, b0 + b1, b2 + b3]
+__attribute__((target("avx2")))
+inline __m256d pair_sums_avx2(const __m256d a, const __m256d b) {
+  return _mm256_permute4x64_pd(_mm256_hadd_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+template<size_t F>
+__attribute__((target("avx2")))
+size_t decimate_avx2(const float * const in, float * const out,
+    const size_t num_out, const size_t factor) {
+  const size_t f = F > 0 ? F : factor;
+  const size_t num_groups = num_out / 4;
+  const __m256d div = _mm256_set1_pd((double)f);
+
+  for (size_t g = 0; g < num_groups; ++g) {
+    const float * const src = in + 4 * f * g;
+    __m256d v[4];
+    size_t n;
+
+    if (f % 4 == 0) {
+      for (size_t j = 0; j < 4; ++j) {
+        const float * const x = src + j * f;
+        __m256d sum = _mm256_cvtps_pd(_mm_loadu_ps(x));
+        for (size_t i = 4; i < f; i += 4)
+          sum = _mm256_add_pd(sum, _mm256_cvtps_pd(_mm_loadu_ps(x + i)));
+        v[j] = sum;
+      }
+      n = 4;
+    } else {
+      for (size_t j = 0; j < f; ++j)
+        v[j] = _mm256_cvtps_pd(_mm_loadu_ps(src + 4 * j));
+      n = f;
+    }
+
+    for (; n > 1; n /= 2) {
+      for (size_t i = 0; i < n / 2; ++i)
+        v[i] = pair_sums_avx2(v[2 * i], v[2 * i + 1]);
+    }
+
+    _mm_storeu_ps(out + 4 * g, _mm256_cvtpd_ps(_mm256_div_pd(v[0], div)));
+  }
+
+  return 4 * num_groups;
+}
+
+// [a0 + a1, a2 + a3, ..., a6 + a7, b0 + b1, ..., b6 + b7]
+__attribute__((target("avx512f")))
+inline __m512d pair_sums_avx512(const __m512d a, const __m512d b) {
+  const __m512i even = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+  const __m512i odd = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+  return _mm512_add_pd(_mm512_permutex2var_pd(a, even, b),
+      _mm512_permutex2var_pd(a, odd, b));
+}
+
+// the unmasked conversions make GCC warn about their undefined source vector
+__attribute__((target("avx512f")))
+inline __m512d load_avx512(const float * const x) {
+  return _mm512_maskz_cvtps_pd(0xFF, _mm256_loadu_ps(x));
+}
+
+__attribute__((target("avx512f")))
+inline void store_avx512(float * const x, const __m512d v) {
+  _mm256_storeu_ps(x, _mm512_maskz_cvtpd_ps(0xFF, v));
+}
+
+template<size_t F>
+__attribute__((target("avx512f")))
+size_t decimate_avx512(const float * const in, float * const out,
+    const size_t num_out, const size_t factor) {
+  const size_t f = F > 0 ? F : factor;
+  const size_t num_groups = num_out / 8;
+  const __m512d div = _mm512_set1_pd((double)f);
+
+  for (size_t g = 0; g < num_groups; ++g) {
+    const float * const src = in + 8 * f * g;
+    __m512d v[8];
+    size_t n;
+
+    if (f % 8 == 0) {
+      for (size_t j = 0; j < 8; ++j) {
+        const float * const x = src + j * f;
+        __m512d sum = load_avx512(x);
+        for (size_t i = 8; i < f; i += 8)
+          sum = _mm512_add_pd(sum, load_avx512(x + i));
+        v[j] = sum;
+      }
+      n = 8;
+    } else {
+      for (size_t j = 0; j < f; ++j)
+        v[j] = load_avx512(src + 8 * j);
+      n = f;
+    }
+
+    for (; n > 1; n /= 2) {
+      for (size_t i = 0; i < n / 2; ++i)
+        v[i] = pair_sums_avx512(v[2 * i], v[2 * i + 1]);
+    }
+
+    store_avx512(out + 8 * g, _mm512_div_pd(v[0], div));
+  }
+
+  return 8 * num_groups;
+}
+
+bool have_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+bool have_avx512() {
+  static const bool avx512 = __builtin_cpu_supports("avx512f");
+  return avx512;
+}
+
+#endif // DECIMATE_X86
+
+template<size_t F>
+void decimate_dispatch(const float * const in, float * const out,
+    const size_t num_out, const size_t factor) {
+  size_t done = 0;
+
+#ifdef DECIMATE_X86
+  if (have_avx512() && ((factor % 8 == 0) || (factor == 2) || (factor == 4)))
+    done = decimate_avx512<F>(in, out, num_out, factor);
+  else if (have_avx2() && ((factor % 4 == 0) || (factor == 2)))
+    done = decimate_avx2<F>(in, out, num_out, factor);
+#endif
+
+  decimate_scalar_kernel<F>(in + done * factor, out + done, num_out - done,
+      factor);
+}
+
+} // namespace [unnamed]
+
+void decimate(const float * const in, float * const out, const size_t num_out,
+    const size_t factor) {
+  switch (factor) {
+  case 0:
+    throw std::invalid_argument("Cannot decimate by a factor of 0");
+  case 2:
+    decimate_dispatch<2>(in, out, num_out, factor);
+    break;
+  case 4:
+    decimate_dispatch<4>(in, out, num_out, factor);
+    break;
+  case 8:
+    decimate_dispatch<8>(in, out, num_out, factor);
+    break;
+  case 16:
+    decimate_dispatch<16>(in, out, num_out, factor);
+    break;
+  case 32:
+    decimate_dispatch<32>(in, out, num_out, factor);
+    break;
+  default:
+    decimate_dispatch<0>(in, out, num_out, factor);
+  }
+}
+
+void decimate_scalar(const float * const in, float * const out,
+    const size_t num_out, const size_t factor) {
+  if (factor == 0)
+    throw std::invalid_argument("Cannot decimate by a factor of 0");
+
+  decimate_scalar_kernel<0>(in, out, num_out, factor);
+}
@@ -0,0 +1,23 @@
+/*
+ * Decimate.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef DECIMATE_HPP_
+#define DECIMATE_HPP_
+
+#include <cstddef>
+
+// Average consecutive groups of factor values: out[t] is the mean of
+// in[t * factor], ..., in[(t + 1) * factor - 1] for t < num_out. The sums are
+// accumulated in double precision. Uses AVX-512 or AVX2 if the CPU supports
+// them, with kernels specialized for the factors 2, 4, 8, 16, and 32.
+void decimate(const float * const in, float * const out,
+    const std::size_t num_out, const std::size_t factor);
+
+// the plain C++ implementation, for testing and benchmarking
+void decimate_scalar(const float * const in, float * const out,
+    const std::size_t num_out, const std::size_t factor);
+
+#endif // DECIMATE_HPP_
@@ -17,6 +17,7 @@
   #define _LARGEFILE64_SOURCE 1
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <boost/filesystem.hpp>
@@ -63,10 +64,17 @@ std::string GetInputPrefix(const std::string& dada) {
 
 } // namespace [unnamed]
 
+constexpr size_t MakeFilterbank::BlockSize;
+
 MakeFilterbank::MakeFilterbank(const MakeFilterbankConfig& config) :
   mConf(config),
+  mDirectIO(false),
+  mDropBehind(false),
+  mBlockLen(0),
+  mOutSlotSize(0),
   mInBuf(nullptr),
-  mOutBuf(nullptr) {
+  mOutBuf(nullptr),
+  mpIO(AsyncIO::Create()) {
   printf("Input config:\n");
   printf("  Bandwidth: %.3f\n", mConf.Bandwidth_MHz);
   printf("  Channel offset: %.3f\n", mConf.ChannelOffset_MHz);
@@ -158,10 +166,25 @@ MakeFilterbank::MakeFilterbank(const MakeFilterbankConfig& config) :
     mHeaders[i] = thisHead;
   }
 
-  // allocate buffer
+  // allocate buffers for two blocks of spectra
   size_t bufSize = (size_t)mConf.NumChannels * mConf.Filterbanks.size();
-  mInBuf = (char*)malloc(bufSize * (size_t)(mConf.InputBits / 8));
-  mOutBuf = (char*)malloc(bufSize * (size_t)(mConf.OutputBits / 8));
+  mBlockLen = std::max(BlockSize / (bufSize * (size_t)(mConf.InputBits / 8)),
+      (size_t)1);
+  mInBuf = (char*)malloc(2 * mBlockLen * bufSize
+      * (size_t)(mConf.InputBits / 8));
+
+  // leave room to place the data at its file offset relative to an aligned
+  // address
+  const size_t align = AsyncIO::DirectAlignment;
+  mOutSlotSize = mBlockLen * (size_t)mConf.NumChannels
+      * (size_t)(mConf.OutputBits / 8);
+  mOutSlotSize = (mOutSlotSize + 2 * align - 1) / align * align;
+  if (posix_memalign((void**)&mOutBuf, align,
+      2 * mConf.Filterbanks.size() * mOutSlotSize) != 0)
+    mOutBuf = nullptr;
+
+  if ((mInBuf == nullptr) || (mOutBuf == nullptr))
+    throw std::runtime_error("Failed to allocate buffers");
 }
 
 MakeFilterbank::~MakeFilterbank() {
@@ -424,6 +447,13 @@ void MakeFilterbank::MakeSigProcFiles(const std::string& inputPath,
 #endif
 
     mpFils.emplace_back(new SigProc(fname, header));
+
+    mWriteOffsets.push_back(mpFils.back()->HeaderSize());
+
+    if (mDirectIO)
+      mpFils.back()->SetDirectIO(true);
+
+    mpFils.back()->SetDropBehind(mDropBehind);
   }
 }
 
@@ -431,6 +461,7 @@ void MakeFilterbank::CloseSigProcFiles() {
   for (size_t i = 0; i < mpFils.size(); ++i)
     mpFils[i].reset();
   mpFils.clear();
+  mWriteOffsets.clear();
 }
 
 template<bool FLIP, bool BIGENDIAN>
@@ -438,18 +469,24 @@ void MakeFilterbank::Do2ProcessDadaFile(const std::string& dadaFile) {
   printf("Processing %s... %3i%%", dadaFile.c_str(), 0);
   fflush(stdout);
 
-  std::ifstream istm(dadaFile, std::fstream::in | std::fstream::binary);
+  int fd = open64(dadaFile.c_str(), O_RDONLY);
 
-  if (istm.fail()) {
+  if (fd == -1) {
     printf("\n");
     throw std::runtime_error("Failed to open file '" + dadaFile + "'");
   }
 
-  // get file size
-  istm.seekg(0, std::ios::end);
-  // subtract header size
-  size_t size = (size_t)istm.tellg() - (size_t)(512 * 8);
-  istm.seekg(512 * 8, std::ios::beg); // skip header
+  // get file size and subtract header size
+  const off64_t headerSize = 512 * 8;
+  off64_t fileSize = lseek64(fd, 0, SEEK_END);
+
+  if (fileSize < headerSize) {
+    printf("\n");
+    close(fd);
+    throw std::runtime_error("File '" + dadaFile + "' is too small");
+  }
+
+  size_t size = (size_t)(fileSize - headerSize);
 
   size_t specSize = mpFils.size()
       * (size_t)(mConf.NumChannels * mConf.InputBits / 8);
@@ -457,57 +494,128 @@ void MakeFilterbank::Do2ProcessDadaFile(const std::string& dadaFile) {
 
   if (numSpec * specSize != size) {
     printf("\n");
+    close(fd);
     throw std::runtime_error("File '" + dadaFile + "' does not contain an "
         "integer number of spectra");
   }
 
-  uint16_t * in = (uint16_t*)mInBuf;
-  float * out = (float*)mOutBuf;
+  // Each block of spectra is read with a single asynchronous read and
+  // converted into one contiguous block per filterbank file, which is written
+  // with a single asynchronous write. While we convert one block, the next
+  // block is being read and the previous one is being written.
   const int stride = 4; // TODO is this always 4 or is it mpFils.size()?
+  const int part = mConf.NumChannels / stride;
+  const size_t inBlockSize = mBlockLen * specSize;
+
+  AsyncIO& io = *mpIO;
+
+  // the data of each file before this offset has been written, report the
+  // blocks written since then, so that their writeback starts right away
+  std::vector<off64_t> written(mWriteOffsets);
+  auto report_written = [&]() {
+    for (size_t f = 0; f < mpFils.size(); ++f) {
+      mpFils[f]->Written(written[f], mWriteOffsets[f] - written[f]);
+      written[f] = mWriteOffsets[f];
+    }
+  };
+
+  auto read_block = [&](const size_t s0, const size_t k) {
+    size_t len = std::min(mBlockLen, numSpec - s0);
+    io.Read(fd, mInBuf + (k % 2) * inBlockSize, len * specSize,
+        headerSize + s0 * specSize);
+    io.Flush();
+  };
 
 #ifdef _OPENMP
   omp_set_num_threads(mpFils.size());
 #endif
 
-  for (size_t s = 0; s < numSpec; ++s) {
-    istm.read(mInBuf, specSize);
+  try {
+    if (numSpec > 0)
+      read_block(0, 0);
+
+    for (size_t s0 = 0, k = 0; s0 < numSpec; s0 += mBlockLen, ++k) {
+      size_t len = std::min(mBlockLen, numSpec - s0);
+
+      // this also waits for the writes of the previous block, whose output
+      // buffer we'll use for the next block
+      io.Wait();
+      report_written();
+      if (s0 + len < numSpec)
+        read_block(s0 + len, k + 1);
+
+      const uint16_t * in = (const uint16_t*)(mInBuf + (k % 2) * inBlockSize);
+
+      // with direct I/O, the data of each file is placed at its file offset
+      // relative to the aligned slot
+      std::vector<float*> out(mpFils.size());
+      for (size_t f = 0; f < mpFils.size(); ++f) {
+        out[f] = (float*)(mOutBuf + ((k % 2) * mpFils.size() + f) * mOutSlotSize
+            + (mDirectIO ? AsyncIO::DirectOffset(mWriteOffsets[f]) : 0));
+      }
 
 #ifdef _OPENMP
-    #pragma omp parallel for
+      #pragma omp parallel for
 #endif
-    for (size_t f = 0; f < mpFils.size(); ++f) {
-      size_t off = f * mConf.NumChannels;
-      int part = mConf.NumChannels / stride;
-
-      for (int p = 0; p < stride; ++p) {
-        for (int i = 0; i < part; ++i) {
-          size_t inIdx =
-              FLIP ? mConf.NumChannels - 1 - (p * part + i) : p * part + i;
-          uint16_t val = in[off + stride * i + p];
-          val = BIGENDIAN ? be16toh(val) : le16toh(val);
-          out[off + inIdx] = (float)val;
+      for (size_t f = 0; f < mpFils.size(); ++f) {
+        float * filOut = out[f];
+
+        for (size_t t = 0; t < len; ++t) {
+          const uint16_t * spec = in + t * mpFils.size() * mConf.NumChannels
+              + f * mConf.NumChannels;
+          float * row = filOut + t * mNumChans[f];
+
+          // the channels are interleaved in groups of stride
+          for (int c = 0; c < mNumChans[f]; ++c) {
+            int idx = mStart[f] + c;
+            idx = FLIP ? mConf.NumChannels - 1 - idx : idx;
+
+            if (idx >= part * stride) {
+              row[c] = 0.0f;
+              continue;
+            }
+
+            uint16_t val = spec[stride * (idx % part) + idx / part];
+            val = BIGENDIAN ? be16toh(val) : le16toh(val);
+            row[c] = (float)val;
+          }
         }
       }
 
-      // write to filterbank files
-      size_t len = mNumChans[f] * mConf.OutputBits / 8;
-
-      if ((size_t)write(mpFils[f]->FD(), (char*)(out + off + mStart[f]), len)
-          != len) {
-        perror("Failure in MakeFilterbank::Do2ProcessDadaFile");
-        throw std::runtime_error("Failed to write data");
+      // write to filterbank files, a pipe is written right away and in order
+      for (size_t f = 0; f < mpFils.size(); ++f) {
+        size_t bytes = len * mNumChans[f] * mConf.OutputBits / 8;
+        if (mpFils[f]->Sequential())
+          mpFils[f]->WriteBytes(out[f], bytes, mWriteOffsets[f]);
+        else if (mDirectIO)
+          io.WriteDirect(mpFils[f]->FD(), mpFils[f]->DirectFD(), out[f], bytes,
+              mWriteOffsets[f]);
+        else
+          io.Write(mpFils[f]->FD(), out[f], bytes, mWriteOffsets[f]);
+        mWriteOffsets[f] += bytes;
       }
+      io.Flush();
+
+      int prog = (double)(s0 + len) / (double)numSpec * 100.0;
+      printf("\b\b\b\b%3i%%", prog);
+      fflush(stdout);
     }
 
-    int prog = (double)(s + 1) / (double)numSpec * 100.0;
-    printf("\b\b\b\b%3i%%", prog);
-    fflush(stdout);
+    io.Wait();
+    report_written();
+  } catch (...) {
+    // make sure nothing is in flight anymore before we give up the buffers
+    try {
+      io.Wait();
+    } catch (...) {}
+    close(fd);
+    printf("\n");
+    throw;
   }
 
-  istm.close();
+  close(fd);
 
-  printf("\33[2K\rProcessing %s... flushing cache (this could take a while)",
-      dadaFile.c_str());
+  printf("\33[2K\rProcessing %s... flushing cache", dadaFile.c_str());
   fflush(stdout);
 
   for (size_t f = 0; f < mpFils.size(); ++f)
@@ -11,6 +11,7 @@
 #include <memory>
 #include <vector>
 
+#include "AsyncIO.hpp"
 #include "SigProc.hpp"
 #include "MakeFilterbankConfig.hpp"
 
@@ -20,6 +21,16 @@ public:
 
   ~MakeFilterbank();
 
+  // write the filterbank files with direct I/O, bypassing the page cache
+  void SetDirectIO(const bool directIO) {
+    mDirectIO = directIO;
+  }
+
+  // drop the filterbank data from the page cache once it is on disk
+  void SetDropBehind(const bool dropBehind) {
+    mDropBehind = dropBehind;
+  }
+
   void ProcessDadaFile(const std::string& dadaFile,
       const std::string& outputPrefix);
 
@@ -58,13 +69,29 @@ private:
   template<bool FLIP, bool BIGENDIAN>
   void Do2ProcessDadaFile(const std::string& dadaFile);
 
+  // we read and convert this many bytes of dada data at once
+  static constexpr size_t BlockSize = 8 * 1024 * 1024; // 8 MB
+
   MakeFilterbankConfig mConf;
 
   std::vector<std::unique_ptr<SigProc>> mpFils;
   std::vector<SigProcHeader> mHeaders;
   std::vector<int> mNumChans, mStart;
 
+  // offset at which the next spectrum goes in each filterbank file, we write
+  // with positioned writes so the file position is not used
+  std::vector<off64_t> mWriteOffsets;
+
+  bool mDirectIO;
+  bool mDropBehind;
+
+  // two blocks of spectra for double buffering, the output of each
+  // filterbank file goes into its own slot of mOutSlotSize bytes, which is
+  // aligned for direct I/O
+  size_t mBlockLen, mOutSlotSize;
   char * mInBuf, * mOutBuf;
+
+  std::unique_ptr<AsyncIO> mpIO;
 };
 
 #endif /* SRC_SIGPROC_MAKEFILTERBANK_HPP_ */
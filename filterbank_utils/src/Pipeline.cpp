@@ -0,0 +1,113 @@
+/*
+ * Pipeline.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Pipeline.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+void Pipeline::Run(const size_t num_items, const size_t num_slots,
+    const Stage& read, const Stage& process, const Stage& write) {
+  Run(num_slots, [&](const size_t i, const size_t slot) {
+    if (i >= num_items)
+      return false;
+
+    read(i, slot);
+    return true;
+  }, process, write);
+}
+
+void Pipeline::Run(const size_t num_slots, const Source& read,
+    const Stage& process, const Stage& write) {
+  if (num_slots == 0)
+    throw std::invalid_argument("Pipeline needs at least one slot");
+
+  if (num_slots == 1) {
+    for (size_t i = 0; read(i, 0); ++i) {
+      process(i, 0);
+      write(i, 0);
+    }
+    return;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  // number of items that have been through each stage
+  size_t num_read = 0;
+  size_t num_processed = 0;
+  size_t num_written = 0;
+
+  // the number of items, once reading has found the end
+  size_t num_items = SIZE_MAX;
+
+  std::exception_ptr error;
+
+  // Item i can go through the stage once more than i - lag items have been
+  // through the previous stage. Reading waits for writing to free the slot.
+  auto run = [&](const Source& stage, const size_t& prev, const size_t lag,
+      size_t * const done) {
+    for (size_t i = 0;; ++i) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] {
+          return error || (i >= num_items) || (prev + lag > i);
+        });
+
+        if (error || (i >= num_items))
+          return;
+      }
+
+      bool more = false;
+      try {
+        more = stage(i, i % num_slots);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+          error = std::current_exception();
+        changed.notify_all();
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (more)
+          ++(*done);
+        else
+          num_items = i;
+      }
+      changed.notify_all();
+
+      if (!more)
+        return;
+    }
+  };
+
+  // processing and writing always go on
+  auto all = [](const Stage& stage) {
+    return [&stage](const size_t i, const size_t slot) {
+      stage(i, slot);
+      return true;
+    };
+  };
+
+  std::thread reader(run, std::cref(read), std::cref(num_written), num_slots,
+      &num_read);
+  std::thread writer(run, all(write), std::cref(num_processed), 0,
+      &num_written);
+
+  run(all(process), num_read, 0, &num_processed);
+
+  reader.join();
+  writer.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
@@ -0,0 +1,43 @@
+/*
+ * Pipeline.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PIPELINE_HPP_
+#define PIPELINE_HPP_
+
+#include <cstddef>
+#include <functional>
+
+// Runs the three stages read, process, and write over a sequence of items,
+// such that reading the next items and writing the previous ones overlaps with
+// processing the current one. Each stage runs in its own thread (processing
+// runs in the calling thread) and handles the items in order.
+//
+// The items in flight live in num_slots slots of buffers owned by the caller,
+// item i uses slot i % num_slots. A slot is only read into again once its
+// previous item has been written, so with 3 slots all three stages can be
+// busy at the same time, with 2 slots reading and writing alternate, and with
+// 1 slot everything runs sequentially in the calling thread.
+//
+// If a stage throws, the other stages stop after their current item and the
+// first exception is rethrown by Run.
+class Pipeline {
+public:
+  typedef std::function<void(const size_t item, const size_t slot)> Stage;
+
+  // a read stage that returns false if there is no item, which ends the
+  // sequence there
+  typedef std::function<bool(const size_t item, const size_t slot)> Source;
+
+  static void Run(const size_t num_items, const size_t num_slots,
+      const Stage& read, const Stage& process, const Stage& write);
+
+  // for a sequence whose length we only find out while reading it, like a
+  // stream
+  static void Run(const size_t num_slots, const Source& read,
+      const Stage& process, const Stage& write);
+};
+
+#endif // PIPELINE_HPP_
@@ -0,0 +1,432 @@
+/*
+ * ProcessingStage.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "ProcessingStage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#include "Decimate.hpp"
+
+namespace {
+
+// index of the calling thread in a parallel region
+int thread_num() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+void check_channels(const StageBlock& block, const char * const stage) {
+  if (!block.channel_major || (block.first_sample != 0))
+    throw std::logic_error(std::string(stage) + " needs entire channels");
+}
+
+// Scale and offset that put the mean of the data in the middle of the range of
+// an nbits-bit unsigned integer and num_sigma standard deviations at its edges.
+// The mean and variance are accumulated with Welford's algorithm, non-finite
+// values are ignored.
+void auto_scale(const float * const data, const size_t num, const int nbits,
+    const double num_sigma, float * const scale, float * const offset) {
+  double mean = 0.0;
+  double m2 = 0.0;
+  size_t n = 0;
+
+  for (size_t i = 0; i < num; ++i) {
+    if (!std::isfinite(data[i]))
+      continue;
+
+    ++n;
+    double delta = (double)data[i] - mean;
+    mean += delta / (double)n;
+    m2 += delta * ((double)data[i] - mean);
+  }
+
+  double mid = 0.5 * (double)((1u << nbits) - 1);
+  double sigma = n > 1 ? sqrt(m2 / (double)(n - 1)) : 0.0;
+
+  if (sigma > 0.0) {
+    *scale = mid / (num_sigma * sigma);
+    *offset = mid - mean * *scale;
+  } else {
+    // constant channel, store it exactly if we can
+    *scale = 1.0;
+    *offset = round(mid) - mean;
+  }
+}
+
+} // namespace [unnamed]
+
+void AverageStage::UpdateHeader(SigProcHeader * const header) const {
+  header->nsamples = std::max(header->nsamples, (int64_t)0) / (int64_t)mNumAvg;
+  header->tsamp *= (double)mNumAvg;
+}
+
+void AverageStage::Process(const StageBlock& block, const float * const in,
+    float * const out) {
+  const size_t num_out = block.num_samples / mNumAvg;
+
+  if (block.channel_major) {
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(block.num_threads)
+#endif
+    for (size_t r = 0; r < block.NumRows(); ++r)
+      decimate(in + r * block.num_samples, out + r * num_out, num_out, mNumAvg);
+
+    return;
+  }
+
+  // add up the spectra in the same order as decimate_scalar
+  const size_t spectrum_size = block.nifs * block.nchans;
+  mSums.resize(block.num_threads, std::vector<double>(spectrum_size));
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t t = 0; t < num_out; ++t) {
+    const float * const src = in + t * mNumAvg * spectrum_size;
+    double * const sum = mSums[thread_num()].data();
+
+    for (size_t v = 0; v < spectrum_size; ++v)
+      sum[v] = src[v];
+    for (size_t i = 1; i < mNumAvg; ++i) {
+      for (size_t v = 0; v < spectrum_size; ++v)
+        sum[v] += src[i * spectrum_size + v];
+    }
+    for (size_t v = 0; v < spectrum_size; ++v)
+      out[t * spectrum_size + v] = sum[v] / (double)mNumAvg;
+  }
+}
+
+void AverageStage::Accumulate(const StageBlock& block, const float * const in) {
+  if (block.channel_major)
+    throw std::logic_error("Can only accumulate averages of spectra");
+
+  // the spectra are added up in the same order as in Process
+  const size_t spectrum_size = block.nifs * block.nchans;
+  const bool first = (block.first_sample % mNumAvg) == 0;
+  mPartialSum.resize(spectrum_size);
+  double * const sum = mPartialSum.data();
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t v = 0; v < spectrum_size; ++v) {
+    size_t i = 0;
+    if (first)
+      sum[v] = in[i++ * spectrum_size + v];
+    for (; i < block.num_samples; ++i)
+      sum[v] += in[i * spectrum_size + v];
+  }
+}
+
+void AverageStage::Finish(const StageBlock& block, float * const out) {
+  const size_t spectrum_size = block.nifs * block.nchans;
+  for (size_t v = 0; v < spectrum_size; ++v)
+    out[v] = mPartialSum[v] / (double)mNumAvg;
+}
+
+void BandpassStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  if (block.channel_major) {
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(block.num_threads)
+#endif
+    for (size_t r = 0; r < block.NumRows(); ++r) {
+      const float bp = mBandpass[block.RowChannel(r)];
+      for (size_t t = 0; t < block.num_samples; ++t)
+        out[r * block.num_samples + t] /= bp;
+    }
+
+    return;
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t t = 0; t < block.num_samples; ++t) {
+    for (size_t if_idx = 0; if_idx < block.nifs; ++if_idx) {
+      float * const dst = out + (t * block.nifs + if_idx) * block.nchans;
+      for (size_t c = 0; c < block.nchans; ++c)
+        dst[c] /= mBandpass[c];
+    }
+  }
+}
+
+void ZeroChannelsStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  if (block.channel_major) {
+    for (size_t r = 0; r < block.NumRows(); ++r) {
+      if (mChannels.count(block.RowChannel(r)) > 0)
+        memset(out + r * block.num_samples, 0,
+            block.num_samples * sizeof(float));
+    }
+
+    return;
+  }
+
+  for (size_t t = 0; t < block.num_samples; ++t) {
+    for (size_t c : mChannels) {
+      for (size_t if_idx = 0; if_idx < block.nifs; ++if_idx)
+        out[(t * block.nifs + if_idx) * block.nchans + c] = 0.0;
+    }
+  }
+}
+
+void MaskStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  // the mask intervals are in samples of the original input, we zero every
+  // sample that contains a zapped sample of the original input
+  const size_t interval_size = mMask.IntervalSize();
+  const size_t num_intervals = mMask.NumIntervals();
+  const size_t factor = block.sample_factor;
+
+  if (block.channel_major) {
+    check_channels(block, "MaskStage");
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(block.num_threads)
+#endif
+    for (size_t r = 0; r < block.NumRows(); ++r) {
+      for (auto& run : mMask.ZappedIntervalRuns(block.RowChannel(r))) {
+        size_t first = run.first * interval_size / factor;
+        size_t end = std::min((run.second * interval_size + factor - 1)
+            / factor, block.num_samples);
+
+        if (first < end)
+          memset(out + r * block.num_samples + first, 0,
+              (end - first) * sizeof(float));
+      }
+    }
+
+    return;
+  }
+
+  if (num_intervals == 0)
+    return;
+
+  mZapped.resize(block.num_threads,
+      std::vector<uint64_t>(mMask.WordsPerInterval()));
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t t = 0; t < block.num_samples; ++t) {
+    const size_t sample = block.first_sample + t;
+    const size_t first_interval = sample * factor / interval_size;
+    const size_t last_interval = std::min(
+        ((sample + 1) * factor - 1) / interval_size, num_intervals - 1);
+
+    if (first_interval > last_interval)
+      continue;
+
+    // the channels zapped in any of the intervals of this sample
+    std::vector<uint64_t>& bits = mZapped[thread_num()];
+    std::fill(bits.begin(), bits.end(), 0);
+    for (size_t i = first_interval; i <= last_interval; ++i) {
+      const uint64_t * const zapped = mMask.ZappedChannelBits(i);
+      for (size_t w = 0; w < bits.size(); ++w)
+        bits[w] |= zapped[w];
+    }
+
+    for (size_t w = 0; w < bits.size(); ++w) {
+      for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+        size_t c = w * RFIMask::BitsPerWord + __builtin_ctzll(word);
+        for (size_t if_idx = 0; if_idx < block.nifs; ++if_idx)
+          out[(t * block.nifs + if_idx) * block.nchans + c] = 0.0;
+      }
+    }
+  }
+}
+
+ChannelAverageStage::ChannelAverageStage(const size_t num_avg,
+    const size_t nchans, const std::set<size_t>& excluded,
+    const RFIMask * const mask) :
+    mNumAvg(num_avg),
+    mExcluded((nchans + RFIMask::BitsPerWord - 1) / RFIMask::BitsPerWord, 0),
+    mpMask(mask) {
+  if ((num_avg == 0) || (nchans % num_avg != 0))
+    throw std::invalid_argument("Cannot average " + std::to_string(num_avg)
+        + " channels of " + std::to_string(nchans));
+
+  for (size_t c : excluded) {
+    if (c < nchans)
+      mExcluded[c / RFIMask::BitsPerWord] |=
+          (uint64_t)1 << (c % RFIMask::BitsPerWord);
+  }
+}
+
+void ChannelAverageStage::UpdateHeader(SigProcHeader * const header) const {
+  // the frequency of an output channel is the mean of its input channels
+  header->fch1 += 0.5 * (double)(mNumAvg - 1) * header->foff;
+  header->foff *= (double)mNumAvg;
+  header->nchans /= (int)mNumAvg;
+}
+
+void ChannelAverageStage::Process(const StageBlock& block,
+    const float * const in, float * const out) {
+  const size_t factor = block.sample_factor;
+  auto left_out = [](const std::vector<uint64_t>& bits, const size_t c) {
+    return (bits[c / RFIMask::BitsPerWord] >> (c % RFIMask::BitsPerWord)) & 1;
+  };
+
+  if (block.channel_major) {
+    // the samples of each channel are added up, except for the runs of
+    // samples the mask zaps (see MaskStage)
+    const size_t n = block.num_samples;
+    const size_t num_out = block.num_channels / mNumAvg;
+    mSums.resize(block.num_threads);
+    mCounts.resize(block.num_threads);
+
+    if (mpMask != nullptr)
+      check_channels(block, "ChannelAverageStage");
+
+#ifdef _OPENMP
+    #pragma omp parallel for num_threads(block.num_threads)
+#endif
+    for (size_t r = 0; r < block.nifs * num_out; ++r) {
+      std::vector<double>& sum = mSums[thread_num()];
+      std::vector<size_t>& count = mCounts[thread_num()];
+      sum.assign(n, 0.0);
+      count.assign(n, 0);
+
+      const size_t if_idx = r / num_out;
+      const size_t first_row = if_idx * block.num_channels
+          + (r % num_out) * mNumAvg;
+
+      for (size_t i = 0; i < mNumAvg; ++i) {
+        const size_t c = block.RowChannel(first_row + i);
+        if (left_out(mExcluded, c))
+          continue;
+
+        const float * const src = in + (first_row + i) * n;
+        size_t t = 0;
+        auto add = [&](const size_t end) {
+          for (; t < end; ++t) {
+            sum[t] += src[t];
+            ++count[t];
+          }
+        };
+
+        if (mpMask != nullptr) {
+          const size_t interval_size = mpMask->IntervalSize();
+          for (auto& run : mpMask->ZappedIntervalRuns(c)) {
+            add(std::min(run.first * interval_size / factor, n));
+            t = std::max(t, std::min((run.second * interval_size + factor - 1)
+                / factor, n));
+          }
+        }
+        add(n);
+      }
+
+      float * const dst = out + r * n;
+      for (size_t t = 0; t < n; ++t)
+        dst[t] = count[t] > 0 ? sum[t] / (double)count[t] : 0.0;
+    }
+
+    return;
+  }
+
+  const size_t num_out = block.nchans / mNumAvg;
+  const size_t num_intervals = mpMask == nullptr ? 0 : mpMask->NumIntervals();
+  mLeftOut.resize(block.num_threads);
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t t = 0; t < block.num_samples; ++t) {
+    // the excluded channels and the ones zapped in any of the intervals of
+    // this sample
+    std::vector<uint64_t>& bits = mLeftOut[thread_num()];
+    bits = mExcluded;
+
+    if (num_intervals > 0) {
+      const size_t interval_size = mpMask->IntervalSize();
+      const size_t sample = block.first_sample + t;
+      const size_t last_interval = std::min(
+          ((sample + 1) * factor - 1) / interval_size, num_intervals - 1);
+
+      for (size_t i = sample * factor / interval_size; i <= last_interval;
+          ++i) {
+        const uint64_t * const zapped = mpMask->ZappedChannelBits(i);
+        for (size_t w = 0; w < bits.size(); ++w)
+          bits[w] |= zapped[w];
+      }
+    }
+
+    for (size_t if_idx = 0; if_idx < block.nifs; ++if_idx) {
+      const float * const src = in + (t * block.nifs + if_idx) * block.nchans;
+      float * const dst = out + (t * block.nifs + if_idx) * num_out;
+
+      for (size_t g = 0; g < num_out; ++g) {
+        double sum = 0.0;
+        size_t count = 0;
+        for (size_t c = g * mNumAvg; c < (g + 1) * mNumAvg; ++c) {
+          if (left_out(bits, c))
+            continue;
+
+          sum += src[c];
+          ++count;
+        }
+        dst[g] = count > 0 ? sum / (double)count : 0.0;
+      }
+    }
+  }
+}
+
+void BaselineStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  check_channels(block, "BaselineStage");
+  mRemover.Process_batch(out, block.NumRows());
+}
+
+void BarycenterStage::UpdateHeader(SigProcHeader * const header) const {
+  header->barycentric = 1;
+  header->tstart = mBary.BaryStartMJD();
+}
+
+void BarycenterStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  check_channels(block, "BarycenterStage");
+
+  const size_t n = block.num_samples;
+  mBuffers.resize(block.num_threads, std::vector<float>(n));
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t r = 0; r < block.NumRows(); ++r) {
+    float * const buf = mBuffers[thread_num()].data();
+    memcpy(buf, out + r * n, n * sizeof(float));
+    mBary.DoBarycenterCorrection(buf, out + r * n, n);
+  }
+}
+
+void AutoScaleStage::Process(const StageBlock& block, const float * const,
+    float * const out) {
+  check_channels(block, "AutoScaleStage");
+
+#ifdef _OPENMP
+  #pragma omp parallel for num_threads(block.num_threads)
+#endif
+  for (size_t r = 0; r < block.NumRows(); ++r) {
+    const size_t if_idx = r / block.num_channels;
+    const size_t channel = block.RowChannel(r);
+
+    float scale, offset;
+    auto_scale(out + r * block.num_samples, block.num_samples, mNumBits,
+        mNumSigma, &scale, &offset);
+    mpOut->SetChannelQuantization(if_idx, channel, scale, offset);
+  }
+}
@@ -0,0 +1,308 @@
+/*
+ * ProcessingStage.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PROCESSINGSTAGE_HPP_
+#define PROCESSINGSTAGE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Barycenter.hpp"
+#include "BaselineRemover.hpp"
+#include "RFIMask.hpp"
+#include "SigProc.hpp"
+
+// A block of data going through the stages of SigProcUtil::Process. It is
+// either a block of consecutive spectra of all channels, stored spectrum by
+// spectrum, or all the samples of a batch of channels, stored channel by
+// channel (the channels of the batch of the first IF, then those of the second
+// IF and so on).
+struct StageBlock {
+  bool channel_major;
+
+  // of the file
+  std::size_t nifs, nchans;
+
+  // the channels in the block (all of them for a block of spectra)
+  std::size_t first_channel, num_channels;
+
+  // the samples in the block, in units of the samples that go into the stage
+  std::size_t first_sample, num_samples;
+
+  // number of samples of the original input in each sample of the block
+  std::size_t sample_factor;
+
+  // number of threads to process the block with
+  int num_threads;
+
+  std::size_t NumRows() const {
+    return nifs * num_channels;
+  }
+
+  std::size_t RowChannel(const std::size_t row) const {
+    return first_channel + row % num_channels;
+  }
+};
+
+// One operation of SigProcUtil::Process. Stages that don't need entire channels
+// work on a single spectrum at a time, so the engine can run them on blocks of
+// spectra while streaming through a time-major file, as well as on batches of
+// channels.
+class ProcessingStage {
+public:
+  virtual ~ProcessingStage() {}
+
+  // true if the stage needs all samples of a channel at once
+  virtual bool NeedsChannels() const = 0;
+
+  // number of input samples that make one output sample
+  virtual std::size_t Decimation() const {
+    return 1;
+  }
+
+  // number of adjacent input channels that make one output channel
+  virtual std::size_t ChannelDecimation() const {
+    return 1;
+  }
+
+  // memory the stage needs for each channel in a batch, in floats
+  virtual std::size_t MemoryPerChannel() const {
+    return 0;
+  }
+
+  // adjust the header of the output to what the stage does
+  virtual void UpdateHeader(SigProcHeader * const /*header*/) const {}
+
+  // Process the block from in into out. The block describes the input, the
+  // output has block.num_samples / Decimation() samples of
+  // block.num_channels / ChannelDecimation() channels (out of
+  // block.nchans / ChannelDecimation()). If both are 1, in and out are the
+  // same.
+  virtual void Process(const StageBlock& block, const float * const in,
+      float * const out) = 0;
+
+  // A stage that decimates in time may also take the input spectra of an
+  // output spectrum a few at a time, when they don't all fit in memory:
+  // Accumulate adds up a block of spectra of the same output spectrum (a block
+  // that starts one afresh), and Finish writes the output spectrum out. The
+  // block describes the input, as in Process.
+  virtual bool CanAccumulate() const {
+    return false;
+  }
+
+  virtual void Accumulate(const StageBlock& /*block*/,
+      const float * const /*in*/) {}
+
+  virtual void Finish(const StageBlock& /*block*/, float * const /*out*/) {}
+};
+
+typedef std::vector<std::unique_ptr<ProcessingStage>> ProcessingStages;
+
+// average groups of num_avg samples
+class AverageStage : public ProcessingStage {
+public:
+  AverageStage(const std::size_t num_avg) :
+      mNumAvg(num_avg) {}
+
+  bool NeedsChannels() const {
+    return false;
+  }
+
+  std::size_t Decimation() const {
+    return mNumAvg;
+  }
+
+  void UpdateHeader(SigProcHeader * const header) const;
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+  bool CanAccumulate() const {
+    return true;
+  }
+
+  void Accumulate(const StageBlock& block, const float * const in);
+
+  void Finish(const StageBlock& block, float * const out);
+
+private:
+  std::size_t mNumAvg;
+
+  // sums of the averages of each thread
+  std::vector<std::vector<double>> mSums;
+
+  // sum of the spectra Accumulate has added up so far
+  std::vector<double> mPartialSum;
+};
+
+// divide each channel by its bandpass
+class BandpassStage : public ProcessingStage {
+public:
+  BandpassStage(const std::vector<float>& bandpass) :
+      mBandpass(bandpass) {}
+
+  bool NeedsChannels() const {
+    return false;
+  }
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  std::vector<float> mBandpass;
+};
+
+// set the given channels to 0
+class ZeroChannelsStage : public ProcessingStage {
+public:
+  ZeroChannelsStage(const std::set<std::size_t>& channels) :
+      mChannels(channels) {}
+
+  bool NeedsChannels() const {
+    return false;
+  }
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  std::set<std::size_t> mChannels;
+};
+
+// set the samples to 0 that contain samples zapped by an RFI mask
+class MaskStage : public ProcessingStage {
+public:
+  MaskStage(const RFIMask& mask) :
+      mMask(mask) {}
+
+  bool NeedsChannels() const {
+    return false;
+  }
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  const RFIMask& mMask;
+
+  // zapped channels of each thread
+  std::vector<std::vector<uint64_t>> mZapped;
+};
+
+// Average groups of num_avg adjacent channels. The excluded channels (the ones
+// that were zeroed) and the samples zapped by the mask (if it isn't nullptr)
+// are left out of the averages, so they don't pull them towards 0. An output
+// sample whose input samples are all left out is 0.
+class ChannelAverageStage : public ProcessingStage {
+public:
+  ChannelAverageStage(const std::size_t num_avg, const std::size_t nchans,
+      const std::set<std::size_t>& excluded, const RFIMask * const mask);
+
+  bool NeedsChannels() const {
+    return false;
+  }
+
+  std::size_t ChannelDecimation() const {
+    return mNumAvg;
+  }
+
+  void UpdateHeader(SigProcHeader * const header) const;
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  std::size_t mNumAvg;
+
+  // bitmap of the excluded channels, in the layout of RFIMask::ZappedChannelBits
+  std::vector<uint64_t> mExcluded;
+
+  const RFIMask * mpMask;
+
+  // left out channels (for spectra), and the sums and numbers of averaged
+  // samples (for channels) of each thread
+  std::vector<std::vector<uint64_t>> mLeftOut;
+  std::vector<std::vector<double>> mSums;
+  std::vector<std::vector<std::size_t>> mCounts;
+};
+
+// remove the low frequencies of each channel with an FFT
+class BaselineStage : public ProcessingStage {
+public:
+  BaselineStage(const std::size_t num_samples,
+      const std::size_t total_num_channels, const double tsamp_in_sec,
+      const double baseline_length_in_sec, const bool useGPU) :
+      mRemover(num_samples, total_num_channels, tsamp_in_sec,
+          baseline_length_in_sec, useGPU) {}
+
+  bool NeedsChannels() const {
+    return true;
+  }
+
+  std::size_t MemoryPerChannel() const {
+    return mRemover.Ram_per_channel();
+  }
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  BaselineRemover mRemover;
+};
+
+// shift the samples of each channel to barycentric time
+class BarycenterStage : public ProcessingStage {
+public:
+  BarycenterStage(const SigProcHeader& header, const std::size_t num_samples,
+      const std::string& observatoryCode) :
+      mBary(header.tsamp, header.tstart, num_samples, header.src_raj,
+          header.src_dej, observatoryCode) {}
+
+  bool NeedsChannels() const {
+    return true;
+  }
+
+  void UpdateHeader(SigProcHeader * const header) const;
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  Barycenter mBary;
+
+  // a channel buffer for each thread
+  std::vector<std::vector<float>> mBuffers;
+};
+
+// Scale each channel of 8 and 16-bit output such that the mean is in the
+// middle of the integer range and num_sigma standard deviations are at its
+// edges. The scales and offsets are set on the output, see
+// SigProc::SetChannelQuantization.
+class AutoScaleStage : public ProcessingStage {
+public:
+  AutoScaleStage(const int nbits, const double num_sigma, SigProc * const out) :
+      mNumBits(nbits),
+      mNumSigma(num_sigma),
+      mpOut(out) {}
+
+  bool NeedsChannels() const {
+    return true;
+  }
+
+  void Process(const StageBlock& block, const float * const in,
+      float * const out);
+
+private:
+  int mNumBits;
+  double mNumSigma;
+  SigProc * mpOut;
+};
+
+#endif // PROCESSINGSTAGE_HPP_
@@ -13,8 +13,11 @@
 
 #include "utils.hpp"
 
+constexpr size_t RFIMask::BitsPerWord;
+
 RFIMask::RFIMask(const std::string& filename,
     const SigProcHeader& sigprocHeader) :
+    mFileName(filename),
     mNumChannels(0),
     mNumIntervals(0),
     mIntervalSize(0) {
@@ -63,11 +66,15 @@ RFIMask::RFIMask(const std::string& filename,
       secPerInterval))
     throw std::runtime_error("Times per interval don't agree");
 
-  int num = (sigprocHeader.nsamples + mIntervalSize - 1) / mIntervalSize;
+  // we can't check the length of a stream that doesn't say how long it is
+  int64_t num = (sigprocHeader.nsamples + mIntervalSize - 1) / mIntervalSize;
 //  printf("%i, %i\n", mNumIntervals, num);
-  if (mNumIntervals != num)
+  if ((sigprocHeader.nsamples >= 0) && (mNumIntervals != num))
     throw std::runtime_error("Numbers of intervals don't agree");
 
+  mWordsPerInterval = (mNumChannels + BitsPerWord - 1) / BitsPerWord;
+  mBitmap.assign((size_t)mNumIntervals * mWordsPerInterval, 0);
+
   // read channels that are zapped at all times
   int n;
   istm.read((char*)&n, sizeof(int));
@@ -75,8 +82,18 @@ RFIMask::RFIMask(const std::string& filename,
   if (n > 0)
     istm.read((char*)zapped.data(), n * sizeof(int));
 
-  for (int c : zapped)
-    mZappedChannels.insert(invertChannels ? mNumChannels - c - 1 : c);
+  auto check_channel = [&](const int c) {
+    if ((c < 0) || (c >= mNumChannels))
+      throw std::runtime_error("Invalid channel in mask");
+  };
+
+  for (int c : zapped) {
+    check_channel(c);
+    int chan = invertChannels ? mNumChannels - c - 1 : c;
+    mZappedChannels.insert(chan);
+    for (int i = 0; i < mNumIntervals; ++i)
+      Zap(i, chan);
+  }
 
   // read intervals that are zapped for all channels
   istm.read((char*)&n, sizeof(int));
@@ -84,45 +101,46 @@ RFIMask::RFIMask(const std::string& filename,
   if (n > 0)
     istm.read((char*)zappedIntervals.data(), n * sizeof(int));
 
-  // we record the zapped intervals per channel, first in a set to avoid
-  // duplicates and then we'll convert the set of intervals to vectors
-  std::vector<std::set<int>> zappedIntervalsPerChannel(mNumChannels);
+  for (int i : zappedIntervals) {
+    if ((i < 0) || (i >= mNumIntervals))
+      throw std::runtime_error("Invalid interval in mask");
 
-  for (int c = 0; c < mNumChannels; ++c)
-    zappedIntervalsPerChannel[c].insert(zappedIntervals.begin(),
-        zappedIntervals.end());
+    for (int c = 0; c < mNumChannels; ++c)
+      Zap(i, c);
+  }
 
   // read number of zapped channels per interval
   std::vector<int> numZap(mNumIntervals);
   istm.read((char*)numZap.data(), mNumIntervals * sizeof(int));
 
-  mZappedChannelsPerInterval.resize(mNumIntervals);
-
   for (int i = 0; i < mNumIntervals; ++i) {
-    for (int c : mZappedChannels)
-      mZappedChannelsPerInterval[i].insert(c);
-
     if ((numZap[i] > 0) && (numZap[i] < mNumChannels)) {
       std::vector<int> zappedChannels(numZap[i]);
       istm.read((char*)zappedChannels.data(), numZap[i] * sizeof(int));
 
       for (int c : zappedChannels) {
-        int chan = invertChannels ? mNumChannels - c - 1 : c;
-        zappedIntervalsPerChannel[chan].insert(i);
-        mZappedChannelsPerInterval[i].insert(chan);
+        check_channel(c);
+        Zap(i, invertChannels ? mNumChannels - c - 1 : c);
       }
     } else if (numZap[i] == mNumChannels) {
-      for (int c = 0; c < mNumChannels; ++c) {
-        zappedIntervalsPerChannel[c].insert(i);
-        mZappedChannelsPerInterval[i].insert(c);
-      }
+      for (int c = 0; c < mNumChannels; ++c)
+        Zap(i, c);
     }
   }
 
-  mZappedIntervalsPerChannel.resize(mNumChannels);
+  // derive the runs of zapped intervals of each channel from the bitmap
+  mZappedIntervalRuns.resize(mNumChannels);
   for (int c = 0; c < mNumChannels; ++c) {
-    mZappedIntervalsPerChannel[c].assign(zappedIntervalsPerChannel[c].begin(),
-        zappedIntervalsPerChannel[c].end());
+    auto& runs = mZappedIntervalRuns[c];
+    for (int i = 0; i < mNumIntervals; ++i) {
+      if (!IsZapped(i, c))
+        continue;
+
+      if ((runs.size() > 0) && (runs.back().second == (size_t)i))
+        ++runs.back().second;
+      else
+        runs.push_back({ (size_t)i, (size_t)i + 1 });
+    }
   }
 
   // make sure we're at the end of the file
@@ -9,16 +9,27 @@
 #define SRC_SIGPROC_RFIMASK_HPP_
 
 #include <cstddef>
+#include <cstdint>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "SigProcHeader.hpp"
 
+// The mask is stored as a bitmap with one row per interval, where bit c % 64
+// of word c / 64 of a row is set if channel c is zapped in that interval.
 class RFIMask {
 public:
+  static constexpr size_t BitsPerWord = 64;
+
   RFIMask(const std::string& filename, const SigProcHeader& sigprocHeader);
 
+  // the file the mask was read from
+  const std::string& FileName() const {
+    return mFileName;
+  }
+
   int NumChannels() const {
     return mNumChannels;
   }
@@ -35,22 +46,45 @@ public:
     return mZappedChannels;
   }
 
-  const std::vector<std::vector<int>>& ZappedIntervalsPerChannel() const {
-    return mZappedIntervalsPerChannel;
+  size_t WordsPerInterval() const {
+    return mWordsPerInterval;
+  }
+
+  // the row of the bitmap of the given interval
+  const uint64_t * ZappedChannelBits(const size_t interval) const {
+    return mBitmap.data() + interval * mWordsPerInterval;
+  }
+
+  bool IsZapped(const size_t interval, const size_t channel) const {
+    return (ZappedChannelBits(interval)[channel / BitsPerWord]
+        >> (channel % BitsPerWord)) & 1;
   }
 
-  const std::vector<std::set<int>>& ZappedChannelsPerInterval() const {
-    return mZappedChannelsPerInterval;
+  // the runs [first, end) of consecutive intervals in which the channel is
+  // zapped
+  const std::vector<std::pair<size_t, size_t>>& ZappedIntervalRuns(
+      const size_t channel) const {
+    return mZappedIntervalRuns[channel];
   }
 
 private:
+  void Zap(const size_t interval, const size_t channel) {
+    mBitmap[interval * mWordsPerInterval + channel / BitsPerWord] |=
+        (uint64_t)1 << (channel % BitsPerWord);
+  }
+
+  std::string mFileName;
+
   int mNumChannels;
   int mNumIntervals;
   int mIntervalSize;
 
   std::set<int> mZappedChannels;
-  std::vector<std::vector<int>> mZappedIntervalsPerChannel;
-  std::vector<std::set<int>> mZappedChannelsPerInterval;
+
+  size_t mWordsPerInterval;
+  std::vector<uint64_t> mBitmap;
+
+  std::vector<std::vector<std::pair<size_t, size_t>>> mZappedIntervalRuns;
 };
 
 #endif /* SRC_SIGPROC_RFIMASK_HPP_ */
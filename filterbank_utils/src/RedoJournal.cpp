@@ -0,0 +1,293 @@
+/*
+ * RedoJournal.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "RedoJournal.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// The log is a sequence of records of a header, a payload of header.len bytes,
+// and the checksum of both. The redo file is a header with the unit in value,
+// the data, and the checksum of both. A record that is cut off or doesn't
+// match its checksum was being written when the program stopped, and it ends
+// the log.
+struct RecordHeader {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t value;
+  uint64_t len;
+};
+
+void write_at(const int fd, const void * const buf, const size_t len,
+    const off64_t off, const std::string& name) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pwrite64(fd, (const char*)buf + done, len - done, off + done);
+    if (n < 0) {
+      perror("Failure in RedoJournal");
+      throw std::runtime_error("Failed to write to '" + name + "'");
+    }
+    done += n;
+  }
+}
+
+// returns false if the file ends before len bytes
+bool read_at(const int fd, void * const buf, const size_t len,
+    const off64_t off, const std::string& name) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread64(fd, (char*)buf + done, len - done, off + done);
+    if (n < 0) {
+      perror("Failure in RedoJournal");
+      throw std::runtime_error("Failed to read from '" + name + "'");
+    }
+    if (n == 0)
+      return false;
+    done += n;
+  }
+
+  return true;
+}
+
+void sync_and_close(const int fd, const std::string& name) {
+  if ((fsync(fd) != 0) || (close(fd) != 0)) {
+    perror("Failure in RedoJournal");
+    throw std::runtime_error("Failed to flush '" + name + "'");
+  }
+}
+
+// make sure a newly created file in the directory of name survives a crash
+void sync_dir(const std::string& name) {
+  const size_t slash = name.find_last_of('/');
+  const std::string dir = slash == std::string::npos ? "."
+      : (slash == 0 ? "/" : name.substr(0, slash));
+
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    perror("Failure in RedoJournal");
+    throw std::runtime_error("Failed to open directory '" + dir + "'");
+  }
+  sync_and_close(fd, dir);
+}
+
+} // namespace [unnamed]
+
+uint64_t RedoJournal::Checksum(const void * const data, const size_t len,
+    uint64_t hash) {
+  // FNV-1a
+  const unsigned char * const bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < len; ++i)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+
+  return hash;
+}
+
+RedoJournal::RedoJournal(const std::string& name) :
+    mName(name),
+    mRedoName(name + ".redo"),
+    mEnd(0),
+    mStarted(false),
+    mUnitSize(0),
+    mInterrupted(false),
+    mInterruptedUnit(0) {
+  int fd = open64(mName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT)
+      return;
+
+    perror("Failure in RedoJournal::RedoJournal");
+    throw std::runtime_error("Failed to open journal '" + mName + "'");
+  }
+
+  const off64_t size = lseek64(fd, 0, SEEK_END);
+  if (size < 0) {
+    perror("Failure in RedoJournal::RedoJournal");
+    throw std::runtime_error("Failed to seek end of journal '" + mName + "'");
+  }
+
+  // replay the log up to the first incomplete record
+  while (true) {
+    RecordHeader header;
+    if (!read_at(fd, &header, sizeof(header), mEnd, mName)
+        || (header.len > (uint64_t)size - mEnd))
+      break;
+
+    std::vector<char> payload(header.len);
+    uint64_t sum;
+    if (!read_at(fd, payload.data(), payload.size(), mEnd + sizeof(header),
+        mName) || !read_at(fd, &sum, sizeof(sum), mEnd + sizeof(header)
+        + payload.size(), mName))
+      break;
+
+    if (sum != Checksum(payload.data(), payload.size(),
+        Checksum(&header, sizeof(header))))
+      break;
+
+    if (header.type == StartRecord) {
+      mStarted = true;
+      mPreamble = payload;
+    } else if (header.type == UnitSizeRecord) {
+      mUnitSize = header.value;
+    } else if (header.type == BeginRecord) {
+      mInterrupted = true;
+      mInterruptedUnit = header.value;
+      mInterruptedExtra = payload;
+    } else if (header.type == EndRecord) {
+      mInterrupted = false;
+      mDone[header.value] = payload;
+    } else {
+      break;
+    }
+
+    mEnd += sizeof(header) + payload.size() + sizeof(sum);
+  }
+
+  if (close(fd) != 0) {
+    perror("Failure in RedoJournal::RedoJournal");
+    throw std::runtime_error("Failed to close journal '" + mName + "'");
+  }
+}
+
+void RedoJournal::Start(const std::vector<char>& preamble) {
+  // start over with an empty log
+  int fd = open64(mName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Failure in RedoJournal::Start");
+    throw std::runtime_error("Failed to create journal '" + mName + "'");
+  }
+  sync_and_close(fd, mName);
+  sync_dir(mName);
+
+  mEnd = 0;
+  mUnitSize = 0;
+  mDone.clear();
+  mInterrupted = false;
+
+  Append(StartRecord, 0, preamble);
+  mStarted = true;
+  mPreamble = preamble;
+}
+
+void RedoJournal::SetUnitSize(const std::size_t unit_size) {
+  Append(UnitSizeRecord, unit_size, std::vector<char>());
+  mUnitSize = unit_size;
+}
+
+bool RedoJournal::Interrupted(std::size_t * const unit,
+    std::vector<char> * const data, std::vector<char> * const extra) const {
+  if (!mInterrupted)
+    return false;
+
+  // the data was flushed before the record was written, so it must be there
+  int fd = open64(mRedoName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror("Failure in RedoJournal::Interrupted");
+    throw std::runtime_error("Failed to open redo file '" + mRedoName + "'");
+  }
+
+  struct stat st;
+  RecordHeader header;
+  uint64_t sum = 0;
+  bool complete = (fstat(fd, &st) == 0)
+      && read_at(fd, &header, sizeof(header), 0, mRedoName)
+      && (header.value == mInterruptedUnit)
+      && (header.len <= (uint64_t)st.st_size);
+  if (complete) {
+    data->resize(header.len);
+    complete = read_at(fd, data->data(), data->size(), sizeof(header),
+        mRedoName) && read_at(fd, &sum, sizeof(sum), sizeof(header)
+        + data->size(), mRedoName);
+  }
+  close(fd);
+
+  if (!complete || (sum != Checksum(data->data(), data->size(),
+      Checksum(&header, sizeof(header)))))
+    throw std::runtime_error("The redo file '" + mRedoName + "' doesn't hold "
+        "the data of the unit that was being written");
+
+  *unit = mInterruptedUnit;
+  *extra = mInterruptedExtra;
+  return true;
+}
+
+void RedoJournal::BeginWrite(const std::size_t unit, const void * const data,
+    const std::size_t len, const std::vector<char>& extra) {
+  int fd = open64(mRedoName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Failure in RedoJournal::BeginWrite");
+    throw std::runtime_error("Failed to create redo file '" + mRedoName
+        + "'");
+  }
+
+  RecordHeader header = { BeginRecord, 0, unit, len };
+  uint64_t sum = Checksum(data, len, Checksum(&header, sizeof(header)));
+
+  write_at(fd, &header, sizeof(header), 0, mRedoName);
+  write_at(fd, data, len, sizeof(header), mRedoName);
+  write_at(fd, &sum, sizeof(sum), sizeof(header) + len, mRedoName);
+  sync_and_close(fd, mRedoName);
+  sync_dir(mRedoName);
+
+  Append(BeginRecord, unit, extra);
+  mInterrupted = true;
+  mInterruptedUnit = unit;
+  mInterruptedExtra = extra;
+}
+
+void RedoJournal::EndWrite(const std::size_t unit,
+    const std::vector<char>& extra) {
+  Append(EndRecord, unit, extra);
+  mInterrupted = false;
+  mDone[unit] = extra;
+}
+
+void RedoJournal::Remove() {
+  if ((unlink(mRedoName.c_str()) != 0) && (errno != ENOENT))
+    fprintf(stderr, "WARNING: Failed to remove redo file '%s'\n",
+        mRedoName.c_str());
+
+  if (unlink(mName.c_str()) != 0)
+    fprintf(stderr, "WARNING: Failed to remove journal '%s'\n",
+        mName.c_str());
+
+  mStarted = false;
+}
+
+void RedoJournal::Append(const RecordType type, const uint64_t value,
+    const std::vector<char>& payload) {
+  int fd = open64(mName.c_str(), O_WRONLY);
+  if (fd < 0) {
+    perror("Failure in RedoJournal::Append");
+    throw std::runtime_error("Failed to open journal '" + mName + "'");
+  }
+
+  RecordHeader header = { type, 0, value, payload.size() };
+  uint64_t sum = Checksum(payload.data(), payload.size(),
+      Checksum(&header, sizeof(header)));
+
+  write_at(fd, &header, sizeof(header), mEnd, mName);
+  write_at(fd, payload.data(), payload.size(), mEnd + sizeof(header), mName);
+  write_at(fd, &sum, sizeof(sum), mEnd + sizeof(header) + payload.size(),
+      mName);
+  mEnd += sizeof(header) + payload.size() + sizeof(sum);
+
+  // cut off what is left of a record that was being written when the previous
+  // run stopped
+  if (ftruncate64(fd, mEnd) != 0) {
+    perror("Failure in RedoJournal::Append");
+    throw std::runtime_error("Failed to truncate journal '" + mName + "'");
+  }
+
+  sync_and_close(fd, mName);
+}
@@ -0,0 +1,117 @@
+/*
+ * RedoJournal.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef REDOJOURNAL_HPP_
+#define REDOJOURNAL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Makes overwriting a file with processed data unit by unit (batches of
+// channels or blocks of spectra) crash-safe. Once a unit has been written in
+// place, its original data is gone, so before that, its processed data is
+// saved to the redo file NAME.redo, and a record of what happened is appended
+// to the log NAME. Each unit goes through:
+//
+//   BeginWrite: save the data to the redo file, log that the unit is written
+//   (the caller writes the unit in place and flushes the file)
+//   EndWrite:   log that the unit is done
+//
+// After a crash, the units that are done are skipped, the unit that was being
+// written (if any) is written again from the redo file, and the others are
+// processed from their original data, which is still there. The redo file only
+// ever holds a single unit, so the disk space needed on top of the file is
+// small.
+//
+// Each record carries some extra bytes for the caller (like the quantization
+// of the channels of the unit), and the first record carries a preamble with
+// whatever the caller needs to pick up where it left off (like the measured
+// bandpass).
+class RedoJournal {
+public:
+  // Open the journal NAME if it exists, otherwise it is created by Start
+  RedoJournal(const std::string& name);
+
+  // true if a previous run started this journal
+  bool Resumed() const {
+    return mStarted;
+  }
+
+  const std::vector<char>& Preamble() const {
+    return mPreamble;
+  }
+
+  // number of spectra or channels per unit, 0 if it hasn't been set yet
+  std::size_t UnitSize() const {
+    return mUnitSize;
+  }
+
+  // create the journal
+  void Start(const std::vector<char>& preamble);
+
+  void SetUnitSize(const std::size_t unit_size);
+
+  bool IsDone(const std::size_t unit) const {
+    return mDone.count(unit) > 0;
+  }
+
+  // the units that are done and their extra bytes
+  const std::map<std::size_t, std::vector<char>>& Done() const {
+    return mDone;
+  }
+
+  // Get the unit that was being written when the previous run stopped, with
+  // its data and extra bytes. Returns false if there is none.
+  bool Interrupted(std::size_t * const unit, std::vector<char> * const data,
+      std::vector<char> * const extra) const;
+
+  void BeginWrite(const std::size_t unit, const void * const data,
+      const std::size_t len, const std::vector<char>& extra);
+
+  void EndWrite(const std::size_t unit, const std::vector<char>& extra);
+
+  // delete the journal once the file is complete
+  void Remove();
+
+  // The checksum of the records, which also tells whether what a journal was
+  // started with is still the same. The checksum of several pieces is that of
+  // the first one passed as hash to that of the next one and so on.
+  static uint64_t Checksum(const void * const data, const std::size_t len,
+      uint64_t hash = 14695981039346656037ull);
+
+private:
+  enum RecordType : uint32_t {
+    StartRecord = 1,
+    UnitSizeRecord = 2,
+    BeginRecord = 3,
+    EndRecord = 4
+  };
+
+  void Append(const RecordType type, const uint64_t value,
+      const std::vector<char>& payload);
+
+  std::string mName;
+  std::string mRedoName;
+
+  // where the next record goes
+  uint64_t mEnd;
+
+  bool mStarted;
+  std::vector<char> mPreamble;
+  std::size_t mUnitSize;
+
+  std::map<std::size_t, std::vector<char>> mDone;
+
+  // the unit of the last BeginRecord that has no EndRecord
+  bool mInterrupted;
+  std::size_t mInterruptedUnit;
+  std::vector<char> mInterruptedExtra;
+};
+
+#endif // REDOJOURNAL_HPP_
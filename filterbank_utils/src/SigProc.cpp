@@ -7,8 +7,10 @@
 
 #include "SigProc.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
 
@@ -18,21 +20,165 @@
 #endif
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "AsyncIO.hpp"
+#include "BitPacking.hpp"
+#include "Transpose.hpp"
 #include "utils.hpp"
+#include "Writeback.hpp"
 
-SigProc::SigProc(const std::string& filename) {
+namespace {
+
+// size of the blocks of consecutive spectra that are read or written at once
+const size_t BlockSize = 32 * 1024 * 1024; // 32 MB
+
+// if the unwanted data between the requested channels of two consecutive
+// spectra is larger than this and larger than the requested data itself, we
+// read the requested strips individually instead of reading the whole span and
+// skipping the unwanted data
+const size_t MaxGapSize = 4 * 1024; // 4 kB
+
+// read exactly len bytes at offset off, read() may return less than requested
+// for large reads
+void pread_all(const int fd, void * const buf, const size_t len,
+    const off64_t off) {
+  char * ptr = (char*)buf;
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = pread64(fd, ptr + done, len - done, off + done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in pread_all");
+      throw std::runtime_error("Failed to read");
+    }
+
+    if (n == 0)
+      throw std::runtime_error("Unexpected end of file");
+
+    done += n;
+  }
+}
+
+// like pread_all, but the part of the range that is beyond the end of the file
+// reads as zeros
+void pread_or_zero(const int fd, void * const buf, const size_t len,
+    const off64_t off) {
+  char * ptr = (char*)buf;
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = pread64(fd, ptr + done, len - done, off + done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in pread_or_zero");
+      throw std::runtime_error("Failed to read");
+    }
+
+    if (n == 0) {
+      memset(ptr + done, 0, len - done);
+      break;
+    }
+
+    done += n;
+  }
+}
+
+// write exactly len bytes at offset off
+void pwrite_all(const int fd, const void * const buf, const size_t len,
+    const off64_t off) {
+  const char * ptr = (const char*)buf;
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = pwrite64(fd, ptr + done, len - done, off + done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in pwrite_all");
+      throw std::runtime_error("Failed to write");
+    }
+
+    done += n;
+  }
+}
+
+// the bytes on disk that contain the values [first_value, first_value +
+// num_values) of nbits bits each, skip is the number of values in the first
+// byte that precede first_value
+struct ByteRange {
+  size_t first;
+  size_t num;
+  size_t skip;
+};
+
+ByteRange byte_range(const size_t first_value, const size_t num_values,
+    const size_t nbits) {
+  ByteRange range;
+  range.first = first_value * nbits / 8;
+  range.num = ((first_value + num_values) * nbits + 7) / 8 - range.first;
+  range.skip = nbits < 8 ? first_value - range.first * 8 / nbits : 0;
+  return range;
+}
+
+// give the kernel a hint about how we are going to access the given range of a
+// memory mapped file, madvise needs a page aligned address
+void advise(const char * const ptr, const size_t len, const int advice) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t start = (size_t)ptr & ~(page_size - 1);
+  // this is only a hint, so we don't care if it fails
+  madvise((void*)start, len + ((size_t)ptr - start), advice);
+}
+
+} // namespace [unnamed]
+
+bool SigProc::IsStream(const std::string& name) {
+  if (name == "-")
+    return true;
+
+  // a file that doesn't exist (yet) is not a stream, don't leave that in errno
+  int saved_errno = errno;
+  struct stat st;
+  if (stat(name.c_str(), &st) != 0) {
+    errno = saved_errno;
+    return false;
+  }
+
+  return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) || S_ISCHR(st.st_mode);
+}
+
+SigProc::SigProc(const std::string& filename, const bool memoryMap) :
+  mpMap(nullptr),
+  mMapSize(0),
+  mDirectFD(-1),
+  mSequential(false),
+  mStreamOffset(0),
+  mpIO(nullptr) {
   mReadOnly = false;
   errno = 0;
 
-  mFD = open64(filename.c_str(), O_RDWR);
-
-  if (mFD == -1) {
-    errno = 0;
-    // try open read-only
+  if (IsStream(filename)) {
     mReadOnly = true;
-    mFD = open64(filename.c_str(), O_RDONLY);
+    mSequential = true;
+    mFD = filename == "-" ? dup(STDIN_FILENO)
+        : open64(filename.c_str(), O_RDONLY);
+  } else {
+    mFD = open64(filename.c_str(), O_RDWR);
+
+    if (mFD == -1) {
+      errno = 0;
+      // try open read-only
+      mReadOnly = true;
+      mFD = open64(filename.c_str(), O_RDONLY);
+    }
   }
 
   if (mFD == -1) {
@@ -40,8 +186,16 @@ SigProc::SigProc(const std::string& filename) {
     throw std::runtime_error("Failed to open file '" + filename + "'");
   }
 
-  mHeader = SigProcHeader::Read(mFD);
+  // reading the header of a stream may read the start of the data as well
+  if (mSequential) {
+    mHeader = SigProcHeader::ReadSequential(mFD, &mReadAhead);
+    mReadAhead.erase(mReadAhead.begin(),
+        mReadAhead.begin() + mHeader.Input_size);
+  } else {
+    mHeader = SigProcHeader::Read(mFD);
+  }
   mHeaderSize = mHeader.Input_size;
+  mStreamOffset = mHeaderSize;
 
   if (errno != 0) {
     perror("Failure in SigProc::SigProc(const std::string&)");
@@ -49,8 +203,28 @@ SigProc::SigProc(const std::string& filename) {
         "Failed to read header from file '" + filename + "'");
   }
 
-  if (mHeader.nbits != 32)
-    throw std::invalid_argument("Can only read 32-bit sigproc files");
+  if ((mHeader.nbits != 32) && !is_packed_nbits(mHeader.nbits))
+    throw std::invalid_argument("Can only read 1, 2, 4, 8, 16, and 32-bit "
+        "sigproc files");
+
+  if (mHeader.nbits != 32) {
+    size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+    mScales.assign(spectrum_size, 1.0f);
+    mOffsets.assign(spectrum_size, 0.0f);
+  }
+
+  // we can't look at the size or map a stream, we'll see where it ends
+  if (mSequential) {
+    if ((size_t)mHeader.nifs * (size_t)mHeader.nchans
+        * (size_t)mHeader.nbits % 8 != 0)
+      throw std::invalid_argument("Can only read a stream whose spectra are "
+          "whole bytes");
+
+    if (mHeader.nsamples <= 0)
+      mHeader.nsamples = -1;
+
+    return;
+  }
 
   // check file size
   off64_t seek = lseek64(mFD, 0, SEEK_END);
@@ -69,8 +243,8 @@ SigProc::SigProc(const std::string& filename) {
 
   if (mHeader.nsamples <= 0) {
     size_t data_size = file_size - mHeaderSize;
-    mHeader.nsamples = data_size / (size_t)mHeader.nifs / (size_t)mHeader.nchans
-        / (size_t)(mHeader.nbits / 8);
+    mHeader.nsamples = data_size * 8 / (size_t)mHeader.nifs
+        / (size_t)mHeader.nchans / (size_t)mHeader.nbits;
   }
 
   size_t data_size = mHeader.Data_size();
@@ -82,43 +256,57 @@ SigProc::SigProc(const std::string& filename) {
     throw std::invalid_argument("The sigproc file '" + filename + "' has less "
         "data than it reports");
   }
+
+  if (memoryMap && (file_size > 0)) {
+    void * map = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, mFD, 0);
+    if (map == MAP_FAILED) {
+      perror("Failure in SigProc::SigProc(const std::string&, const bool)");
+      throw std::runtime_error("Failed to memory map '" + filename + "'");
+    }
+
+    mpMap = (char*)map;
+    mMapSize = file_size;
+
+    // we mostly stream through the file
+    advise(mpMap, mMapSize, MADV_SEQUENTIAL);
+  }
 }
 
 SigProc::SigProc(const std::string& filename, const SigProcHeader& header) :
   mHeader(header),
-  mHeaderSize(header.Get_output_size()) {
+  mHeaderSize(header.Get_output_size()),
+  mpMap(nullptr),
+  mMapSize(0),
+  mDirectFD(-1),
+  mSequential(false),
+  mStreamOffset(mHeaderSize),
+  mpIO(nullptr) {
   mReadOnly = false;
   errno = 0;
 
-  if (mHeader.nbits != 32)
-    throw std::invalid_argument("Can only write 32-bit sigproc files");
-
-  if (mHeader.Data_size() == 0) {
-    // we don't know the file size, so create a new file overwriting any
-    // existing file
-    mFD = open64(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC,
-          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-  } else {
-    // we know the file size, allocate the entire file
-    size_t file_size = mHeaderSize + mHeader.Data_size();
+  if ((mHeader.nbits != 32) && !is_quantized_nbits(mHeader.nbits))
+    throw std::invalid_argument("Can only write 8, 16, and 32-bit sigproc "
+        "files");
 
-    // allocate file
-    FILE * f = fopen(filename.c_str(), "wb");
-
-    if (f == nullptr)
-      throw std::runtime_error("Failed to open file '" + filename + "'");
-
-    if (fseek(f, file_size - 1, SEEK_SET) != 0)
-      throw std::runtime_error("Failed to allocate file '" + filename + "'");
-
-    if (fputc(0, f) != 0)
-      throw std::runtime_error("Failed to allocate file '" + filename + "'");
+  if (mHeader.nbits != 32) {
+    size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+    mScales.assign(spectrum_size, 1.0f);
+    mOffsets.assign(spectrum_size, 0.0f);
+  }
 
-    if (fclose(f) != 0)
-      throw std::runtime_error("Failed to close file '" + filename + "'");
+  // if the header doesn't say how many spectra there are, we can write as
+  // many as we like
+  if (mHeader.nsamples <= 0)
+    mHeader.nsamples = -1;
 
-    // open file as fstream
-    mFD = open64(filename.c_str(), O_RDWR);
+  if (IsStream(filename)) {
+    mSequential = true;
+    mFD = filename == "-" ? dup(STDOUT_FILENO)
+        : open64(filename.c_str(), O_WRONLY);
+  } else {
+    // create a new file overwriting any existing file
+    mFD = open64(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
   }
 
   if (mFD == -1) {
@@ -127,6 +315,19 @@ SigProc::SigProc(const std::string& filename, const SigProcHeader& header) :
       throw std::runtime_error("Failed to open file '" + filename + "'");
     }
 
+  // if we know the file size, allocate the entire file
+  if (!mSequential && (mHeader.Data_size() != 0)) {
+    try {
+      Writeback::Allocate(mFD, mHeaderSize + mHeader.Data_size());
+    } catch (std::runtime_error&) {
+      close(mFD);
+      throw std::runtime_error("Failed to allocate file '" + filename + "'");
+    }
+  }
+
+  if (!mSequential)
+    mpWriteback = std::unique_ptr<Writeback>(new Writeback(mFD));
+
   mHeader.Write(mFD);
 
   if (errno != 0) {
@@ -138,8 +339,23 @@ SigProc::SigProc(const std::string& filename, const SigProcHeader& header) :
 }
 
 SigProc::~SigProc() noexcept(false) {
+  if (mpMap != nullptr) {
+    if (munmap(mpMap, mMapSize) != 0) {
+      perror("Failure in SigProc::~SigProc()");
+      throw std::runtime_error("Failed to unmap file");
+    }
+  }
+
+  // all requests have completed by now, but the backend may hold on to mFD
+  mpIO.reset();
+
   HardFlush();
 
+  if ((mDirectFD >= 0) && (close(mDirectFD) == -1)) {
+    perror("Failure in SigProc::~SigProc()");
+    throw std::runtime_error("Failed to close file");
+  }
+
   if (close(mFD) == -1) {
     perror("Failure in SigProc::~SigProc()");
     throw std::runtime_error("Failed to close file");
@@ -147,188 +363,898 @@ SigProc::~SigProc() noexcept(false) {
 }
 
 void SigProc::HardFlush() {
+  // what we wrote to a stream is gone already
+  if (mSequential)
+    return;
+
+  // most of the data is on disk already, so the fsync is cheap
+  if (mpWriteback != nullptr)
+    mpWriteback->Finish();
+
   if (fsync(mFD) != 0) {
     perror("Failure in HardFlush");
     throw std::runtime_error("Failed to flush SigProc file");
   }
 }
 
+void SigProc::SetDirectIO(const bool direct) {
+  // a stream has no page cache to bypass
+  if (mSequential || (direct == DirectIO()))
+    return;
+
+  // make sure no request uses the old descriptor anymore
+  if (mpIO != nullptr)
+    mpIO->Wait();
+
+  if (direct) {
+    mDirectFD = AsyncIO::OpenDirect(mFD, mReadOnly);
+  } else {
+    if (close(mDirectFD) == -1) {
+      perror("Failure in SigProc::SetDirectIO");
+      throw std::runtime_error("Failed to close file");
+    }
+    mDirectFD = -1;
+  }
+}
+
+void SigProc::ReadBytes(void * const buf, const size_t len,
+    const off64_t off) const {
+  if (mSequential) {
+    ReadStream(buf, len, off, false);
+    return;
+  }
+
+  if (mDirectFD < 0) {
+    pread_all(mFD, buf, len, off);
+    return;
+  }
+
+  AlignedBuffer bounce(std::min(len, BlockSize) + AsyncIO::DirectAlignment);
+
+  for (size_t done = 0; done < len; done += BlockSize) {
+    size_t n = std::min(BlockSize, len - done);
+    char * const ptr = bounce.Data() + DirectOffset(off + done);
+
+    QueueRead(ptr, n, off + done);
+    IO().Wait();
+    memcpy((char*)buf + done, ptr, n);
+  }
+}
+
+void SigProc::WriteBytes(const void * const buf, const size_t len,
+    const off64_t off) {
+  if (mSequential) {
+    WriteStream(buf, len, off);
+    return;
+  }
+
+  if (mDirectFD < 0) {
+    // write in blocks, so that the writeback of each block can start while we
+    // write the next one
+    for (size_t done = 0; done < len; done += BlockSize) {
+      size_t n = std::min(BlockSize, len - done);
+      pwrite_all(mFD, (const char*)buf + done, n, off + done);
+      Written(off + done, n);
+    }
+    return;
+  }
+
+  AlignedBuffer bounce(std::min(len, BlockSize) + AsyncIO::DirectAlignment);
+
+  for (size_t done = 0; done < len; done += BlockSize) {
+    size_t n = std::min(BlockSize, len - done);
+    char * const ptr = bounce.Data() + DirectOffset(off + done);
+
+    memcpy(ptr, (const char*)buf + done, n);
+    QueueWrite(ptr, n, off + done);
+    IO().Wait();
+  }
+
+  Written(off, len);
+}
+
+size_t SigProc::ReadStream(void * const buf, const size_t len,
+    const off64_t off, const bool partial) const {
+  if (off != mStreamOffset)
+    throw std::runtime_error("Cannot read a stream out of order, it can only "
+        "be read spectrum by spectrum from front to back");
+
+  // first what we read with the header
+  char * ptr = (char*)buf;
+  size_t done = std::min(len, mReadAhead.size());
+  memcpy(ptr, mReadAhead.data(), done);
+  mReadAhead.erase(mReadAhead.begin(), mReadAhead.begin() + done);
+
+  while (done < len) {
+    ssize_t n = read(mFD, ptr + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in SigProc::ReadStream");
+      throw std::runtime_error("Failed to read stream");
+    }
+
+    if (n == 0) {
+      if (partial)
+        break;
+
+      throw std::runtime_error("Unexpected end of stream");
+    }
+
+    done += n;
+  }
+
+  mStreamOffset += done;
+  return done;
+}
+
+void SigProc::WriteStream(const void * const buf, const size_t len,
+    const off64_t off) {
+  if (off != mStreamOffset)
+    throw std::runtime_error("Cannot write a stream out of order, it can only "
+        "be written spectrum by spectrum from front to back");
+
+  const char * ptr = (const char*)buf;
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t n = write(mFD, ptr + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in SigProc::WriteStream");
+      throw std::runtime_error("Failed to write stream");
+    }
+
+    done += n;
+  }
+
+  mStreamOffset += len;
+}
+
 void SigProc::GetData(float * const data) const {
+  if (ChannelMajor()) {
+    GetSpectra(data, 0, mHeader.nsamples);
+    return;
+  }
+
   size_t num_elements = (size_t)mHeader.nifs * (size_t)mHeader.nchans
       * (size_t)mHeader.nsamples;
-  if ((size_t)lseek64(mFD, mHeaderSize, SEEK_SET) != mHeaderSize) {
-    perror("Failure in SigProc::GetData");
-    throw std::runtime_error("Failed to seek");
-  }
 
-  size_t nbytes = num_elements * (size_t)(mHeader.nbits / 8);
-  if ((size_t)read(mFD, data, nbytes) != nbytes) {
-    perror("Failure in SigProc::GetData");
-    throw std::runtime_error("Failed to read");
-  }
+  std::vector<unsigned char> raw;
+  ReadValues(data, 0, num_elements, &raw);
 }
 
 void SigProc::SetData(const float * const data) {
   if (mReadOnly)
     throw std::runtime_error("Cannot set data on a read-only sigproc file");
 
+  if ((mHeader.nbits != 32) && !is_quantized_nbits(mHeader.nbits))
+    throw std::runtime_error("Can only write data to 8, 16, and 32-bit "
+        "sigproc files");
+
+  if (ChannelMajor()) {
+    SetSpectra(0, data, mHeader.nsamples);
+    return;
+  }
+
   size_t num_elements = (size_t)mHeader.nifs * (size_t)mHeader.nchans
       * (size_t)mHeader.nsamples;
 
-  if ((size_t)lseek64(mFD, mHeaderSize, SEEK_SET) != mHeaderSize) {
-    perror("Failure in SigProc::SetData");
-    throw std::runtime_error("Failed to seek");
+  std::vector<unsigned char> raw;
+  WriteValues(0, data, num_elements, &raw);
+}
+
+void SigProc::GetSpectra(float * const data, const size_t first_sample,
+    const size_t num_samples) const {
+  if (first_sample + num_samples > (size_t)mHeader.nsamples)
+    throw std::out_of_range("Requested samples out of range");
+
+  if (num_samples == 0)
+    return;
+
+  const size_t nsamples = mHeader.nsamples;
+  const size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+
+  std::vector<unsigned char> raw;
+
+  if (!ChannelMajor()) {
+    ReadValues(data, first_sample * spectrum_size, num_samples * spectrum_size,
+        &raw);
+    return;
+  }
+
+  // Read the time window of a group of channels (one read per channel) and
+  // transpose the group into the spectra. The channels of all IFs are stored
+  // one after the other, so we can treat them as one long list of channels.
+  const float * const mapped = MappedData();
+  size_t group = BlockSize / (num_samples * sizeof(float));
+  group = std::min(std::max(group, (size_t)1), spectrum_size);
+
+  std::vector<float> staging(mapped == nullptr ? group * num_samples : 0);
+
+  for (size_t g0 = 0; g0 < spectrum_size; g0 += group) {
+    size_t num = std::min(group, spectrum_size - g0);
+
+    const float * src = mapped + g0 * nsamples + first_sample;
+    size_t src_stride = nsamples;
+
+    if (mapped == nullptr) {
+      for (size_t i = 0; i < num; ++i) {
+        ReadValues(staging.data() + i * num_samples,
+            (g0 + i) * nsamples + first_sample, num_samples, &raw);
+      }
+
+      src = staging.data();
+      src_stride = num_samples;
+    }
+
+    transpose_tiled(src, src_stride, data + g0, spectrum_size, num,
+        num_samples);
+  }
+}
+
+size_t SigProc::GetNextSpectra(float * const data,
+    const size_t max_samples) const {
+  if (!mSequential || ChannelMajor())
+    throw std::runtime_error("Can only get the next spectra of a time-major "
+        "stream");
+
+  const size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+  const size_t spectrum_bytes = spectrum_size * mHeader.nbits / 8;
+  const size_t first_sample = (mStreamOffset - mHeaderSize) / spectrum_bytes;
+
+  size_t num_samples = max_samples;
+  if (mHeader.nsamples >= 0)
+    num_samples = std::min(num_samples, std::max((size_t)mHeader.nsamples,
+        first_sample) - first_sample);
+
+  // the bytes of an incomplete spectrum at the end of the stream are dropped
+  std::vector<unsigned char> raw;
+  void * dest = data;
+  if (mHeader.nbits != 32) {
+    raw.resize(num_samples * spectrum_bytes);
+    dest = raw.data();
+  }
+
+  num_samples = ReadStream(dest, num_samples * spectrum_bytes, mStreamOffset,
+      true) / spectrum_bytes;
+
+  if (mHeader.nbits != 32)
+    unpack_to_float(raw.data(), 0, data, num_samples * spectrum_size,
+        mHeader.nbits);
+
+  return num_samples;
+}
+
+void SigProc::SetSpectra(const size_t first_sample, const float * const data,
+    const size_t num_samples) {
+  if (mReadOnly)
+    throw std::runtime_error("Cannot set spectra on a read-only sigproc file");
+
+  if ((mHeader.nbits != 32) && !is_quantized_nbits(mHeader.nbits))
+    throw std::runtime_error("Can only write data to 8, 16, and 32-bit "
+        "sigproc files");
+
+  if (first_sample + num_samples > (size_t)mHeader.nsamples)
+    throw std::out_of_range("Requested samples out of range");
+
+  if (num_samples == 0)
+    return;
+
+  const size_t nsamples = mHeader.nsamples;
+  const size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+
+  std::vector<unsigned char> raw;
+
+  if (!ChannelMajor()) {
+    WriteValues(first_sample * spectrum_size, data,
+        num_samples * spectrum_size, &raw);
+    return;
+  }
+
+  // transpose a group of channels at a time and write the time window of each
+  // channel in the group
+  size_t group = BlockSize / (num_samples * sizeof(float));
+  group = std::min(std::max(group, (size_t)1), spectrum_size);
+
+  std::vector<float> staging(group * num_samples);
+
+  for (size_t g0 = 0; g0 < spectrum_size; g0 += group) {
+    size_t num = std::min(group, spectrum_size - g0);
+
+    transpose_tiled(data + g0, spectrum_size, staging.data(), num_samples,
+        num_samples, num);
+
+    for (size_t i = 0; i < num; ++i) {
+      WriteValues((g0 + i) * nsamples + first_sample,
+          staging.data() + i * num_samples, num_samples, &raw);
+    }
+  }
+}
+
+void SigProc::SetQuantization(const float scale, const float offset) {
+  std::fill(mScales.begin(), mScales.end(), scale);
+  std::fill(mOffsets.begin(), mOffsets.end(), offset);
+}
+
+void SigProc::SetChannelQuantization(const size_t if_idx,
+    const size_t channel_idx, const float scale, const float offset) {
+  if (((int)if_idx >= mHeader.nifs) || ((int)channel_idx >= mHeader.nchans))
+    throw std::out_of_range("Channel out of range");
+
+  if (mScales.size() == 0)
+    return;
+
+  mScales[if_idx * mHeader.nchans + channel_idx] = scale;
+  mOffsets[if_idx * mHeader.nchans + channel_idx] = offset;
+}
+
+void SigProc::GetChannelQuantization(const size_t if_idx,
+    const size_t channel_idx, float * const scale, float * const offset) const {
+  if (((int)if_idx >= mHeader.nifs) || ((int)channel_idx >= mHeader.nchans))
+    throw std::out_of_range("Channel out of range");
+
+  if (mScales.size() == 0) {
+    *scale = 1.0;
+    *offset = 0.0;
+    return;
+  }
+
+  *scale = mScales[if_idx * mHeader.nchans + channel_idx];
+  *offset = mOffsets[if_idx * mHeader.nchans + channel_idx];
+}
+
+void SigProc::QuantizeValues(const size_t first_value,
+    const float * const data, const size_t num_values,
+    unsigned char * const out) const {
+  const size_t nsamples = mHeader.nsamples;
+  const size_t spectrum_size = (size_t)mHeader.nifs * (size_t)mHeader.nchans;
+  const size_t bytes_per_value = mHeader.nbits / 8;
+
+  // split the values into runs of the same channel (channel-major) or runs
+  // within the same spectrum (time-major)
+  size_t i = 0;
+  while (i < num_values) {
+    size_t idx = first_value + i;
+
+    if (ChannelMajor()) {
+      size_t chan = idx / nsamples;
+      size_t len = std::min(num_values - i, (chan + 1) * nsamples - idx);
+      quantize_from_float(data + i, mScales[chan], mOffsets[chan],
+          out + i * bytes_per_value, len, mHeader.nbits);
+      i += len;
+    } else {
+      size_t chan = idx % spectrum_size;
+      size_t len = std::min(num_values - i, spectrum_size - chan);
+      quantize_from_float(data + i, mScales.data() + chan,
+          mOffsets.data() + chan, out + i * bytes_per_value, len,
+          mHeader.nbits);
+      i += len;
+    }
+  }
+}
+
+void SigProc::WriteValues(const size_t first_value, const float * const data,
+    const size_t num_values, std::vector<unsigned char> * const raw) {
+  if (num_values == 0)
+    return;
+
+  const size_t bytes_per_value = mHeader.nbits / 8;
+  const off64_t off = mHeaderSize + first_value * bytes_per_value;
+
+  if (mHeader.nbits == 32) {
+    WriteBytes(data, num_values * sizeof(float), off);
+    return;
+  }
+
+  if (raw->size() < num_values * bytes_per_value)
+    raw->resize(num_values * bytes_per_value);
+
+  QuantizeValues(first_value, data, num_values, raw->data());
+  WriteBytes(raw->data(), num_values * bytes_per_value, off);
+}
+
+void SigProc::ReadValues(float * const data, const size_t first_value,
+    const size_t num_values, std::vector<unsigned char> * const raw) const {
+  if (num_values == 0)
+    return;
+
+  if (mHeader.nbits == 32) {
+    off64_t off = mHeaderSize + first_value * sizeof(float);
+    if (mpMap != nullptr)
+      memcpy(data, mpMap + off, num_values * sizeof(float));
+    else
+      ReadBytes(data, num_values * sizeof(float), off);
+
+    return;
   }
 
-  size_t nbytes = num_elements * (size_t)(mHeader.nbits / 8);
-  if ((size_t)write(mFD, data, nbytes) != nbytes) {
-    perror("Failure in SigProc::SetData");
-    throw std::runtime_error("Failed to write");
+  // read the bytes that contain the packed values and unpack them, values with
+  // fewer than 8 bits may start in the middle of a byte
+  const auto range = byte_range(first_value, num_values, mHeader.nbits);
+
+  const unsigned char * src = nullptr;
+
+  if (mpMap != nullptr) {
+    src = (const unsigned char*)mpMap + mHeaderSize + range.first;
+  } else {
+    if (raw->size() < range.num)
+      raw->resize(range.num);
+
+    ReadBytes(raw->data(), range.num, mHeaderSize + range.first);
+    src = raw->data();
   }
+
+  unpack_to_float(src, range.skip, data, num_values, mHeader.nbits);
 }
 
 template<bool PRINT>
-void SigProc::DoGetChannels(float * const data, const size_t if_idx,
-    const size_t first_channel_idx, const size_t num_channels) const {
+void SigProc::DoGetChannels(float * const data, const size_t first_if_idx,
+    const size_t num_ifs, const size_t first_channel_idx,
+    const size_t num_channels, const size_t first_sample,
+    const size_t num_samples) const {
   int prev_prog = 0;
 
+  if (mSequential)
+    throw std::runtime_error("Cannot read channels from a stream, it can only "
+        "be read spectrum by spectrum from front to back");
+
   if (PRINT) {
-    printf("%2i%%", prev_prog);
-    fflush(stdout);
+    fprintf(stderr, "%2i%%", prev_prog);
+    fflush(stderr);
   }
 
-  if ((int)if_idx >= mHeader.nifs)
+  if ((int)(first_if_idx + num_ifs) > mHeader.nifs)
     throw std::out_of_range("if_idx is out of range");
 
   if ((int)(first_channel_idx + num_channels) > mHeader.nchans)
     throw std::out_of_range("Requested channels out of range");
 
-  if (num_channels == 0) {
+  if (first_sample + num_samples > (size_t)std::max(mHeader.nsamples, (int64_t)0))
+    throw std::out_of_range("Requested samples out of range");
+
+  if ((num_ifs == 0) || (num_channels == 0) || (num_samples == 0)) {
+    if (PRINT)
+      fprintf(stderr, "\b\b\bdone (nothing read)");
+    return;
+  }
+
+  // from here on, nsamples is the length of the window and all offsets into
+  // the file are relative to the first spectrum of the window
+  const size_t nsamples = num_samples;
+  const size_t bytes_per_value = sizeof(float);
+  const size_t nchans = mHeader.nchans;
+  const size_t spectrum_size = (size_t)mHeader.nifs * nchans;
+  const size_t first_value = first_sample * spectrum_size;
+
+  // the channels of IF first_if_idx + i go to data_if(i)
+  auto data_if = [&](const size_t i) {
+    return data + i * num_channels * nsamples;
+  };
+
+  std::vector<unsigned char> raw;
+
+  if (ChannelMajor()) {
+    // the channels are already stored one after the other, so the window of
+    // each channel is contiguous
+    for (size_t i = 0; i < num_ifs; ++i) {
+      const size_t chan = (first_if_idx + i) * nchans + first_channel_idx;
+
+      if (num_samples == (size_t)mHeader.nsamples) {
+        ReadValues(data_if(i), chan * nsamples, num_channels * nsamples, &raw);
+      } else {
+        for (size_t c = 0; c < num_channels; ++c) {
+          ReadValues(data_if(i) + c * nsamples,
+              (chan + c) * mHeader.nsamples + first_sample, nsamples, &raw);
+        }
+      }
+    }
+
     if (PRINT)
-      printf("\b\b\bdone (nothing read)");
+      fprintf(stderr, "\b\b\bdone");
     return;
   }
 
-  for (size_t t = 0; t < (size_t)mHeader.nsamples; ++t) {
-    std::vector<float> sample(num_channels);
+  if (MappedData() != nullptr) {
+    // transpose straight out of the page cache, one block at a time so that we
+    // can ask the kernel to start reading the next block
+    const float * const mapped = MappedData() + first_value;
 
-    size_t offset = t * mHeader.nifs * mHeader.nchans + if_idx * mHeader.nchans
-        + first_channel_idx;
+    size_t block_len = BlockSize / (spectrum_size * bytes_per_value);
+    block_len = std::min(std::max(block_len, (size_t)1), nsamples);
 
-    off64_t off = offset * (size_t)(mHeader.nbits / 8) + mHeaderSize;
-    if (lseek64(mFD, off, SEEK_SET) != off) {
-      perror("Failure in SigProc::DoGetChannels");
-      throw std::runtime_error("Failed to seek");
+    for (size_t t0 = 0; t0 < nsamples; t0 += block_len) {
+      size_t len = std::min(block_len, nsamples - t0);
+
+      if (t0 + len < nsamples) {
+        size_t next_len = std::min(block_len, nsamples - t0 - len);
+        advise((const char*)(mapped + (t0 + len) * spectrum_size),
+            next_len * spectrum_size * bytes_per_value, MADV_WILLNEED);
+      }
+
+      for (size_t i = 0; i < num_ifs; ++i) {
+        const float * const src = mapped + t0 * spectrum_size
+            + (first_if_idx + i) * nchans + first_channel_idx;
+        transpose_tiled(src, spectrum_size, data_if(i) + t0, nsamples, len,
+            num_channels);
+      }
+
+      if (PRINT) {
+        int prog = (int)(100.0 * (double)(t0 + len) / (double)nsamples);
+        prog = std::min(99, prog);
+        if (prog != prev_prog) {
+          fprintf(stderr, "\b\b\b%2i%%", prog);
+          fflush(stderr);
+          prev_prog = prog;
+        }
+      }
     }
 
-    size_t nbytes = num_channels * sizeof(float);
-    if ((size_t)read(mFD, sample.data(), nbytes) != nbytes) {
-      perror("Failure in SigProc::DoGetChannels");
-      throw std::runtime_error("Failed to read");
+    if (PRINT)
+      fprintf(stderr, "\b\b\bdone");
+    return;
+  }
+
+  // Read blocks of many consecutive spectra with a single read and transpose
+  // them into the channel-major output. If the channels we want are a small
+  // part of a big spectrum, read only the wanted strip of each spectrum. The
+  // strip runs from our first channel of the first IF to our last channel of
+  // the last IF, so that all IFs are demultiplexed from a single pass. The gap
+  // is measured in bits on disk, since the data may be packed. The reads are
+  // asynchronous and double buffered: while we unpack and transpose one block,
+  // the next one is already being read.
+  const size_t nbits = mHeader.nbits;
+  const size_t strip_values = (num_ifs - 1) * nchans + num_channels;
+  const size_t gap = (spectrum_size - strip_values) * nbits;
+  const bool read_span = (gap <= 8 * MaxGapSize)
+      || (gap <= 3 * strip_values * nbits);
+  const size_t stride = read_span ? spectrum_size : strip_values;
+
+  size_t block_len = BlockSize / (stride * bytes_per_value);
+  block_len = std::min(std::max(block_len, (size_t)1), nsamples);
+
+  // Each strip gets its own slot in the raw buffer, for packed data a strip
+  // may need one more byte than its values if it starts in the middle of a
+  // byte. With direct I/O, each read is placed at its offset relative to an
+  // aligned address, so a slot needs up to DirectAlignment extra bytes.
+  // 32-bit data is used in place, unless direct I/O placed it at an address
+  // that is not a multiple of 4 (if the header size isn't) or padded the
+  // slots of separate strips, which then no longer follow each other.
+  const size_t block_values = (block_len - 1) * stride + strip_values;
+  const size_t slack = DirectIO() ? AsyncIO::DirectAlignment : 0;
+  size_t strip_bytes = nbits == 32 ? strip_values * sizeof(float)
+      : (strip_values * nbits + 7) / 8 + 1;
+  if (DirectIO())
+    strip_bytes = (strip_bytes + 2 * slack - 1) / slack * slack;
+  const size_t raw_bytes = read_span ? (block_values * nbits + 7) / 8 + 1
+      + slack : block_len * strip_bytes;
+
+  AlignedBuffer raw_blocks[2];
+  for (auto& r : raw_blocks)
+    r.Resize(raw_bytes);
+
+  const bool unpack = (nbits != 32) || (DirectOffset(mHeaderSize) % 4 != 0)
+      || (DirectIO() && !read_span);
+  std::vector<float> block(unpack ? block_values : 0);
+
+  AsyncIO& io = IO();
+
+  // the location of the strip of spectrum t of the block starting at t0 in
+  // the file and in the raw buffer
+  auto strip = [&](const size_t t0, const size_t t, const size_t num,
+      char * const buf, ByteRange * const range) {
+    size_t offset = first_value + (t0 + t) * spectrum_size
+        + first_if_idx * nchans + first_channel_idx;
+    *range = byte_range(offset, num, nbits);
+    return buf + (read_span ? 0 : t * strip_bytes)
+        + DirectOffset(mHeaderSize + range->first);
+  };
+
+  // queue the reads of the block starting at t0
+  auto read_block = [&](const size_t t0, char * const buf) {
+    size_t len = std::min(block_len, nsamples - t0);
+    ByteRange range;
+
+    if (read_span) {
+      char * ptr = strip(t0, 0, (len - 1) * spectrum_size + strip_values, buf,
+          &range);
+      QueueRead(ptr, range.num, mHeaderSize + range.first);
+    } else {
+      for (size_t t = 0; t < len; ++t) {
+        char * ptr = strip(t0, t, strip_values, buf, &range);
+        QueueRead(ptr, range.num, mHeaderSize + range.first);
+      }
+    }
+
+    io.Flush();
+  };
+
+  read_block(0, raw_blocks[0].Data());
+
+  for (size_t t0 = 0, k = 0; t0 < nsamples; t0 += block_len, ++k) {
+    size_t len = std::min(block_len, nsamples - t0);
+    char * const buf = raw_blocks[k % 2].Data();
+
+    io.Wait();
+    if (t0 + len < nsamples)
+      read_block(t0 + len, raw_blocks[(k + 1) % 2].Data());
+
+    ByteRange range;
+    const float * src = (const float*)strip(t0, 0, 0, buf, &range);
+
+    if (unpack) {
+      size_t num = read_span ? (len - 1) * spectrum_size + strip_values
+          : strip_values;
+
+      for (size_t t = 0; t < (read_span ? 1 : len); ++t) {
+        char * ptr = strip(t0, t, num, buf, &range);
+        float * out = block.data() + t * strip_values;
+
+        if (nbits == 32)
+          memcpy(out, ptr, num * sizeof(float));
+        else
+          unpack_to_float(ptr, range.skip, out, num, nbits);
+      }
+
+      src = block.data();
     }
 
-    for (size_t i = 0; i < num_channels; ++i) {
-      data[i * mHeader.nsamples + t] = sample[i];
+    for (size_t i = 0; i < num_ifs; ++i) {
+      transpose_tiled(src + i * nchans, stride, data_if(i) + t0, nsamples, len,
+          num_channels);
     }
 
     if (PRINT) {
-      int prog = (int)(100.0 * (double)(t + 1) / (double)mHeader.nsamples);
+      int prog = (int)(100.0 * (double)(t0 + len) / (double)nsamples);
       prog = std::min(99, prog);
       if (prog != prev_prog) {
-        printf("\b\b\b%2i%%", prog);
-        fflush(stdout);
+        fprintf(stderr, "\b\b\b%2i%%", prog);
+        fflush(stderr);
         prev_prog = prog;
       }
     }
   }
 
-  if (errno != 0) {
-    perror("Failure in SigProc::DoGetChannels");
-    throw std::runtime_error("An error occurred while reading channel from "
-        "sigproc file");
-  }
-
   if (PRINT)
-    printf("\b\b\bdone");
+    fprintf(stderr, "\b\b\bdone");
 }
 
 template<bool PRINT>
-void SigProc::DoSetChannels(const size_t if_idx, const size_t first_channel_idx,
-    const float * const data, const size_t num_channels) {
+void SigProc::DoSetChannels(const size_t first_if_idx, const size_t num_ifs,
+    const size_t first_channel_idx, const size_t first_sample,
+    const float * const data, const size_t num_channels,
+    const size_t num_samples) {
   int prev_prog = 0;
 
+  if (mSequential)
+    throw std::runtime_error("Cannot write channels to a stream, it can only "
+        "be written spectrum by spectrum from front to back");
+
   if (PRINT) {
-    printf("%2i%%", prev_prog);
-    fflush(stdout);
+    fprintf(stderr, "%2i%%", prev_prog);
+    fflush(stderr);
   }
 
   if (mReadOnly)
     throw std::runtime_error("Cannot set channels on a read-only sigproc file");
 
-  if (num_channels == 0) {
+  if ((mHeader.nbits != 32) && !is_quantized_nbits(mHeader.nbits))
+    throw std::runtime_error("Can only write data to 8, 16, and 32-bit "
+        "sigproc files");
+
+  if ((num_ifs == 0) || (num_channels == 0)) {
     if (PRINT)
-      printf("\b\b\bdone (nothing written)");
+      fprintf(stderr, "\b\b\bdone (nothing written)");
     return;
   }
 
-  if ((int)if_idx >= mHeader.nifs)
+  if ((int)(first_if_idx + num_ifs) > mHeader.nifs)
     throw std::out_of_range("if_idx is out of range");
 
   if ((int)(first_channel_idx + num_channels) > mHeader.nchans)
     throw std::out_of_range("Requested channels out of range");
 
-  for (size_t t = 0; t < (size_t)mHeader.nsamples; ++t) {
-    std::vector<float> sample(num_channels);
+  if (first_sample + num_samples > (size_t)std::max(mHeader.nsamples, (int64_t)0))
+    throw std::out_of_range("Requested samples out of range");
+
+  if (num_samples == 0) {
+    if (PRINT)
+      fprintf(stderr, "\b\b\bdone (nothing written)");
+    return;
+  }
 
-    for (size_t i = 0; i < num_channels; ++i) {
-      sample[i] = data[i * mHeader.nsamples + t];
+  // from here on, nsamples is the length of the window and all offsets into
+  // the file are relative to the first spectrum of the window
+  const size_t nsamples = num_samples;
+  const size_t bytes_per_value = mHeader.nbits / 8;
+  const size_t nchans = mHeader.nchans;
+  const size_t spectrum_size = (size_t)mHeader.nifs * nchans;
+  const size_t first_value = first_sample * spectrum_size;
+
+  // the channels of IF first_if_idx + i come from data_if(i)
+  auto data_if = [&](const size_t i) {
+    return data + i * num_channels * nsamples;
+  };
+
+  if (ChannelMajor()) {
+    // the channels are stored one after the other, so the window of each
+    // channel is contiguous
+    std::vector<unsigned char> raw;
+
+    for (size_t i = 0; i < num_ifs; ++i) {
+      const size_t chan = (first_if_idx + i) * nchans + first_channel_idx;
+
+      if (num_samples == (size_t)mHeader.nsamples) {
+        WriteValues(chan * nsamples, data_if(i), num_channels * nsamples, &raw);
+      } else {
+        for (size_t c = 0; c < num_channels; ++c) {
+          WriteValues((chan + c) * mHeader.nsamples + first_sample,
+              data_if(i) + c * nsamples, nsamples, &raw);
+        }
+      }
     }
 
-    size_t offset = t * mHeader.nifs * mHeader.nchans + if_idx * mHeader.nchans
-        + first_channel_idx;
+    if (PRINT)
+      fprintf(stderr, "\b\b\bdone");
+    return;
+  }
+
+  // Assemble blocks of many consecutive spectra in a staging buffer and write
+  // each block with a single write. If we cover entire spectra, the blocks are
+  // simply written one after the other. If we only cover part of each spectrum
+  // the rest of the span has to be preserved, so we read the span, fill in our
+  // channels and write it back. If our channels are a small part of a big
+  // spectrum, we write the strip of each spectrum individually instead. For
+  // 8 and 16-bit files, we transpose into a compact block of floats and
+  // quantize it into the staging buffer. The writes are asynchronous and we
+  // alternate between two staging buffers, so that we can assemble the next
+  // block while the previous one is being written. With direct I/O, each write
+  // is placed at its offset relative to an aligned address, which means that
+  // strips get their own slots and 32-bit values may not be aligned, so we
+  // go through the compact block as well. Like for reading, the strip covers
+  // our channels of all our IFs. If there are other channels between the IFs,
+  // they have to be preserved, so we always read and write back the span.
+  const bool quantize = (mHeader.nbits != 32);
+  const size_t strip_values = (num_ifs - 1) * nchans + num_channels;
+  const bool dense_strip = (num_ifs == 1) || (num_channels == nchans);
+  const size_t gap = (spectrum_size - strip_values) * bytes_per_value;
+  const bool full_spectra = (strip_values == spectrum_size);
+  const bool write_span = !dense_strip || (gap <= MaxGapSize)
+      || (gap <= 3 * strip_values * bytes_per_value);
+  const size_t stride = write_span ? spectrum_size : strip_values;
+
+  size_t block_len = BlockSize / (stride * sizeof(float));
+  block_len = std::min(std::max(block_len, (size_t)1), nsamples);
+
+  const size_t block_values = (block_len - 1) * stride + strip_values;
+  const size_t slack = DirectIO() ? AsyncIO::DirectAlignment : 0;
+  const size_t chan_bytes = num_channels * bytes_per_value;
+  const size_t strip_bytes = strip_values * bytes_per_value;
+  const size_t slot_bytes = (DirectIO() && !write_span) ?
+      (strip_bytes + 2 * slack - 1) / slack * slack : strip_bytes;
+  const bool compact = quantize || (DirectOffset(mHeaderSize) % 4 != 0)
+      || (slot_bytes != strip_bytes);
+
+  std::vector<float> block(compact ? block_len * num_channels : 0);
+
+  AlignedBuffer staging_blocks[2];
+  for (auto& b : staging_blocks)
+    b.Resize(write_span ? block_values * bytes_per_value + slack
+        : block_len * slot_bytes);
+
+  AsyncIO& io = IO();
+
+  // If we write entire spectra, the blocks are written in sequence and we
+  // report each one once its write has completed, so that its writeback
+  // starts. Otherwise the next batch of channels will touch the same pages.
+  off64_t written_off = 0;
+  size_t written_len = 0;
+  auto report_written = [&]() {
+    if (full_spectra)
+      Written(written_off, written_len);
+    written_len = 0;
+  };
+
+  for (size_t t0 = 0, k = 0; t0 < nsamples; t0 += block_len, ++k) {
+    size_t len = std::min(block_len, nsamples - t0);
+    char * const staging = staging_blocks[k % 2].Data();
+
+    size_t offset = first_value + t0 * spectrum_size
+        + first_if_idx * nchans + first_channel_idx;
+    off64_t off = offset * bytes_per_value + mHeaderSize;
+    size_t span = ((len - 1) * spectrum_size + strip_values) * bytes_per_value;
+
+    // where the values of spectrum t of this block go in the staging buffer
+    auto row = [&](const size_t t) {
+      off64_t row_off = off + t * spectrum_size * bytes_per_value;
+      if (write_span)
+        return staging + DirectOffset(off) + (row_off - off);
+      else
+        return staging + t * slot_bytes + DirectOffset(row_off);
+    };
+
+    if (write_span && !full_spectra) {
+      if (DirectIO()) {
+        QueueRead(row(0), span, off);
+        io.Wait();
+      } else {
+        pread_or_zero(mFD, row(0), span, off);
+      }
+    }
 
-    off64_t off = offset * (size_t)(mHeader.nbits / 8) + mHeaderSize;
-    if (lseek64(mFD, off, SEEK_SET) != off) {
-      perror("Failure in SigProc::DoSetChannels");
-      throw std::runtime_error("Failed to seek");
+    for (size_t i = 0; i < num_ifs; ++i) {
+      // our channels of IF first_if_idx + i in the strip
+      const size_t skip = i * nchans;
+
+      if (compact) {
+        transpose_tiled(data_if(i) + t0, nsamples, block.data(), num_channels,
+            num_channels, len);
+
+        for (size_t t = 0; t < len; ++t) {
+          const float * const values = block.data() + t * num_channels;
+          char * const dst = row(t) + skip * bytes_per_value;
+          if (quantize)
+            QuantizeValues(offset + t * spectrum_size + skip, values,
+                num_channels, (unsigned char*)dst);
+          else
+            memcpy(dst, values, chan_bytes);
+        }
+      } else {
+        transpose_tiled(data_if(i) + t0, nsamples, (float*)row(0) + skip,
+            stride, num_channels, len);
+      }
     }
 
-    size_t nbytes = num_channels * sizeof(float);
-    if ((size_t)write(mFD, sample.data(), nbytes) != nbytes) {
-      perror("Failure in SigProc::DoSetChannels");
-      throw std::runtime_error("Failed to write");
+    // wait for the previous block, so that its buffer is free for the next one
+    io.Wait();
+    report_written();
+
+    if (write_span) {
+      QueueWrite(row(0), span, off);
+    } else {
+      for (size_t t = 0; t < len; ++t) {
+        QueueWrite(row(t), strip_bytes,
+            off + t * spectrum_size * bytes_per_value);
+      }
     }
+    io.Flush();
+    written_off = off;
+    written_len = span;
 
     if (PRINT) {
-      int prog = (int)(100.0 * (double)(t + 1) / (double)mHeader.nsamples);
+      int prog = (int)(100.0 * (double)(t0 + len) / (double)nsamples);
       prog = std::min(99, prog);
       if (prog != prev_prog) {
-        printf("\b\b\b%2i%%", prog);
-        fflush(stdout);
+        fprintf(stderr, "\b\b\b%2i%%", prog);
+        fflush(stderr);
         prev_prog = prog;
       }
     }
   }
 
-  if (errno != 0) {
-    perror("Failure in SigProc::DoSetChannels");
-    throw std::runtime_error("An error occurred while writing channel from "
-        "sigproc file");
-  }
+  io.Wait();
+  report_written();
 
   if (PRINT)
-    printf("\b\b\bdone");
+    fprintf(stderr, "\b\b\bdone");
 }
 
 // explicit template instantiations
 template void SigProc::DoGetChannels<true>(float * const, const size_t,
-    const size_t, const size_t) const;
+    const size_t, const size_t, const size_t, const size_t,
+    const size_t) const;
 
 template void SigProc::DoGetChannels<false>(float * const, const size_t,
-    const size_t, const size_t) const;
+    const size_t, const size_t, const size_t, const size_t,
+    const size_t) const;
 
 template void SigProc::DoSetChannels<true>(const size_t, const size_t,
-    const float * const, const size_t);
+    const size_t, const size_t, const float * const, const size_t,
+    const size_t);
 
 template void SigProc::DoSetChannels<false>(const size_t, const size_t,
-    const float * const, const size_t);
+    const size_t, const size_t, const float * const, const size_t,
+    const size_t);
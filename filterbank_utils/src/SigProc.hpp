@@ -10,22 +10,42 @@
 
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <stdexcept>
 
+#include "AsyncIO.hpp"
 #include "SigProcHeader.hpp"
+#include "Writeback.hpp"
 
 class SigProc {
 public:
-  // open a file
-  SigProc(const std::string& filename);
-
-  // create a new file
+  // Open a file, if memoryMap is true, the file is mapped read-only into memory
+  // and the data is read straight from the page cache. If filename is "-" or
+  // a pipe (see IsStream), the header is read from the stream and the data can
+  // only be read in order (see Sequential). A stream that doesn't say how many
+  // spectra it has gets nsamples = -1 and is read with GetNextSpectra.
+  SigProc(const std::string& filename, const bool memoryMap = false);
+
+  // Create a new file. If filename is "-" or a pipe, the header is written to
+  // the stream right away and the data has to be written in order. If the
+  // header doesn't say how many spectra there will be (nsamples <= 0), we get
+  // nsamples = -1 and can write as many as we like.
   SigProc(const std::string& filename, const SigProcHeader& header);
 
   ~SigProc()  noexcept(false);
 
+  // true if name is "-" (stdin or stdout) or a pipe, socket or character
+  // device, which can only be read or written once from front to back
+  static bool IsStream(const std::string& name);
+
+  // true if the file is a stream, whose data can only be read or written
+  // spectrum by spectrum from front to back, anything else throws
+  bool Sequential() const {
+    return mSequential;
+  }
+
   const SigProcHeader& Header() const {
     return mHeader;
   }
@@ -34,15 +54,66 @@ public:
     return mHeaderSize;
   }
 
+  // true if the data is stored channel by channel rather than spectrum by
+  // spectrum (see SigProcHeader::channel_major)
+  bool ChannelMajor() const {
+    return mHeader.channel_major != 0;
+  }
+
+  // Make sure the data is on disk. The writeback of data written in sequence
+  // is started while it is being written (see Writeback), so this is cheap.
   void HardFlush();
 
+  // Tell the file that the bytes [off, off + len) have been written to FD()
+  // from outside (like the asynchronous writes of MakeFilterbank), so that
+  // their writeback can be started. SigProc reports its own writes.
+  void Written(const off64_t off, const size_t len) {
+    if (mpWriteback != nullptr)
+      mpWriteback->Written(off, len);
+  }
+
+  // drop the data from the page cache once it is on disk
+  void SetDropBehind(const bool dropBehind) {
+    if (mpWriteback != nullptr)
+      mpWriteback->SetDropBehind(dropBehind);
+  }
+
   void GetChannels(float * const data, const size_t if_idx,
       const size_t first_channel_idx, const size_t num_channels,
       const bool print_progress = false) const {
+    GetChannels(data, if_idx, first_channel_idx, num_channels, 0,
+        (size_t)mHeader.nsamples, print_progress);
+  }
+
+  // Read the time window [first_sample, first_sample + num_samples) of the
+  // given channels, data holds num_samples values of each channel, one channel
+  // after the other. This lets us process long observations in windows of
+  // bounded size.
+  void GetChannels(float * const data, const size_t if_idx,
+      const size_t first_channel_idx, const size_t num_channels,
+      const size_t first_sample, const size_t num_samples,
+      const bool print_progress = false) const {
     if (print_progress)
-      DoGetChannels<true>(data, if_idx, first_channel_idx, num_channels);
+      DoGetChannels<true>(data, if_idx, 1, first_channel_idx, num_channels,
+          first_sample, num_samples);
     else
-      DoGetChannels<false>(data, if_idx, first_channel_idx, num_channels);
+      DoGetChannels<false>(data, if_idx, 1, first_channel_idx, num_channels,
+          first_sample, num_samples);
+  }
+
+  // Read the window of the given channels of every IF in a single pass over
+  // the file, data holds the channels of the first IF, then those of the
+  // second IF and so on. For a time-major file, this reads the data once
+  // instead of once per IF.
+  void GetChannelsAllIFs(float * const data, const size_t first_channel_idx,
+      const size_t num_channels, const size_t first_sample,
+      const size_t num_samples, const bool print_progress = false) const {
+    if (print_progress)
+      DoGetChannels<true>(data, 0, (size_t)mHeader.nifs, first_channel_idx,
+          num_channels, first_sample, num_samples);
+    else
+      DoGetChannels<false>(data, 0, (size_t)mHeader.nifs, first_channel_idx,
+          num_channels, first_sample, num_samples);
   }
 
   void GetChannels(float * const data, const size_t first_channel_idx,
@@ -88,10 +159,36 @@ public:
   void SetChannels(const size_t if_idx, const size_t first_channel_idx,
       const float * const data, const size_t num_channels,
       const bool print_progress = false) {
+    SetChannels(if_idx, first_channel_idx, 0, data, num_channels,
+        (size_t)mHeader.nsamples, print_progress);
+  }
+
+  // write the time window [first_sample, first_sample + num_samples) of the
+  // given channels, data is laid out like for the windowed GetChannels
+  void SetChannels(const size_t if_idx, const size_t first_channel_idx,
+      const size_t first_sample, const float * const data,
+      const size_t num_channels, const size_t num_samples,
+      const bool print_progress = false) {
     if (print_progress)
-      DoSetChannels<true>(if_idx, first_channel_idx, data, num_channels);
+      DoSetChannels<true>(if_idx, 1, first_channel_idx, first_sample, data,
+          num_channels, num_samples);
     else
-      DoSetChannels<false>(if_idx, first_channel_idx, data, num_channels);
+      DoSetChannels<false>(if_idx, 1, first_channel_idx, first_sample, data,
+          num_channels, num_samples);
+  }
+
+  // write the window of the given channels of every IF in a single pass, data
+  // is laid out like for GetChannelsAllIFs
+  void SetChannelsAllIFs(const size_t first_channel_idx,
+      const size_t first_sample, const float * const data,
+      const size_t num_channels, const size_t num_samples,
+      const bool print_progress = false) {
+    if (print_progress)
+      DoSetChannels<true>(0, (size_t)mHeader.nifs, first_channel_idx,
+          first_sample, data, num_channels, num_samples);
+    else
+      DoSetChannels<false>(0, (size_t)mHeader.nifs, first_channel_idx,
+          first_sample, data, num_channels, num_samples);
   }
 
   void SetChannels(const size_t first_channel_idx, const float * const data,
@@ -145,12 +242,75 @@ public:
     return data;
   }
 
+  // Read num_samples consecutive spectra (all IFs and channels) starting at
+  // first_sample into data, regardless of how the file is laid out
+  void GetSpectra(float * const data, const size_t first_sample,
+      const size_t num_samples) const;
+
+  // Write num_samples consecutive spectra starting at first_sample
+  void SetSpectra(const size_t first_sample, const float * const data,
+      const size_t num_samples);
+
+  // Read up to max_samples of the spectra that follow the ones read last from
+  // a time-major stream, returns how many were read, which is less than
+  // max_samples only at the end of the stream
+  size_t GetNextSpectra(float * const data, const size_t max_samples) const;
+
+  // Write len bytes at offset off of the file right away (through an aligned
+  // bounce buffer with direct I/O), a stream has to be written in order
+  void WriteBytes(const void * const buf, const size_t len, const off64_t off);
+
   int FD() const {
     return mFD;
   }
 
+  bool IsMapped() const {
+    return mpMap != nullptr;
+  }
+
+  // Read and write the data with direct I/O, bypassing the page cache. Only
+  // the unaligned bytes at the ends of each block (and the header) go through
+  // the page cache. Throws if the file system doesn't support direct I/O.
+  void SetDirectIO(const bool direct);
+
+  bool DirectIO() const {
+    return mDirectFD >= 0;
+  }
+
+  // file descriptor of the file opened with O_DIRECT (-1 if not enabled)
+  int DirectFD() const {
+    return mDirectFD;
+  }
+
+  // read-only view of the data region (in the layout of the file) if the file
+  // is memory mapped and contains 32-bit floats, nullptr otherwise
+  const float * MappedData() const {
+    if ((mpMap == nullptr) || (mHeader.nbits != 32))
+      return nullptr;
+
+    return (const float*)(mpMap + mHeaderSize);
+  }
+
   void SetData(const float * const data);
 
+  // Quantization of the data written to 8 and 16-bit files: a value v is
+  // stored as round(v * scale + offset), clamped to the range of the integer
+  // type. The default is scale = 1 and offset = 0, so that the integers read
+  // from a file are written back unchanged.
+  void SetQuantization(const float scale, const float offset);
+
+  void SetChannelQuantization(const size_t if_idx, const size_t channel_idx,
+      const float scale, const float offset);
+
+  void SetChannelQuantization(const size_t channel_idx, const float scale,
+      const float offset) {
+    SetChannelQuantization(0, channel_idx, scale, offset);
+  }
+
+  // the quantization of a channel (scale 1 and offset 0 for 32-bit files)
+  void GetChannelQuantization(const size_t if_idx, const size_t channel_idx,
+      float * const scale, float * const offset) const;
+
   void SetData(const std::vector<float>& data) {
     size_t num_elements = (size_t)mHeader.nifs * (size_t)mHeader.nchans
         * (size_t)mHeader.nsamples;
@@ -161,25 +321,119 @@ public:
   }
 
 private:
+  // Read num_values consecutive values of the data region (in the layout of
+  // the file) starting at value first_value and convert them to floats. raw is
+  // used as scratch space for packed data.
+  void ReadValues(float * const data, const size_t first_value,
+      const size_t num_values, std::vector<unsigned char> * const raw) const;
+
+  // quantize num_values values that go to value first_value of the data region
+  // into out
+  void QuantizeValues(const size_t first_value, const float * const data,
+      const size_t num_values, unsigned char * const out) const;
+
+  // write num_values consecutive values starting at value first_value,
+  // quantizing them if necessary, raw is used as scratch space
+  void WriteValues(const size_t first_value, const float * const data,
+      const size_t num_values, std::vector<unsigned char> * const raw);
+
+  // Queue the read or write of len bytes at offset off of the file. With
+  // direct I/O, buf must be placed DirectOffset(off) bytes past an aligned
+  // address.
+  void QueueRead(char * const buf, const size_t len, const off64_t off) const {
+    if (mDirectFD >= 0)
+      IO().ReadDirect(mFD, mDirectFD, buf, len, off);
+    else
+      IO().Read(mFD, buf, len, off);
+  }
+
+  void QueueWrite(const char * const buf, const size_t len,
+      const off64_t off) const {
+    if (mDirectFD >= 0)
+      IO().WriteDirect(mFD, mDirectFD, buf, len, off);
+    else
+      IO().Write(mFD, buf, len, off);
+  }
+
+  size_t DirectOffset(const off64_t off) const {
+    return mDirectFD >= 0 ? AsyncIO::DirectOffset(off) : 0;
+  }
+
+  // read len bytes at offset off right away (through an aligned bounce buffer
+  // with direct I/O)
+  void ReadBytes(void * const buf, const size_t len, const off64_t off) const;
+
+  // Read len bytes of a stream, which must be at offset off. If partial, the
+  // stream may end before, returns the number of bytes read.
+  size_t ReadStream(void * const buf, const size_t len, const off64_t off,
+      const bool partial) const;
+
+  // write len bytes to a stream, which must be at offset off
+  void WriteStream(const void * const buf, const size_t len,
+      const off64_t off);
+
+  // asynchronous I/O on mFD, created on first use (which may happen in
+  // several threads at once through the const methods)
+  AsyncIO& IO() const {
+    std::call_once(mIOCreated, [this] { mpIO = AsyncIO::Create(); });
+    return *mpIO;
+  }
+
+  // read or write the channels of the IFs [first_if_idx, first_if_idx +
+  // num_ifs), the channels of each IF follow those of the previous one in data
   template<bool PRINT>
-  void DoGetChannels(float * const data, const size_t if_idx,
-      const size_t first_channel_idx, const size_t num_channels) const;
+  void DoGetChannels(float * const data, const size_t first_if_idx,
+      const size_t num_ifs, const size_t first_channel_idx,
+      const size_t num_channels, const size_t first_sample,
+      const size_t num_samples) const;
 
   template<bool PRINT>
-  void DoSetChannels(const size_t if_idx, const size_t first_channel_idx,
-      const float * const data, const size_t num_channels);
+  void DoSetChannels(const size_t first_if_idx, const size_t num_ifs,
+      const size_t first_channel_idx, const size_t first_sample,
+      const float * const data, const size_t num_channels,
+      const size_t num_samples);
 
   SigProc(const SigProcHeader header, const int fd) :
     mHeader(header),
     mHeaderSize(0),
     mFD(fd),
-    mReadOnly(true) {}
+    mReadOnly(true),
+    mpMap(nullptr),
+    mMapSize(0),
+    mDirectFD(-1),
+    mSequential(false),
+    mStreamOffset(0),
+    mpIO(nullptr) {}
 
   SigProcHeader mHeader;
   size_t mHeaderSize;
 
   int mFD; // file descriptor for I/O
   bool mReadOnly;
+
+  char * mpMap; // memory mapped file (nullptr if not mapped)
+  size_t mMapSize;
+
+  int mDirectFD; // file opened with O_DIRECT (-1 if direct I/O is off)
+
+  // mFD is a stream, which is read or written in order with read and write
+  bool mSequential;
+
+  // offset in the file of the next byte of the stream
+  mutable off64_t mStreamOffset;
+
+  // the start of the data of an input stream, which was read with the header
+  mutable std::vector<char> mReadAhead;
+
+  mutable std::unique_ptr<AsyncIO> mpIO;
+  mutable std::once_flag mIOCreated;
+
+  // starts the writeback of what we write (nullptr for read-only files)
+  std::unique_ptr<Writeback> mpWriteback;
+
+  // quantization of each channel of each IF (only used for 8 and 16-bit files)
+  std::vector<float> mScales;
+  std::vector<float> mOffsets;
 };
 
 #endif // SIGPROC_HPP_
@@ -7,6 +7,7 @@
 
 #include "SigProcHeader.hpp"
 
+#include <climits>
 #include <cstring>
 #include <sstream>
 #include <stdexcept>
@@ -44,111 +45,148 @@ void write_string(std::ostream& stm, const std::string str, const bool pad) {
   stm.write(buf, out_len * sizeof(char));
 }
 
-template<typename T>
-T read_header(const int fd) {
-  T val;
-  if ((size_t)read(fd, &val, sizeof(T)) != sizeof(T)) {
-    perror("Failure in read");
-    throw std::runtime_error("Failed to read value");
+// thrown by BufferSource if the header doesn't end within the buffer
+struct Incomplete {};
+
+// reads the header from memory
+class BufferSource {
+public:
+  BufferSource(const char * const buf, const size_t len) :
+      mBuf(buf),
+      mLen(len),
+      mPos(0) {}
+
+  void Get(void * const dst, const size_t len) {
+    if (mPos + len > mLen)
+      throw Incomplete();
+
+    memcpy(dst, mBuf + mPos, len);
+    mPos += len;
+  }
+
+  size_t Pos() const {
+    return mPos;
+  }
+
+private:
+  const char * mBuf;
+  size_t mLen, mPos;
+};
+
+// reads the header from a stream, leaving the stream at the start of the data
+class StreamSource {
+public:
+  StreamSource(std::istream& stm) :
+      mStm(stm),
+      mPos(0) {}
+
+  void Get(void * const dst, const size_t len) {
+    if (!mStm.read((char*)dst, len))
+      throw std::runtime_error("Failed to read header from stream");
+
+    mPos += len;
+  }
+
+  size_t Pos() const {
+    return mPos;
   }
+
+private:
+  std::istream& mStm;
+  size_t mPos;
+};
+
+template<typename T, typename SOURCE>
+T read_header(SOURCE& src) {
+  T val;
+  src.Get(&val, sizeof(T));
   return val;
 }
 
-std::string read_string(const int fd) {
-  int len = read_header<int>(fd);
+template<typename SOURCE>
+std::string read_string(SOURCE& src) {
+  int len = read_header<int>(src);
   char buf[80];
 
   if ((len <= 0) || (len >= 80))
     throw std::runtime_error("Got string of invalid length in read_string "
         "(len = " + std::to_string(len) + ")");
 
-  if ((size_t)read(fd, buf, len * sizeof(char)) != len * sizeof(char)) {
-    perror("Failure in read_string");
-    throw std::runtime_error("Failed to read string");
-  }
+  src.Get(buf, len * sizeof(char));
 
   buf[len] = '\0';
   return std::string(buf);
 }
 
-template<typename T>
-void write_header(std::ostream& stm, const std::string name, const T val) {
-  write_string(stm, name, false);
-  stm.write((char*)&val, sizeof(T));
-}
-
-} // namespace [unnamed]
-
-SigProcHeader SigProcHeader::Read(const int fd) {
+// parse the header from the beginning of src, Input_size is set to the size of
+// the header
+template<typename SOURCE>
+SigProcHeader parse(SOURCE& src) {
   SigProcHeader header;
 
-  // rewind
-  if (lseek64(fd, 0, SEEK_SET) != 0) {
-    perror("Failure in SigProcHeader::Read");
-    throw std::runtime_error("Failed to seek");
-  }
-
-  std::string s = read_string(fd);
+  std::string s = read_string(src);
   if (s != "HEADER_START")
     throw std::invalid_argument("Not valid sigproc header");
 
   while (true) {
-    s = read_string(fd);
+    s = read_string(src);
 
     if (s == "HEADER_END")
       break;
     else if (s == "source_name")
-      header.source_name = read_string(fd);
+      header.source_name = read_string(src);
     else if (s == "rawdatafile")
-      header.rawdatafile = read_string(fd);
+      header.rawdatafile = read_string(src);
     else if (s == "az_start")
-      header.az_start = read_header<double>(fd);
+      header.az_start = read_header<double>(src);
     else if (s == "za_start")
-      header.za_start = read_header<double>(fd);
+      header.za_start = read_header<double>(src);
     else if (s == "src_raj")
-      header.src_raj = read_header<double>(fd);
+      header.src_raj = read_header<double>(src);
     else if (s == "src_dej")
-      header.src_dej = read_header<double>(fd);
+      header.src_dej = read_header<double>(src);
     else if (s == "tstart")
-      header.tstart = read_header<double>(fd);
+      header.tstart = read_header<double>(src);
     else if (s == "tsamp")
-      header.tsamp = read_header<double>(fd);
+      header.tsamp = read_header<double>(src);
     else if (s == "period")
-      /*header.period =*/ read_header<double>(fd);
+      /*header.period =*/ read_header<double>(src);
     else if (s == "fch1")
-      header.fch1 = read_header<double>(fd);
+      header.fch1 = read_header<double>(src);
     else if (s == "foff")
-      header.foff = read_header<double>(fd);
+      header.foff = read_header<double>(src);
     else if (s == "nchans")
-      header.nchans = read_header<int>(fd);
+      header.nchans = read_header<int>(src);
     else if (s == "telescope_id")
-      header.telescope_id = read_header<int>(fd);
+      header.telescope_id = read_header<int>(src);
     else if (s == "machine_id")
-      header.machine_id = read_header<int>(fd);
+      header.machine_id = read_header<int>(src);
     else if (s == "data_type")
-      header.data_type = read_header<int>(fd);
+      header.data_type = read_header<int>(src);
     else if (s == "ibeam")
-      header.ibeam = read_header<int>(fd);
+      header.ibeam = read_header<int>(src);
     else if (s == "nbeams")
-      header.nbeams = read_header<int>(fd);
+      header.nbeams = read_header<int>(src);
     else if (s == "nbits")
-      header.nbits = read_header<int>(fd);
+      header.nbits = read_header<int>(src);
     else if (s == "barycentric")
-      header.barycentric = read_header<int>(fd);
+      header.barycentric = read_header<int>(src);
     else if (s == "pulsarcentric")
-      header.pulsarcentric = read_header<int>(fd);
+      header.pulsarcentric = read_header<int>(src);
     else if (s == "nbins")
-      /*header.nbins =*/ read_header<int>(fd);
+      /*header.nbins =*/ read_header<int>(src);
     else if (s == "nsamples")
-      header.nsamples = read_header<int>(fd);
+      header.nsamples = read_header<int>(src);
     else if (s == "nifs")
-      header.nifs = read_header<int>(fd);
+      header.nifs = read_header<int>(src);
+    else if (s == "channel_major")
+      header.channel_major = read_header<int>(src);
     else if (s == "npuls")
-      /*header.npuls =*/ read_header<long int>(fd);
+      /*header.npuls =*/ read_header<long int>(src);
     else if (s == "refdm")
-      /*header.refdm =*/ read_header<double>(fd);
+      /*header.refdm =*/ read_header<double>(src);
     else if (s == "signed")
-      /*header.signed_data =*/ read_header<unsigned char>(fd);
+      /*header.signed_data =*/ read_header<unsigned char>(src);
     else if ((s == "FREQUENCY_START") || (s == "FREQUENCY_END")
         || (s == "fchannel"))
       throw std::runtime_error("Frequency tables are not implemented");
@@ -166,15 +204,90 @@ SigProcHeader SigProcHeader::Read(const int fd) {
   if (header.nsamples == 0)
     header.nsamples = -1; // to be determined by file size
 
-  off64_t size = lseek64(fd, 0, SEEK_CUR);
-  if (errno != 0) {
-    perror("Failure in SigProcHeader::Read");
-    throw std::runtime_error("Failed to seek end of header");
+  header.Input_size = src.Pos();
+
+  return header;
+}
+
+// a header is usually about 500 bytes, so this is enough to read it at once
+const size_t InitialHeaderRead = 16 * 1024; // 16 kB
+
+template<typename T>
+void write_header(std::ostream& stm, const std::string name, const T val) {
+  write_string(stm, name, false);
+  stm.write((char*)&val, sizeof(T));
+}
+
+} // namespace [unnamed]
+
+SigProcHeader SigProcHeader::Read(const int fd) {
+  std::vector<char> buf(InitialHeaderRead);
+
+  while (true) {
+    // read from the beginning of the file regardless of the file position
+    size_t len = 0;
+    while (len < buf.size()) {
+      ssize_t n = pread64(fd, buf.data() + len, buf.size() - len, len);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+
+        perror("Failure in SigProcHeader::Read");
+        throw std::runtime_error("Failed to read header");
+      }
+
+      if (n == 0)
+        break;
+
+      len += n;
+    }
+
+    try {
+      BufferSource src(buf.data(), len);
+      return parse(src);
+    } catch (Incomplete&) {
+      if (len < buf.size())
+        throw std::runtime_error("File ends before the end of the header");
+
+      // a very long header, try again with more
+      buf.resize(2 * buf.size());
+    }
   }
+}
 
-  header.Input_size= size;
+SigProcHeader SigProcHeader::ReadSequential(const int fd,
+    std::vector<char> * const buffer) {
+  buffer->clear();
 
-  return header;
+  while (true) {
+    size_t len = buffer->size();
+    buffer->resize(len + InitialHeaderRead);
+
+    ssize_t n = read(fd, buffer->data() + len, InitialHeaderRead);
+    if (n < 0) {
+      buffer->resize(len);
+      if (errno == EINTR)
+        continue;
+
+      perror("Failure in SigProcHeader::ReadSequential");
+      throw std::runtime_error("Failed to read header");
+    }
+
+    buffer->resize(len + n);
+
+    try {
+      BufferSource src(buffer->data(), buffer->size());
+      return parse(src);
+    } catch (Incomplete&) {
+      if (n == 0)
+        throw std::runtime_error("Stream ends before the end of the header");
+    }
+  }
+}
+
+SigProcHeader SigProcHeader::ReadStream(std::istream& stm) {
+  StreamSource src(stm);
+  return parse(src);
 }
 
 void SigProcHeader::Write(const int fd) const {
@@ -217,8 +330,12 @@ void SigProcHeader::WriteStream(std::ostream& stm) const {
   write_header(stm, "barycentric", barycentric);
   write_header(stm, "pulsarcentric", pulsarcentric);
 //  write_header(fd, "nbins", nbins);
-  write_header(stm, "nsamples", nsamples);
+  // 0 says the number of samples is unknown
+  write_header(stm, "nsamples",
+      ((nsamples < 0) || (nsamples > INT_MAX)) ? 0 : (int)nsamples);
   write_header(stm, "nifs", nifs);
+  if (channel_major != 0)
+    write_header(stm, "channel_major", channel_major);
 //  write_header(fd, "npuls", npuls);
 //  write_header(fd, "refdm", refdm);
 //  write_header(fd, "signed", signed_data);
@@ -255,6 +372,7 @@ bool SigProcHeader::operator==(const SigProcHeader& other) const {
 //  if (nbins != other.nbins) return false;
   if (nsamples != other.nsamples) return false;
   if (nifs != other.nifs) return false;
+  if (channel_major != other.channel_major) return false;
 //  if (npuls != other.npuls) return false;
 //  if (refdm != other.refdm) return false;
 //  if (signed_data != other.signed_data) return false;
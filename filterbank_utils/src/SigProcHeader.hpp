@@ -8,6 +8,7 @@
 #ifndef SIGPROCHEADER_HPP_
 #define SIGPROCHEADER_HPP_
 
+#include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <list>
@@ -39,8 +40,14 @@ struct SigProcHeader {
   int    barycentric;
   int    pulsarcentric;
 //  int    nbins;
-  int    nsamples;
+  // the header field is only 32 bits wide, longer observations are written
+  // with nsamples = 0 (i.e. determined by the file size)
+  int64_t nsamples;
   int    nifs;
+  // not a standard sigproc field: if set, the data is stored channel by
+  // channel (all samples of channel 0 of IF 0, then channel 1, etc.) instead
+  // of spectrum by spectrum, only written to the header if set
+  int    channel_major;
 //  long int npuls;
 //  double refdm;
 //  unsigned char signed_data;
@@ -71,16 +78,26 @@ struct SigProcHeader {
 //    nbins(0),
     nsamples(0),
     nifs(0),
+    channel_major(0),
 //    npuls(0),
 //    refdm(0.0),
 //    signed_data(0),
     Input_size(0) {}
 
+  // Read the header at the beginning of the file with a single read into
+  // memory, the file position is not used
   static SigProcHeader Read(const int fd);
 
+  // Read the header from a file that can only be read front to back, like a
+  // pipe. This reads in chunks, so buffer receives all bytes that were read,
+  // the header (Input_size bytes) and possibly the beginning of the data.
+  static SigProcHeader ReadSequential(const int fd,
+      std::vector<char> * const buffer);
+
   void Write(const int fd) const;
 
-  static SigProcHeader ReadStream(const std::istream& stm);
+  // read exactly the header, the stream is left at the beginning of the data
+  static SigProcHeader ReadStream(std::istream& stm);
 
   void WriteStream(std::ostream& stm) const;
 
@@ -88,8 +105,9 @@ struct SigProcHeader {
     if (nsamples == -1)
       return 0;
 
-    return (size_t)nifs * (size_t)nchans * (size_t)nsamples
-        * (size_t)(nbits / 8);
+    // data with fewer than 8 bits is packed into bytes
+    return ((size_t)nifs * (size_t)nchans * (size_t)nsamples * (size_t)nbits
+        + 7) / 8;
   }
 
   size_t Get_output_size() const;
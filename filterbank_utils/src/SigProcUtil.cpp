@@ -8,18 +8,29 @@
 #include "SigProcUtil.hpp"
 
 #include <algorithm>
+#include <cstdarg>
 #include <cstring>
 #include <cmath>
+#include <mutex>
 #include <set>
 
 #ifndef _LARGEFILE64_SOURCE
   #define _LARGEFILE64_SOURCE 1
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
-#include "Barycenter.hpp"
-#include "BaselineRemover.hpp"
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#include "AsyncIO.hpp"
+#include "Pipeline.hpp"
+#include "ProcessingStage.hpp"
+#include "RedoJournal.hpp"
+#include "Smoothing.hpp"
+#include "SpectrumReader.hpp"
 #include "utils.hpp"
 
 void SigProcUtil::Meminfo(size_t * const total_kB,
@@ -99,6 +110,10 @@ void SigProcUtil::Meminfo(size_t * const total_kB,
   *available_kB = avail;
 }
 
+constexpr double SigProcUtil::AutoScaleNumSigma;
+constexpr size_t SigProcUtil::NumBatchesInFlight;
+constexpr int SigProcUtil::BandpassSavitzkyGolayOrder;
+
 namespace {
 
 void seek(const int fd, off64_t off) {
@@ -122,10 +137,150 @@ void write_data(const int fd, const void * const buf, const size_t len) {
   }
 }
 
+// We write into a temporary file and rename it once it is complete, unless the
+// output is a pipe, which receives the data as it is written.
+std::string in_progress_name(const std::string& output) {
+  return SigProc::IsStream(output) ? output : output + ".in_progress";
+}
+
+void finish_output(const std::string& output) {
+  std::string src = in_progress_name(output);
+  if (src == output)
+    return;
+
+  if (rename(src.c_str(), output.c_str()) != 0)
+    throw std::runtime_error(
+        "Failed to rename file '" + src + "' to '" + output + "'");
+}
+
+// sum[c] += values[c] for the num channels c that are not zapped, the zapped
+// channels are given by a row of the bitmap of an RFIMask. We go through the
+// bitmap word by word, so that the channels of words without zapped channels
+// are accumulated in a loop the compiler can vectorize.
+void masked_accumulate(const float * const values,
+    const uint64_t * const zapped, const size_t num, double * const sum) {
+  const size_t bits = RFIMask::BitsPerWord;
+
+  for (size_t first = 0; first < num; first += bits) {
+    const uint64_t word = zapped[first / bits];
+    const size_t n = std::min(bits, num - first);
+
+    const float * const v = values + first;
+    double * const s = sum + first;
+
+    if (word == 0) {
+      for (size_t j = 0; j < n; ++j)
+        s[j] += v[j];
+    } else if (word != ~(uint64_t)0) {
+      for (size_t j = 0; j < n; ++j)
+        s[j] += ((word >> j) & 1) ? 0.0 : (double)v[j];
+    }
+  }
+}
+
+// Run the stages [first, end) on the data of block, which starts out in in.
+// The stages work in place, except for the ones that decimate in time or
+// frequency, which write into whichever of buf and buf_dec doesn't hold their
+// input. If in is neither of them, it is copied into buf before the first stage
+// that works in place. So buf has to hold the input and buf_dec the output of
+// the first stage that decimates. Returns the result, which block then
+// describes.
+const float * run_stages(const ProcessingStages& stages, const size_t first,
+    const size_t end, StageBlock * const block, const float * const in,
+    float * const buf, float * const buf_dec) {
+  const float * result = in;
+  float * data = (in == buf) ? buf : nullptr;
+
+  for (size_t s = first; s < end; ++s) {
+    ProcessingStage& stage = *stages[s];
+    const size_t decimation = stage.Decimation();
+    const size_t channel_decimation = stage.ChannelDecimation();
+
+    if ((decimation > 1) || (channel_decimation > 1)) {
+      float * const dst = (data == buf) ? buf_dec : buf;
+      stage.Process(*block, result, dst);
+      result = data = dst;
+
+      block->first_sample /= decimation;
+      block->num_samples /= decimation;
+      block->sample_factor *= decimation;
+
+      block->nchans /= channel_decimation;
+      block->first_channel /= channel_decimation;
+      block->num_channels /= channel_decimation;
+    } else {
+      if (data == nullptr) {
+        memcpy(buf, in, block->NumRows() * block->num_samples * sizeof(float));
+        result = data = buf;
+      }
+      stage.Process(*block, data, data);
+    }
+  }
+
+  return result;
+}
+
+// Write unit k (a block of spectra or a batch of channels) with write(k,
+// data). In place, the data (len bytes) and the extra bytes go to the journal
+// first, and the file is flushed before the unit is logged as done.
+template<typename WRITE>
+void write_unit(RedoJournal * const journal, SigProc * const out,
+    const size_t k, const float * const data, const size_t len,
+    const std::vector<char>& extra, WRITE write) {
+  if (journal == nullptr) {
+    write(k, data);
+    return;
+  }
+
+  journal->BeginWrite(k, data, len, extra);
+  write(k, data);
+  out->HardFlush();
+  journal->EndWrite(k, extra);
+}
+
+// In place, write the unit whose write was interrupted by the previous run
+// again from the journal, after restore(k, extra)
+template<typename WRITE, typename RESTORE>
+void replay_interrupted_unit(RedoJournal * const journal, SigProc * const out,
+    WRITE write, RESTORE restore) {
+  size_t k;
+  std::vector<char> data, extra;
+  if ((journal == nullptr) || !journal->Interrupted(&k, &data, &extra))
+    return;
+
+  restore(k, extra);
+  write(k, (const float*)data.data());
+  out->HardFlush();
+  journal->EndWrite(k, extra);
+}
+
+// The scratch files of a run, the ones that are left when it goes out of scope
+// are removed, so that they don't pile up if we fail halfway
+struct ScratchFiles {
+  std::vector<std::string> names;
+
+  ~ScratchFiles() {
+    for (auto& name : names)
+      Remove(&name);
+  }
+
+  // remove a scratch file we don't need anymore to free the disk space
+  static void Remove(std::string * const name) {
+    if ((*name != "") && (unlink(name->c_str()) != 0))
+      fprintf(stderr, "WARNING: Failed to remove scratch file '%s'\n",
+          name->c_str());
+    name->clear();
+  }
+};
+
 } // namespace [unnamed]
 
 void SigProcUtil::ModifyHeader(const std::string& input_file,
     const std::string& output_file, const SigProcHeader newHeader) const {
+  // we copy the data with seeks and reads of our own
+  if (SigProc::IsStream(input_file) || SigProc::IsStream(output_file))
+    throw std::invalid_argument("Cannot modify the header of a stream");
+
   SigProc in_file(input_file);
 
   if (in_file.Header().Data_size() != newHeader.Data_size())
@@ -141,8 +296,7 @@ void SigProcUtil::ModifyHeader(const std::string& input_file,
     seek(fd, 0);
     newHeader.Write(fd);
   } else {
-    std::string temp_out = output_file + ".in_progress";
-    SigProc out_file(temp_out, newHeader);
+    SigProc out_file(in_progress_name(output_file), newHeader);
 
     int in_fd = in_file.FD();
     seek(in_fd, in_file.HeaderSize());
@@ -155,16 +309,14 @@ void SigProcUtil::ModifyHeader(const std::string& input_file,
 
     size_t num_chunks = newHeader.Data_size() / bufsize;
 
-    printf("\33[2K\rCopying data... %3i%%", 0);
-    fflush(stdout);
+    Progress("\33[2K\rCopying data... %3i%%", 0);
 
     for (size_t i = 0; i < num_chunks; ++i) {
       read_data(in_fd, buf, bufsize);
       write_data(out_fd, buf, bufsize);
 
-      printf("\33[2K\rCopying data... %3i%%",
+      Progress("\33[2K\rCopying data... %3i%%",
           (int)(100.0 * (double)(i + 1) / (double)num_chunks));
-      fflush(stdout);
     }
 
     // and leftover part
@@ -174,13 +326,64 @@ void SigProcUtil::ModifyHeader(const std::string& input_file,
       write_data(out_fd, buf, leftover);
     }
 
-    printf("\33[2K\rCopying data... done\n");
+    Progress("\33[2K\rCopying data... done\n");
     free(buf);
 
-    if (rename(temp_out.c_str(), output_file.c_str()) != 0)
-      throw std::runtime_error(
-          "Failed to rename file '" + temp_out + "' to '" + output_file + "'");
+    finish_output(output_file);
+  }
+}
+
+void SigProcUtil::ConvertLayout(const SigProc& input,
+    const std::string& output, const bool channel_major) const {
+  // the layout of a channel-major file depends on the number of spectra
+  if (input.Header().nsamples < 0)
+    throw std::invalid_argument("Cannot convert the layout of a stream that "
+        "doesn't say how many spectra it has");
+
+  auto header = input.Header();
+  header.channel_major = channel_major ? 1 : 0;
+  // packed input is unpacked to floats
+  header.nbits = 32;
+
+  const size_t spectrum_size = (size_t)header.nifs * (size_t)header.nchans;
+  const size_t nsamples = std::max(header.nsamples, (int64_t)0);
+
+  // the longer the blocks, the longer the contiguous reads or writes of each
+  // channel on the channel-major side, leave room for the block that is read
+  // ahead and the transposition
+  size_t block_len = BufferSize() / (3 * spectrum_size * sizeof(float));
+  block_len = std::min(std::max(block_len, (size_t)1), nsamples);
+
+  {
+    SigProc out(in_progress_name(output), header);
+    out.SetDirectIO(mDirectIO);
+    SpectrumReader reader(input, block_len);
+
+    const char * layout = channel_major ? "channel" : "time";
+    Progress("\33[2K\rConverting to %s-major layout... %3i%%", layout, 0);
+
+    while (reader.Next()) {
+      out.SetSpectra(reader.FirstSample(), reader.Data(), reader.NumSamples());
+
+      Progress("\33[2K\rConverting to %s-major layout... %3i%%", layout,
+          (int)(100.0 * reader.Progress()));
+    }
+
+    Progress("\33[2K\rConverting to %s-major layout... done\n", layout);
   }
+
+  finish_output(output);
+}
+
+void SigProcUtil::Progress(const char * const format, ...) const {
+  if (!mShowProgress)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fflush(stderr);
 }
 
 size_t SigProcUtil::BufferSize() const {
@@ -200,16 +403,26 @@ size_t SigProcUtil::BufferSize() const {
 }
 
 void SigProcUtil::GetBatches(const size_t samples_per_channel,
-    const size_t num_channels, size_t * const batch_size,
+    const size_t num_channels, const size_t num_in_flight,
+    const size_t channel_multiple, size_t * const batch_size,
     size_t * const num_concurrent_batches) const {
-  size_t buffer_size = BufferSize();
+  size_t buffer_size = BufferSize() / num_in_flight;
 
-  *batch_size = buffer_size / (sizeof(float) * samples_per_channel);
-  *batch_size = std::min(*batch_size, num_channels);
+  // the batches are made of groups of channel_multiple channels
+  const size_t num_groups = num_channels / channel_multiple;
+  size_t groups_per_batch = buffer_size
+      / (sizeof(float) * samples_per_channel * channel_multiple);
+  groups_per_batch = std::min(groups_per_batch, num_groups);
+
+  if (groups_per_batch == 0) {
+    *batch_size = 0;
+    *num_concurrent_batches = 0;
+    return;
+  }
 
   // balance the batches
-  size_t num_batches = (num_channels + *batch_size - 1) / *batch_size;
-  *batch_size = num_channels / num_batches;
+  size_t num_batches = (num_groups + groups_per_batch - 1) / groups_per_batch;
+  *batch_size = num_groups / num_batches * channel_multiple;
 
   size_t batch_data_size = *batch_size * (sizeof(float) * samples_per_channel);
 //  printf("batch_data_size = %lu\n", batch_data_size / 1024l / 1024l);
@@ -217,434 +430,1222 @@ void SigProcUtil::GetBatches(const size_t samples_per_channel,
   *num_concurrent_batches = buffer_size / batch_data_size;
 }
 
-template<bool do_avg, bool do_bp, bool do_base, bool do_bary>
-void SigProcUtil::DoProcess(const SigProc& input, const std::string& output,
-    const int num_samples_to_average,
-    const int num_samples_to_estimate_bandpass,
-    const double bandpass_smoothing_parameter,
-    const double baseline_length_in_sec,
-    const std::string observatoryCodeForBarycentering) const {
-  if (num_samples_to_average <= 0)
-    throw std::invalid_argument("Cannot average a non-positive number "
-        "of samples");
+void SigProcUtil::ScatterBatches(const SigProc& input,
+    const std::string& output, const size_t batch_size,
+    const size_t num_batches, const ProcessingStages& stages,
+    const size_t num_stages, const int num_threads,
+    std::vector<std::string> * const names) const {
+  auto header = input.Header();
+  const size_t nifs = header.nifs;
+  const size_t nchans = header.nchans;
+  const size_t nsamples = std::max(header.nsamples, (int64_t)0);
+  const size_t spectrum_size = nifs * nchans;
+
+  // the first num_stages stages run on the spectra before they are scattered,
+  // so the scratch files contain their output
+  size_t decimation = 1;
+  size_t first_decimation = 1;
+  for (size_t s = 0; s < num_stages; ++s) {
+    if ((first_decimation == 1) && (stages[s]->Decimation() > 1))
+      first_decimation = stages[s]->Decimation();
+    decimation *= stages[s]->Decimation();
+  }
 
-  if (num_samples_to_estimate_bandpass < 0)
-    throw std::invalid_argument("Cannot estimate bandpass with negative "
-        "number of samples");
+  std::string prefix = output;
+  if (mScratchDir != "") {
+    size_t slash = output.find_last_of('/');
+    prefix = mScratchDir + "/"
+        + (slash == std::string::npos ? output : output.substr(slash + 1));
+  }
 
-  if (baseline_length_in_sec < 0.0)
-    throw std::invalid_argument("Cannot remove negative length baseline");
+  // create one scratch file per batch, each contains the channels of its batch
+  // of all IFs in the original time-major order
+  names->assign(num_batches, "");
+  std::vector<int> fds(num_batches), direct_fds;
+  std::vector<off64_t> offsets(num_batches);
+  std::vector<size_t> first(num_batches), num(num_batches);
+
+  for (size_t b = 0; b < num_batches; ++b) {
+    first[b] = b * batch_size;
+    num[b] = std::min(batch_size, nchans - first[b]);
+    const std::string name = prefix + ".scratch_" + std::to_string(b);
+
+    auto scratch_header = header;
+    for (size_t s = 0; s < num_stages; ++s)
+      stages[s]->UpdateHeader(&scratch_header);
+    scratch_header.nbits = 32;
+    scratch_header.nchans = num[b];
+    scratch_header.fch1 = header.fch1 + (double)first[b] * header.foff;
+    scratch_header.channel_major = 0;
+
+    fds[b] = open64(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+        S_IRUSR | S_IWUSR);
+    if (fds[b] == -1) {
+      perror("Failure in SigProcUtil::ScatterBatches");
+      throw std::runtime_error("Failed to create scratch file '" + name + "'");
+    }
+    (*names)[b] = name;
 
-  auto header = input.Header();
-  int in_n = header.nsamples;
-
-  if (do_avg != (num_samples_to_average > 1))
-    throw std::invalid_argument("do_avg and num_samples_to_average don't "
-        "agree");
-  if (do_bp != (num_samples_to_estimate_bandpass > 0))
-    throw std::invalid_argument("do_bp and num_samples_to_estimate_bandpass "
-        "don't agree");
-  if (do_base != (baseline_length_in_sec > 0.0))
-    throw std::invalid_argument("do_base and baseline_length_in_sec don't "
-        "agree");
-  if (do_bary != (observatoryCodeForBarycentering != ""))
-    throw std::invalid_argument("do_bary and observatoryCodeForBarycentering "
-        "don't agree");
-
-  int out_n = in_n / num_samples_to_average;
-
-  // set up for bandpass correction
-  std::vector<float> bp(header.nchans, 1.0);
-  size_t bp_samples = 0;
+    scratch_header.Write(fds[b]);
+    offsets[b] = scratch_header.Get_output_size();
+
+    if (mDirectIO)
+      direct_fds.push_back(AsyncIO::OpenDirect(fds[b], false));
+  }
+
+  // with direct I/O, the strip has to be placed at the offset it goes to
+  // relative to an aligned address
+  std::unique_ptr<AsyncIO> io;
+  if (mDirectIO)
+    io = AsyncIO::Create();
 
-  if (do_bp) {
-    if (num_samples_to_estimate_bandpass < 16384) {
-      printf("WARNING: Using small number of samples (%i) to estimate "
-          "bandpass\n", num_samples_to_estimate_bandpass);
+  auto append = [&](const size_t i, const char * const buf, const size_t len) {
+    if (mDirectIO) {
+      io->WriteDirect(fds[i], direct_fds[i], buf, len, offsets[i]);
+      io->Wait();
+    } else {
+      write_data(fds[i], buf, len);
     }
+    offsets[i] += len;
+  };
+
+  auto placement = [&](const size_t i) {
+    return mDirectIO ? AsyncIO::DirectOffset(offsets[i]) : 0;
+  };
+
+  // stream through the input once in blocks of spectra (a multiple of the
+  // decimation of the stages) and append each block's part of every batch to
+  // the corresponding scratch file
+  const size_t num_used = nsamples / decimation * decimation;
+  size_t block_len = std::max((size_t)1, (size_t)(32 * 1024 * 1024)
+      / (spectrum_size * sizeof(float) * decimation)) * decimation;
+  block_len = std::min(block_len, num_used);
+
+  SpectrumReader reader(input, block_len, SpectrumReader::AllIFs, 0, num_used);
+  AlignedBuffer strip(block_len / decimation * nifs * batch_size
+      * sizeof(float) + AsyncIO::DirectAlignment);
+
+  // buffers for the stages
+  std::vector<float> stage_buf(num_stages > 0 ? block_len * spectrum_size : 0);
+  std::vector<float> stage_buf_dec(decimation > 1
+      ? block_len / first_decimation * spectrum_size : 0);
+
+  Progress("\33[2K\rSplitting input into %lu scratch files... %3i%%",
+      num_batches, 0);
+
+  while ((num_used > 0) && reader.Next()) {
+    StageBlock block = { false, nifs, nchans, 0, nchans, reader.FirstSample(),
+        reader.NumSamples(), 1, num_threads };
+    const float * const spectra = run_stages(stages, 0, num_stages, &block,
+        reader.Data(), stage_buf.data(), stage_buf_dec.data());
+    const size_t len = block.num_samples;
 
-    if (header.nifs > 1)
-      throw std::runtime_error("Don't know how to correct bandpass with "
-          "multiple IFs");
+    for (size_t b = 0; b < num_batches; ++b) {
+      char * const dst = strip.Data() + placement(b);
 
-    bp_samples = std::min(num_samples_to_estimate_bandpass, in_n);
-  }
+      for (size_t t = 0; t < len; ++t) {
+        for (size_t if_idx = 0; if_idx < nifs; ++if_idx) {
+          memcpy(dst + (t * nifs + if_idx) * num[b] * sizeof(float),
+              spectra + t * spectrum_size + if_idx * nchans + first[b],
+              num[b] * sizeof(float));
+        }
+      }
 
-  size_t floats_per_channel = in_n;
+      append(b, dst, len * nifs * num[b] * sizeof(float));
+    }
 
-  // set up for averaging
-  if (do_avg) {
-    floats_per_channel += (size_t)out_n;
-    header.nsamples = out_n;
-    header.tsamp *= (double)num_samples_to_average;
+    Progress("\33[2K\rSplitting input into %lu scratch files... %3i%%",
+        num_batches, (int)(100.0 * reader.Progress()));
   }
 
-  // set up for baseline removal
-  std::unique_ptr<BaselineRemover> baseline_remover;
-  if (do_base) {
-    baseline_remover = std::unique_ptr<BaselineRemover>(
-        new BaselineRemover(out_n, header.nchans, header.tsamp,
-            baseline_length_in_sec, mUseGPU));
+  for (size_t i = 0; i < direct_fds.size(); ++i) {
+    if (close(direct_fds[i]) != 0) {
+      perror("Failure in SigProcUtil::ScatterBatches");
+      throw std::runtime_error("Failed to close scratch file '"
+          + (*names)[i] + "'");
+    }
+  }
 
-    floats_per_channel += baseline_remover->Ram_per_channel();
+  for (size_t i = 0; i < fds.size(); ++i) {
+    if (close(fds[i]) != 0) {
+      perror("Failure in SigProcUtil::ScatterBatches");
+      throw std::runtime_error("Failed to close scratch file '"
+          + (*names)[i] + "'");
+    }
   }
 
-  // set up for barycentering
-  std::unique_ptr<Barycenter> bary;
-  float * baryBuf = nullptr;
-  if (do_bary && (header.barycentric == 0)) {
-    bary = std::unique_ptr<Barycenter>(new Barycenter(header.tsamp,
-        header.tstart, out_n, header.src_raj, header.src_dej,
-        observatoryCodeForBarycentering));
-    baryBuf = (float*)malloc(out_n * sizeof(float));
+  Progress("\33[2K\rSplitting input into %lu scratch files... done\n",
+      num_batches);
+}
 
-    header.barycentric = 1;
-    header.tstart = bary->BaryStartMJD();
-  }
+std::vector<float> SigProcUtil::MeasureBandpass(const SigProc& input,
+    const std::string& output, const size_t bp_samples,
+    const double bandpass_smoothing_parameter,
+    std::set<size_t> * const kill_idxs) const {
+  const auto& header = input.Header();
 
-  size_t batch_size;
-  size_t num_concurrent_batches;
-  GetBatches(floats_per_channel, header.nchans, &batch_size,
-      &num_concurrent_batches);
+  Progress("Measuring bandpass... ");
 
-  size_t num_batches = ((size_t)header.nchans + batch_size - 1) / batch_size;
+  std::vector<float> bp(header.nchans, 1.0);
+  std::vector<double> sum(header.nchans, 0.0);
+  std::vector<size_t> num(header.nchans, 0);
 
-  if (batch_size <= 0)
-    throw std::runtime_error("Not enough memory");
+  // read raw data in time chunks of max 16 MB
+  size_t t_chunk = std::min((size_t)(4 * 1024 * 1024 / header.nchans),
+      bp_samples);
+  t_chunk = std::max(t_chunk, (size_t)1);
 
-  // use a different name for the incomplete file (which has the final
-  // size, though)
-  SigProc out(output + ".in_progress", header);
+  SpectrumReader reader(input, t_chunk, SpectrumReader::AllIFs, 0,
+      bp_samples);
 
-  // TODO add OpenMP
+  while (reader.Next()) {
+    const size_t first_t = reader.FirstSample();
+    const size_t len = reader.NumSamples();
+    const float * const spectra = reader.Data();
 
-  float * buf_in = (float*)malloc(batch_size * (size_t)in_n * sizeof(float));
+    if (mpMask == nullptr) {
+      for (size_t t = 0; t < len; ++t) {
+        for (size_t i = 0; i < (size_t)header.nchans; ++i) {
+          sum[i] += spectra[t * header.nchans + i];
+        }
+      }
+    } else {
+      // go through the block in runs of samples of the same mask interval
+      const size_t interval_size = mpMask->IntervalSize();
+      for (size_t t0 = 0; t0 < len;) {
+        const size_t interval = (first_t + t0) / interval_size;
+        const size_t t1 = std::min(len,
+            (interval + 1) * interval_size - first_t);
+        const uint64_t * const zapped = mpMask->ZappedChannelBits(interval);
+
+        for (size_t t = t0; t < t1; ++t)
+          masked_accumulate(spectra + t * header.nchans, zapped,
+              header.nchans, sum.data());
+
+        for (size_t i = 0; i < (size_t)header.nchans; ++i) {
+          if (!mpMask->IsZapped(interval, i))
+            num[i] += t1 - t0;
+        }
 
-  float * buf_out = buf_in;
-  if (do_avg)
-    buf_out = (float*)malloc(batch_size * (size_t)out_n * sizeof(float));
+        t0 = t1;
+      }
+    }
 
-  std::set<size_t> kill_idxs;
+    Progress("\33[2K\rMeasuring bandpass... %3i%%",
+        (int)(100.0 * reader.Progress()));
+  }
 
-  // add channel killed by mask
-  if (mpMask != nullptr)
-    kill_idxs.insert(mpMask->ZappedChannels().begin(),
-        mpMask->ZappedChannels().end());
+  Progress("\33[2K\rMeasuring bandpass... done\n");
+
+  // write out bandpass and get indices of channels that need to be zeroed out
+  std::string path = output + ".bandpass";
+  FILE * fout = fopen(path.c_str(), "w");
+  fprintf(fout, "# [1] = Channel number (starting at 1)\n");
+  fprintf(fout, "# [2] = Channel frequency [MHz]\n");
+  fprintf(fout, "# [3] = Bandpass\n");
+  if (bandpass_smoothing_parameter > 0.0) {
+    const char * method =
+        mBandpassSmoothing == BandpassSmoothing::Median ? "median" :
+        mBandpassSmoothing == BandpassSmoothing::SavitzkyGolay ?
+            "Savitzky-Golay" : "Gaussian";
+    fprintf(fout, "# [4] = Smoothed bandpass (%s, parameter = %.2f)\n",
+        method, bandpass_smoothing_parameter);
+  }
 
-  // measure bandpass
-  if (do_bp) {
-    printf("Measuring bandpass... ");
-    fflush(stdout);
+  double fch1 = header.fch1;
+  double foff = header.foff;
 
-    // we checked above that nifs == 1
-    std::vector<double> sum(header.nchans, 0.0);
-    std::vector<int> num(header.nchans, 0);
+  double bp_sum = 0.0;
+  std::vector<float> orig_bp(bp.size());
+  std::vector<float> delta_bp(bp.size());
 
-    // read raw data in time chunks
-    size_t max_t = batch_size * (size_t)in_n / (size_t)header.nchans;
-    // max 16 MB
-    size_t t_chunk = std::min(max_t, (size_t)(4 * 1024 * 1024 / header.nchans));
-    t_chunk = std::min(t_chunk, bp_samples);
+  if (mpMask == nullptr) {
+    for (size_t c = 0; c < orig_bp.size(); ++c)
+      orig_bp[c] = sum[c] / (double)bp_samples;
+  } else {
+    for (size_t c = 0; c < orig_bp.size(); ++c) {
+      if (num[c] == 0)
+        bp[c] = 1.0;
+      else
+        orig_bp[c] = sum[c] / (double)num[c];
+    }
+  }
 
-    size_t num_chunks = (bp_samples + t_chunk - 1) / t_chunk;
+  // smooth bandpass if requested
+  if (bandpass_smoothing_parameter > 0.0) {
+    switch (mBandpassSmoothing) {
+    case BandpassSmoothing::Gaussian:
+      bp = smooth_gaussian(orig_bp, bandpass_smoothing_parameter);
+      break;
+    case BandpassSmoothing::Median:
+      bp = smooth_median(orig_bp, (size_t)bandpass_smoothing_parameter);
+      break;
+    case BandpassSmoothing::SavitzkyGolay:
+      bp = smooth_savitzky_golay(orig_bp,
+          (size_t)bandpass_smoothing_parameter, BandpassSavitzkyGolayOrder);
+      break;
+    }
+  } else {
+    bp = orig_bp;
+  }
 
-    int fd = input.FD();
-    seek(fd, input.HeaderSize());
+  for (size_t c = 0; c < bp.size(); ++c) {
+    if (bandpass_smoothing_parameter > 0.0) {
+      fprintf(fout, "%6lu  %12.3f  %18.8e  %18.8e\n", c + 1,
+          fch1 + (double)c * foff, orig_bp[c], bp[c]);
+    } else {
+      fprintf(fout, "%6lu  %12.3f  %18.8e\n", c + 1, fch1 + (double)c * foff,
+          bp[c]);
+    }
 
-    for (size_t c = 0; c < num_chunks; ++c) {
-      size_t first_t = c * t_chunk;
-      size_t len = std::min(t_chunk, bp_samples - first_t);
+    float median_bp = 0.0;
+    if (c == 0)
+      median_bp = bp[0];
+    else if (c == 1)
+      median_bp = median5(bp[0], bp[0], bp[1], bp[2], bp[3]);
+    else if (c == bp.size() - 2)
+      median_bp = median5(bp[c-2], bp[c-1], bp[c], bp[c+1], bp[c+1]);
+    else if (c == bp.size() - 1)
+      median_bp = bp[c];
+    else
+      median_bp = median5(bp[c-2], bp[c-1], bp[c], bp[c+1], bp[c+2]);
+
+    delta_bp[c] = bp[c] - median_bp;
+    bp_sum += delta_bp[c];
+  }
 
-      read_data(fd, (char*)buf_in, len * header.nchans * sizeof(float));
+  fclose(fout);
 
-      if (mpMask == nullptr) {
-        for (size_t t = 0; t < len; ++t) {
-          for (size_t i = 0; i < (size_t)header.nchans; ++i) {
-            sum[i] += buf_in[t * header.nchans + i];
-          }
-        }
-      } else {
-        for (size_t t = 0; t < len; ++t) {
-          int interval = (first_t + t) / mpMask->IntervalSize();
-          auto bad_channels = mpMask->ZappedChannelsPerInterval()[interval];
-
-          for (size_t i = 0; i < (size_t)header.nchans; ++i) {
-            if (bad_channels.count(i) == 0) {
-              sum[i] += buf_in[t * header.nchans + i];
-              num[i] += 1;
-            }
-          }
-        }
-      }
+  double mean_delta_bp = bp_sum / (double)bp.size();
+
+  bp_sum = 0.0;
+  for (size_t i = 0; i < delta_bp.size(); ++i) {
+    double diff = delta_bp[i] - mean_delta_bp;
+    bp_sum += diff * diff;
+  }
+
+  double rms_delta_bp = sqrt(bp_sum / (double)bp.size());
 
-      printf("\33[2K\rMeasuring bandpass... %3i%%",
-          (int)(100.0 * (double)(c + 1) / (double)(num_chunks)));
-      fflush(stdout);
+  for (size_t i = 0; i < bp.size(); ++i) {
+    double diff = abs(delta_bp[i] - mean_delta_bp);
+    if (diff > 3.0 * rms_delta_bp || (bp[i] <= 0.0)) {
+      // kill this channel
+      kill_idxs->insert(i);
     }
+  }
 
-    printf("\33[2K\rMeasuring bandpass... done\n");
+  // print the list at once, so that it stays in one piece when several
+  // SigProcUtils are working at the same time
+  std::string zeroed = kill_idxs->size() == 0 ? "none" : "";
+  for (auto itr = kill_idxs->begin(); itr != kill_idxs->end(); ++itr) {
+    zeroed += (itr == kill_idxs->begin() ? "" : ", ")
+        + std::to_string(*itr + 1);
+  }
+  printf("Zeroing channels: %s\n", zeroed.c_str());
 
-    // write out bandpass and get indices of channels that need to be zeroed out
-    std::string path = output + ".bandpass";
-    FILE * fout = fopen(path.c_str(), "w");
-    fprintf(fout, "# [1] = Channel number (starting at 1)\n");
-    fprintf(fout, "# [2] = Channel frequency [MHz]\n");
-    fprintf(fout, "# [3] = Bandpass\n");
-    if (bandpass_smoothing_parameter > 0.0)
-      fprintf(fout, "# [4] = Smoothed bandpass (parameter = %.2f)\n",
-          bandpass_smoothing_parameter);
+  return bp;
+}
 
-    double fch1 = header.fch1;
-    double foff = header.foff;
+void SigProcUtil::ProcessInPlace(const std::string& file,
+    const int num_samples_to_estimate_bandpass,
+    const double bandpass_smoothing_parameter,
+    const double baseline_length_in_sec,
+    const std::string observatoryCodeForBarycentering) const {
+  if (SigProc::IsStream(file))
+    throw std::invalid_argument("Cannot process a stream in place");
 
-    double bp_sum = 0.0;
-    std::vector<float> orig_bp(bp.size());
-    std::vector<float> delta_bp(bp.size());
+  if (access(file.c_str(), W_OK) != 0) {
+    perror("Failure in SigProcUtil::ProcessInPlace");
+    throw std::runtime_error("Cannot write to '" + file + "'");
+  }
 
-    if (mpMask == nullptr) {
-      for (size_t c = 0; c < orig_bp.size(); ++c)
-        orig_bp[c] = sum[c] / (double)bp_samples;
-    } else {
-      for (size_t c = 0; c < orig_bp.size(); ++c) {
-        if (num[c] == 0)
-          bp[c] = 1.0;
-        else
-          orig_bp[c] = sum[c] / (double)num[c];
-      }
-    }
+  // reading and writing go through different SigProcs, since the pipeline
+  // reads and writes at the same time
+  SigProc in(file);
+  in.SetDirectIO(mDirectIO);
+  SigProc out(file);
+  out.SetDirectIO(mDirectIO);
 
-    // smooth bandpass if requested
-    if (bandpass_smoothing_parameter > 0.0) {
-      for (size_t i = 0; i < orig_bp.size(); ++i) {
-        double sum = 0.0;
-        double denom = 0.0;
-
-        for (size_t j = 0; j < orig_bp.size(); ++j) {
-          double d = (double)i - (double)j;
-          double arg = d * d / (2.0 * bandpass_smoothing_parameter);
-          arg = std::max(arg, 100.0);
-          double k = exp(-arg);
-          sum += k * orig_bp[j];
-          denom += k;
-        }
+  DoProcess(in, &out, file, 1, num_samples_to_estimate_bandpass,
+      bandpass_smoothing_parameter, baseline_length_in_sec,
+      observatoryCodeForBarycentering);
+}
 
-        bp[i] = sum / denom;
-      }
+void SigProcUtil::DoProcess(const SigProc& input, SigProc * const in_place,
+    const std::string& output, const int num_samples_to_average,
+    const int num_samples_to_estimate_bandpass,
+    const double bandpass_smoothing_parameter,
+    const double baseline_length_in_sec,
+    const std::string observatoryCodeForBarycentering) const {
+  if (num_samples_to_average <= 0)
+    throw std::invalid_argument("Cannot average a non-positive number "
+        "of samples");
+
+  if (num_samples_to_estimate_bandpass < 0)
+    throw std::invalid_argument("Cannot estimate bandpass with negative "
+        "number of samples");
+
+  if (baseline_length_in_sec < 0.0)
+    throw std::invalid_argument("Cannot remove negative length baseline");
+
+  auto header = input.Header();
+  const size_t in_n = std::max(header.nsamples, (int64_t)0);
+  const size_t nifs = header.nifs;
+
+  // A stream can only be read or written once from front to back, so it can't
+  // go through the stages that need entire channels (see RunStages), and the
+  // bandpass can't be measured on the input before it is processed. We find
+  // out before we set up any of them.
+  const bool barycenter = (observatoryCodeForBarycentering != "")
+      && (header.barycentric == 0);
+  if (input.Sequential() && (num_samples_to_estimate_bandpass > 0))
+    throw std::invalid_argument("Cannot correct the bandpass of a stream, "
+        "measuring the bandpass would read it twice");
+  if ((input.Sequential() || SigProc::IsStream(output))
+      && ((baseline_length_in_sec > 0.0) || barycenter))
+    throw std::invalid_argument("Cannot remove the baseline of or barycenter "
+        "a stream, that needs entire channels");
+
+  // In place, the data must keep its size and layout. What we need to resume
+  // after a crash is in the preamble of the journal: the parameters (which
+  // must not change) and the bandpass and zeroed channels, which can't be
+  // measured again once the data is overwritten.
+  std::unique_ptr<RedoJournal> journal;
+  std::string params;
+  if (in_place != nullptr) {
+    if (num_samples_to_average > 1)
+      throw std::invalid_argument("Cannot average samples in place");
+
+    if (mNumChannelsToAverage > 1)
+      throw std::invalid_argument("Cannot average channels in place");
+
+    if (mOutputBits != header.nbits)
+      throw std::invalid_argument("Can only process in place if the output "
+          "has as many bits per value as the input");
+
+    if (((mOutputLayout == OutputLayout::TimeMajor) && input.ChannelMajor())
+        || ((mOutputLayout == OutputLayout::ChannelMajor)
+        && !input.ChannelMajor()))
+      throw std::invalid_argument("Cannot change the layout in place");
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "bandpass %i %.17g %i baseline %.17g bits %i "
+        "scaling %i %.9g %.9g mask ", num_samples_to_estimate_bandpass,
+        bandpass_smoothing_parameter, (int)mBandpassSmoothing,
+        baseline_length_in_sec, mOutputBits, mAutoScale ? 1 : 0, mOutputScale,
+        mOutputOffset);
+    params = std::string(buf);
+
+    // The mask is read again when we resume, so it is identified by its file
+    // and a checksum of its bitmap. Everything else the stages use is given
+    // here or kept in the preamble.
+    if (mpMask != nullptr) {
+      const uint64_t sum = RedoJournal::Checksum(mpMask->ZappedChannelBits(0),
+          (size_t)mpMask->NumIntervals() * mpMask->WordsPerInterval()
+          * sizeof(uint64_t));
+      snprintf(buf, sizeof(buf), " %i %i %016llx", mpMask->NumIntervals(),
+          mpMask->IntervalSize(), (unsigned long long)sum);
+      params += mpMask->FileName() + buf;
     } else {
-      bp = orig_bp;
+      params += "none";
     }
 
-    for (size_t c = 0; c < bp.size(); ++c) {
-      if (bandpass_smoothing_parameter > 0.0) {
-        fprintf(fout, "%6lu  %12.3f  %18.8e  %18.8e\n", c + 1,
-            fch1 + (double)c * foff, orig_bp[c], bp[c]);
-      } else {
-        fprintf(fout, "%6lu  %12.3f  %18.8e\n", c + 1, fch1 + (double)c * foff,
-            bp[c]);
+    params += " obs " + observatoryCodeForBarycentering;
+
+    journal = std::unique_ptr<RedoJournal>(new RedoJournal(output
+        + ".journal"));
+  }
+
+  std::set<size_t> kill_idxs;
+  std::vector<float> bp;
+
+  if ((journal != nullptr) && journal->Resumed()) {
+    // pick up where the previous run stopped
+    const auto& preamble = journal->Preamble();
+    const char * const p = preamble.data();
+    const size_t params_size = params.size() + 1;
+    if ((preamble.size() < params_size) || (std::string(p) != params))
+      throw std::runtime_error("'" + output + "' is partly processed with "
+          "other parameters, resume with the same parameters");
+
+    const size_t bp_size = num_samples_to_estimate_bandpass > 0
+        ? header.nchans : 0;
+    bp.resize(bp_size);
+    memcpy(bp.data(), p + params_size, bp_size * sizeof(float));
+
+    const uint64_t * const kill = (const uint64_t*)(p + params_size
+        + bp_size * sizeof(float));
+    const size_t num_kill = (preamble.size() - params_size
+        - bp_size * sizeof(float)) / sizeof(uint64_t);
+    kill_idxs.insert(kill, kill + num_kill);
+
+    printf("Resuming in-place processing of '%s'\n", output.c_str());
+  } else {
+    // add channel killed by mask
+    if (mpMask != nullptr)
+      kill_idxs.insert(mpMask->ZappedChannels().begin(),
+          mpMask->ZappedChannels().end());
+
+    // measure bandpass
+    if (num_samples_to_estimate_bandpass > 0) {
+      if (num_samples_to_estimate_bandpass < 16384) {
+        printf("WARNING: Using small number of samples (%i) to estimate "
+            "bandpass\n", num_samples_to_estimate_bandpass);
       }
 
-      float median_bp = 0.0;
-      if (c == 0)
-        median_bp = bp[0];
-      else if (c == 1)
-        median_bp = median5(bp[0], bp[0], bp[1], bp[2], bp[3]);
-      else if (c == bp.size() - 2)
-        median_bp = median5(bp[c-2], bp[c-1], bp[c], bp[c+1], bp[c+1]);
-      else if (c == bp.size() - 1)
-        median_bp = bp[c];
-      else
-        median_bp = median5(bp[c-2], bp[c-1], bp[c], bp[c+1], bp[c+2]);
+      if (nifs > 1)
+        throw std::runtime_error("Don't know how to correct bandpass with "
+            "multiple IFs");
 
-      delta_bp[c] = bp[c] - median_bp;
-      bp_sum += delta_bp[c];
+      bp = MeasureBandpass(input, output,
+          std::min((size_t)num_samples_to_estimate_bandpass, in_n),
+          bandpass_smoothing_parameter, &kill_idxs);
     }
+  }
 
-    fclose(fout);
+  // the stages in the order they are applied, each one updates the header to
+  // its output
+  ProcessingStages stages;
+  auto add_stage = [&](ProcessingStage * const stage) {
+    stages.emplace_back(stage);
+    stage->UpdateHeader(&header);
+  };
 
-    double mean_delta_bp = bp_sum / (double)bp.size();
+  if (num_samples_to_average > 1)
+    add_stage(new AverageStage(num_samples_to_average));
 
-    bp_sum = 0.0;
-    for (size_t i = 0; i < delta_bp.size(); ++i) {
-      double diff = delta_bp[i] - mean_delta_bp;
-      bp_sum += diff * diff;
+  if (num_samples_to_estimate_bandpass > 0)
+    add_stage(new BandpassStage(bp));
+
+  if (kill_idxs.size() > 0)
+    add_stage(new ZeroChannelsStage(kill_idxs));
+
+  if (baseline_length_in_sec > 0.0)
+    add_stage(new BaselineStage((size_t)std::max(header.nsamples, (int64_t)0),
+        nifs * header.nchans, header.tsamp, baseline_length_in_sec, mUseGPU));
+
+  if (mpMask != nullptr)
+    add_stage(new MaskStage(*mpMask));
+
+  if (mNumChannelsToAverage > 1)
+    add_stage(new ChannelAverageStage(mNumChannelsToAverage, header.nchans,
+        kill_idxs, mpMask.get()));
+
+  if (barycenter)
+    add_stage(new BarycenterStage(header,
+        (size_t)std::max(header.nsamples, (int64_t)0),
+        observatoryCodeForBarycentering));
+
+  header.nbits = mOutputBits;
+
+  if (mOutputLayout == OutputLayout::TimeMajor)
+    header.channel_major = 0;
+  else if (mOutputLayout == OutputLayout::ChannelMajor)
+    header.channel_major = 1;
+
+  // in place, only barycentering changes the header
+  const bool new_header = !(header == input.Header());
+  if ((in_place != nullptr) && new_header
+      && (header.Get_output_size() != in_place->HeaderSize()))
+    throw std::runtime_error("Cannot process in place because the new header "
+        "has a different size");
+
+  if ((journal != nullptr) && !journal->Resumed()) {
+    std::vector<char> preamble(params.begin(), params.end());
+    preamble.push_back('\0');
+    const char * const p = (const char*)bp.data();
+    preamble.insert(preamble.end(), p, p + bp.size() * sizeof(float));
+    for (size_t c : kill_idxs) {
+      const uint64_t idx = c;
+      preamble.insert(preamble.end(), (const char*)&idx,
+          (const char*)&idx + sizeof(idx));
     }
 
-    double rms_delta_bp = sqrt(bp_sum / (double)bp.size());
+    journal->Start(preamble);
+  }
+
+  {
+    std::unique_ptr<SigProc> new_out;
+    SigProc * out = in_place;
+    if (out == nullptr) {
+      // use a different name for the incomplete file (which has the final
+      // size, though)
+      new_out = std::unique_ptr<SigProc>(new SigProc(in_progress_name(output),
+          header));
+      new_out->SetDirectIO(mDirectIO);
+      out = new_out.get();
+    }
 
-    for (size_t i = 0; i < bp.size(); ++i) {
-      double diff = abs(delta_bp[i] - mean_delta_bp);
-      if (diff > 3.0 * rms_delta_bp || (bp[i] <= 0.0)) {
-        // kill this channel
-        kill_idxs.insert(i);
+    // quantization of each channel of each IF for 8 and 16-bit output
+    const bool quantize = (mOutputBits != 32);
+    if (quantize && !mAutoScale)
+      out->SetQuantization(mOutputScale, mOutputOffset);
+    if (quantize && mAutoScale)
+      stages.emplace_back(new AutoScaleStage(mOutputBits, AutoScaleNumSigma,
+          out));
+
+    RunStages(input, out, output, stages, journal.get());
+
+    // clean up
+    stages.clear();
+
+    // A stream can't be scaled automatically, so its quantization is the one
+    // we were given. Its name may not take a suffix either (like /dev/fd/1).
+    if (quantize && !out->Sequential()) {
+      // write out the quantization so that the output can be converted back
+      std::string path = output + ".scales";
+      FILE * fout = fopen(path.c_str(), "w");
+      if (fout == nullptr)
+        throw std::runtime_error("Failed to open file '" + path + "'");
+
+      fprintf(fout, "# %i-bit output = round(value * scale + offset)\n",
+          mOutputBits);
+      fprintf(fout, "# [1] = IF number (starting at 1)\n");
+      fprintf(fout, "# [2] = Channel number (starting at 1)\n");
+      fprintf(fout, "# [3] = Channel frequency [MHz]\n");
+      fprintf(fout, "# [4] = Scale\n");
+      fprintf(fout, "# [5] = Offset\n");
+
+      for (int if_idx = 0; if_idx < header.nifs; ++if_idx) {
+        for (int c = 0; c < header.nchans; ++c) {
+          float scale, offset;
+          out->GetChannelQuantization(if_idx, c, &scale, &offset);
+          fprintf(fout, "%3i  %6i  %12.3f  %18.8e  %18.8e\n", if_idx + 1,
+              c + 1, header.fch1 + (double)c * header.foff, scale, offset);
+        }
       }
+
+      fclose(fout);
     }
+  }
 
-    printf("Zeroing channels: ");
-    if (kill_idxs.size() == 0) {
-      printf("none\n");
-    } else {
-      auto itr = kill_idxs.begin();
-      printf("%lu", *itr + 1);
-      ++itr;
-      for (; itr != kill_idxs.end(); ++itr)
-        printf(", %lu", *itr + 1);
-      printf("\n");
+  if (in_place != nullptr) {
+    // the data is all there, now the header can change
+    if (new_header) {
+      const int fd = in_place->FD();
+      seek(fd, 0);
+      header.Write(fd);
+      in_place->HardFlush();
     }
+    journal->Remove();
+  } else {
+    finish_output(output);
   }
+}
 
-  for (int if_idx = 0; if_idx < header.nifs; ++if_idx) {
-    for (size_t b = 0; b < num_batches; ++b) {
-      size_t first_channel = b * batch_size;
-      size_t num_channels = std::min(batch_size,
-          (size_t)header.nchans - first_channel);
-
-      printf("Batch %lu of %lu: reading... ", b + 1, num_batches);
-      fflush(stdout);
-
-      input.GetChannels(buf_in, if_idx, first_channel, num_channels, true);
-
-      printf("\33[2K\rBatch %lu of %lu: processing... ", b + 1, num_batches);
-      fflush(stdout);
-
-      if (do_bp || do_avg) {
-        for (size_t c = 0; c < num_channels; ++c) {
-          // check if we zero this channel
-          size_t channel = first_channel + c;
-          if (kill_idxs.count(channel) > 0) {
-            memset(buf_out + c * out_n, 0, out_n * sizeof(float));
-            continue;
-          }
-
-          // average samples
-          for (size_t t = 0; t < (size_t)out_n; ++t) {
-            if (do_avg) {
-              double sum = 0.0;
-              for (int i = 0; i < num_samples_to_average; ++i)
-                sum += buf_in[c * in_n + t * num_samples_to_average + i];
-              buf_out[c * out_n + t] = sum / (double)num_samples_to_average;
-            }
-
-            if (do_bp)
-              buf_out[c * out_n + t] /= bp[channel];
-          }
-        }
+void SigProcUtil::RunStages(const SigProc& input, SigProc * const out,
+    const std::string& output, const ProcessingStages& stages,
+    RedoJournal * const journal) const {
+  const auto& header = input.Header();
+  const size_t nifs = header.nifs;
+  const size_t nchans = header.nchans;
+  const size_t spectrum_size = nifs * nchans;
+  const size_t in_n = std::max(header.nsamples, (int64_t)0);
+
+  size_t decimation = 1;
+  size_t channel_decimation = 1;
+  for (auto& stage : stages) {
+    decimation *= stage->Decimation();
+    channel_decimation *= stage->ChannelDecimation();
+  }
+  const size_t out_n = in_n / decimation;
+  const size_t out_spectrum_size = spectrum_size / channel_decimation;
+
+  // the blocks are processed in parallel
+#ifdef _OPENMP
+  const int num_threads = mNumThreads > 0 ? mNumThreads : omp_get_max_threads();
+#else
+  const int num_threads = 1;
+#endif
+
+  // the stages before the first one that needs entire channels can work on
+  // blocks of spectra
+  size_t num_spectra_stages = 0;
+  while ((num_spectra_stages < stages.size())
+      && !stages[num_spectra_stages]->NeedsChannels())
+    ++num_spectra_stages;
+
+  // If no stage needs entire channels and the input and output are both
+  // time-major, we stream through them in blocks of spectra, reading and
+  // writing each file once in order, with a fixed amount of memory. That's
+  // the only way to process a stream.
+  const bool streaming = (num_spectra_stages == stages.size())
+      && !input.ChannelMajor() && !out->ChannelMajor();
+  if (!streaming && (input.Sequential() || out->Sequential()))
+    throw std::invalid_argument("Can only process a stream in time-major "
+        "layout without stages that need entire channels, it can only be read "
+        "and written spectrum by spectrum from front to back");
+
+  if (streaming) {
+    // a stream that doesn't say how long it is goes on until it ends
+    const bool open_ended = input.Sequential() && (header.nsamples < 0);
+
+    // the floats that the output of the first stage in [first, end) that
+    // decimates takes, for num spectra of size floats going into stage first
+    auto dec_floats = [&](const size_t first, const size_t end,
+        const size_t num, const size_t size) {
+      for (size_t s = first; s < end; ++s) {
+        if ((stages[s]->Decimation() > 1)
+            || (stages[s]->ChannelDecimation() > 1))
+          return num / stages[s]->Decimation()
+              * (size / stages[s]->ChannelDecimation());
       }
+      return (size_t)0;
+    };
+
+    // the memory each output spectrum of a block takes: its input spectra, and
+    // their output of the first stage that decimates
+    const size_t out_floats = decimation * spectrum_size
+        + dec_floats(0, stages.size(), decimation, spectrum_size);
+    const size_t max_floats = BufferSize() / sizeof(float);
+
+    // The input is read through a SpectrumReader, which holds the block it
+    // hands out and the one it reads ahead, unless it uses the mapped input.
+    // Only if there isn't even memory for those, we read the spectra straight
+    // into the slots or the chunks.
+    const bool mapped = (input.MappedData() != nullptr);
+    bool use_reader = true;
+    auto reader_floats = [&](const size_t len) {
+      return (use_reader && !mapped) ? 2 * len * spectrum_size : 0;
+    };
+
+    // blocks of whole output spectra, a few of which are in flight at once
+    size_t block_len = std::max((size_t)1, std::min(
+        SpectrumReader::DefaultBlockSize / sizeof(float),
+        max_floats / (NumBatchesInFlight + (mapped ? 0 : 2))) / out_floats);
+    if (!open_ended)
+      block_len = std::min(block_len, out_n);
+
+    // in place, the blocks have to stay the same if we resume
+    if ((journal != nullptr) && (journal->UnitSize() > 0))
+      block_len = journal->UnitSize();
+    else if (journal != nullptr)
+      journal->SetUnitSize(block_len);
+
+    const size_t num_blocks = block_len > 0
+        ? (out_n + block_len - 1) / block_len : 0;
+    size_t num_slots = std::max(std::min(NumBatchesInFlight,
+        open_ended ? NumBatchesInFlight : num_blocks), (size_t)1);
+
+    // If not even one block fits, the first stage that decimates in time (d)
+    // takes the input spectra of each of its output spectra (a group) in
+    // chunks of chunk_len, which go through the stages before it when they
+    // are read. The slots then only hold the output of stage d.
+    const bool partial = (block_len * out_floats > max_floats);
+    if (!partial && (block_len * out_floats
+        + reader_floats(block_len * decimation) > max_floats))
+      use_reader = false;
+    size_t d = 0;
+    while ((d < stages.size()) && (stages[d]->Decimation() == 1))
+      ++d;
+    if (partial && ((d == stages.size()) || !stages[d]->CanAccumulate()))
+      throw std::runtime_error("Not enough memory");
+
+    const size_t group_len = partial ? stages[d]->Decimation() : 1;
+    const size_t rest_decimation = decimation / group_len;
+    size_t d_spectrum_size = spectrum_size;
+    for (size_t s = 0; partial && (s <= d); ++s)
+      d_spectrum_size /= stages[s]->ChannelDecimation();
+
+    size_t slot_in = block_len * decimation * spectrum_size;
+    size_t slot_dec = dec_floats(0, stages.size(), block_len * decimation,
+        spectrum_size);
+    if (partial) {
+      slot_in = block_len * rest_decimation * d_spectrum_size;
+      slot_dec = dec_floats(d + 1, stages.size(), block_len * rest_decimation,
+          d_spectrum_size);
+    }
 
-      if (do_base) {
-        baseline_remover->Process_batch(buf_out, num_channels);
+    // the chunks and the reader's blocks of them take what the slots leave
+    const size_t slot_floats = std::max(slot_in + slot_dec, (size_t)1);
+    num_slots = std::min(num_slots, (partial ? max_floats / 2
+        : max_floats - reader_floats(block_len * decimation)) / slot_floats);
+    if (num_slots == 0)
+      throw std::runtime_error("Not enough memory");
+
+    size_t chunk_len = 0;
+    if (partial) {
+      const size_t left = max_floats - num_slots * slot_floats;
+      const size_t chunk_floats = spectrum_size
+          + dec_floats(0, d, 1, spectrum_size);
+      chunk_len = std::min(group_len, left / (chunk_floats + reader_floats(1)));
+      if (chunk_len == 0) {
+        use_reader = false;
+        chunk_len = std::min(group_len, left / chunk_floats);
+      }
+      if (chunk_len == 0)
+        throw std::runtime_error("Not enough memory");
+    }
+
+    std::vector<std::vector<float>> bufs_in(num_slots,
+        std::vector<float>(slot_in));
+    std::vector<std::vector<float>> bufs_dec(num_slots,
+        std::vector<float>(slot_dec));
+    std::vector<float> chunk(chunk_len * spectrum_size);
+    std::vector<float> chunk_dec(dec_floats(0, d, chunk_len, spectrum_size));
+    std::vector<const float*> results(num_slots);
+
+    // the number of output spectra of the block in each slot
+    std::vector<size_t> lens(num_slots);
+
+    // the output spectra of block k
+    auto block_samples = [&](const size_t k, size_t * const first_sample,
+        size_t * const num_samples) {
+      *first_sample = k * block_len;
+      *num_samples = std::min(block_len, out_n - *first_sample);
+    };
+
+    size_t num_blocks_written = 0;
+
+    auto skip = [&](const size_t k) {
+      return (journal != nullptr) && journal->IsDone(k);
+    };
+
+    auto write_spectra = [&](const size_t k, const float * const data) {
+      size_t first_sample, num_samples;
+      block_samples(k, &first_sample, &num_samples);
+
+      out->SetSpectra(first_sample, data, num_samples);
+    };
+
+    replay_interrupted_unit(journal, out, write_spectra,
+        [](const size_t, const std::vector<char>&) {});
+
+    // Read num spectra from first on (or the next ones of an open-ended
+    // stream) out of the blocks of the reader, unless we can't use one (see
+    // above). The reader is only created here, after the interrupted unit is
+    // replayed. Returns the number of spectra
+    // that were read, which is less than num at the end of the stream. The
+    // blocks that are done when resuming in place are skipped by starting a
+    // new reader after them.
+    std::unique_ptr<SpectrumReader> reader;
+    size_t next_sample = 0;
+    size_t num_used = 0; // spectra of the reader's block copied out so far
+
+    auto read_spectra = [&](float * const data, const size_t first,
+        const size_t num) {
+      if (!use_reader) {
+        if (open_ended)
+          return input.GetNextSpectra(data, num);
+
+        input.GetSpectra(data, first, num);
+        return num;
       }
 
-      // apply RFI zap mask
-      if (mpMask != nullptr) {
-        for (size_t c = 0; c < num_channels; ++c) {
-          size_t channel = first_channel + c;
-
-          if (kill_idxs.count(channel) > 0)
-            // this is a channel that gets zapped completely, which is already
-            // done
-            continue;
-
-          for (int i : mpMask->ZappedIntervalsPerChannel()[channel]) {
-            size_t len = std::min(mpMask->IntervalSize(),
-                out_n - i * mpMask->IntervalSize());
-            memset(buf_out + c * out_n + i * mpMask->IntervalSize(), 0,
-                len * sizeof(float));
-          }
+      if ((reader == nullptr) || (!open_ended && (first != next_sample))) {
+        reader.reset(new SpectrumReader(input,
+            partial ? chunk_len : block_len * decimation,
+            SpectrumReader::AllIFs, open_ended ? 0 : first,
+            open_ended ? 0 : in_n - first));
+        next_sample = first;
+        num_used = 0;
+      }
+
+      size_t done = 0;
+      while (done < num) {
+        if (num_used == reader->NumSamples()) {
+          num_used = 0;
+          if (!reader->Next())
+            break;
         }
+
+        const size_t len = std::min(num - done,
+            reader->NumSamples() - num_used);
+        memcpy(data + done * spectrum_size,
+            reader->Data() + num_used * spectrum_size,
+            len * spectrum_size * sizeof(float));
+        num_used += len;
+        done += len;
       }
 
-      if (do_bary && (baryBuf != nullptr)) {
-        for (size_t c = 0; c < num_channels; ++c) {
-          memcpy(baryBuf, buf_out + c * out_n, out_n * sizeof(float));
-          bary->DoBarycenterCorrection(baryBuf, buf_out + c * out_n, out_n);
+      next_sample += done;
+      return done;
+    };
+
+    // Read the groups of num output spectra of stage d from first on, until
+    // the input runs out. Returns the number of groups that were complete.
+    auto read_groups = [&](float * const out, const size_t first,
+        const size_t num) {
+      for (size_t g = 0; g < num; ++g) {
+        StageBlock block;
+        for (size_t i = 0; i < group_len; i += chunk_len) {
+          const size_t sample = (first + g) * group_len + i;
+          const size_t len = std::min(chunk_len, group_len - i);
+          if (read_spectra(chunk.data(), sample, len) < len)
+            return g;
+
+          block = { false, nifs, nchans, 0, nchans, sample, len, 1,
+              num_threads };
+          const float * const spectra = run_stages(stages, 0, d, &block,
+              chunk.data(), chunk.data(), chunk_dec.data());
+          stages[d]->Accumulate(block, spectra);
         }
+
+        stages[d]->Finish(block, out + g * d_spectrum_size);
       }
 
-      printf("\33[2K\rBatch %lu of %lu: writing... ", b + 1, num_batches);
-      fflush(stdout);
+      return num;
+    };
+
+    // the spectra that are left over at the end of a stream that doesn't fill
+    // the last output spectrum are dropped
+    auto read_block = [&](const size_t k, const size_t slot) {
+      if (!open_ended && (k >= num_blocks))
+        return false;
+
+      size_t first_sample = k * block_len;
+      size_t num_samples = block_len;
+      if (!open_ended)
+        block_samples(k, &first_sample, &num_samples);
+
+      if (skip(k))
+        lens[slot] = num_samples;
+      else if (partial)
+        lens[slot] = read_groups(bufs_in[slot].data(),
+            first_sample * rest_decimation, num_samples * rest_decimation)
+            / rest_decimation;
+      else
+        lens[slot] = read_spectra(bufs_in[slot].data(),
+            first_sample * decimation, num_samples * decimation) / decimation;
+
+      return lens[slot] > 0;
+    };
+
+    auto process_block = [&](const size_t k, const size_t slot) {
+      if (skip(k))
+        return;
+
+      if (partial) {
+        StageBlock block = { false, nifs, d_spectrum_size / nifs, 0,
+            d_spectrum_size / nifs, k * block_len * rest_decimation,
+            lens[slot] * rest_decimation, group_len, num_threads };
+        results[slot] = run_stages(stages, d + 1, stages.size(), &block,
+            bufs_in[slot].data(), bufs_in[slot].data(), bufs_dec[slot].data());
+        return;
+      }
+
+      StageBlock block = { false, nifs, nchans, 0, nchans,
+          k * block_len * decimation, lens[slot] * decimation, 1,
+          num_threads };
+      results[slot] = run_stages(stages, 0, stages.size(), &block,
+          bufs_in[slot].data(), bufs_in[slot].data(), bufs_dec[slot].data());
+    };
+
+    auto write_block = [&](const size_t k, const size_t slot) {
+      if (open_ended)
+        out->SetSpectra(k * block_len, results[slot], lens[slot]);
+      else if (!skip(k))
+        write_unit(journal, out, k, results[slot],
+            lens[slot] * out_spectrum_size * sizeof(float),
+            std::vector<char>(), write_spectra);
+
+      ++num_blocks_written;
+      if (open_ended)
+        Progress("\33[2K\rStreaming spectra... %lu",
+            k * block_len + lens[slot]);
+      else
+        Progress("\33[2K\rStreaming spectra... %3i%%",
+            (int)(100.0 * (double)num_blocks_written / (double)num_blocks));
+    };
 
-      out.SetChannels(if_idx, first_channel, buf_out, num_channels, true);
+    Progress("\33[2K\rStreaming spectra... ");
+
+    Pipeline::Run(num_slots, read_block, process_block, write_block);
+
+    Progress("\33[2K\rStreaming spectra... done\n");
+    return;
+  }
 
-      printf("\33[2K\rBatch %lu of %lu: done\n", b + 1, num_batches);
+  // Otherwise, we process the channels in batches. The memory each channel of
+  // a batch needs if the batches go through the stages [first_stage, end):
+  // the input, the output of the first stage that decimates, and what the
+  // stages need themselves. Once channels are averaged, the memory of an
+  // output channel is shared by the input channels that go into it.
+  auto floats_per_channel = [&](const size_t first_stage) {
+    size_t n = in_n;
+    for (size_t s = 0; s < first_stage; ++s)
+      n /= stages[s]->Decimation();
+
+    size_t floats = n;
+    size_t num_avg = 1;
+    bool decimated = false;
+    for (size_t s = first_stage; s < stages.size(); ++s) {
+      n /= stages[s]->Decimation();
+      num_avg *= stages[s]->ChannelDecimation();
+      if (!decimated && ((stages[s]->Decimation() > 1)
+          || (stages[s]->ChannelDecimation() > 1))) {
+        floats += (n + num_avg - 1) / num_avg;
+        decimated = true;
+      }
+      floats += (stages[s]->MemoryPerChannel() + num_avg - 1) / num_avg;
     }
+
+    return nifs * floats;
+  };
+
+  // each batch holds its channels of all IFs, so that a multi-IF input is
+  // read once and all IFs are demultiplexed from the same pass, and the
+  // channels that are averaged together are in the same batch
+  size_t batch_size;
+  size_t num_concurrent_batches;
+  GetBatches(floats_per_channel(0), nchans, 1, channel_decimation, &batch_size,
+      &num_concurrent_batches);
+
+  if (batch_size <= 0)
+    throw std::runtime_error("Not enough memory");
+
+  size_t num_batches = (nchans + batch_size - 1) / batch_size;
+
+  // Reading a batch of channels from a time-major file means reading the
+  // entire input file, so with more than one batch we split the input into one
+  // scratch file per batch first. Then the input is read only once and each
+  // batch is read from its own contiguous scratch file. The stages that work
+  // on spectra and come first run while splitting the input, so the batches
+  // only go through the remaining stages and, if they average, are smaller.
+  // In place, that would need as much disk space as we are trying to save.
+  // The scratch files have the channels of the input, so the stages running
+  // while splitting the input stop at the first one that averages channels.
+  const bool scatter = mUseScratch && (num_batches > 1)
+      && !input.ChannelMajor() && (journal == nullptr);
+  size_t first_batch_stage = 0;
+  while (scatter && (first_batch_stage < num_spectra_stages)
+      && (stages[first_batch_stage]->ChannelDecimation() == 1))
+    ++first_batch_stage;
+
+  if (first_batch_stage > 0) {
+    GetBatches(floats_per_channel(first_batch_stage), nchans, 1,
+        channel_decimation, &batch_size, &num_concurrent_batches);
+
+    if (batch_size <= 0)
+      throw std::runtime_error("Not enough memory");
+
+    num_batches = (nchans + batch_size - 1) / batch_size;
   }
 
-  // clean up
-  baseline_remover = nullptr;
+  // With several batches, we overlap reading and writing with processing,
+  // which needs memory for more batches. That only pays off if reading a batch
+  // reads just its channels (from a scratch file or a channel-major input),
+  // otherwise each additional batch means reading the entire input once more.
+  size_t num_slots = 1;
+  if ((num_batches > 1) && (scatter || input.ChannelMajor())) {
+    GetBatches(floats_per_channel(first_batch_stage), nchans,
+        NumBatchesInFlight, channel_decimation, &batch_size,
+        &num_concurrent_batches);
+
+    if (batch_size <= 0)
+      throw std::runtime_error("Not enough memory");
+
+    num_batches = (nchans + batch_size - 1) / batch_size;
+    num_slots = std::min(NumBatchesInFlight, num_batches);
+  }
 
-  free(buf_in);
-  if (do_avg)
-    free(buf_out);
-  if (baryBuf != nullptr)
-    free(baryBuf);
+  // in place, the batches have to stay the same if we resume
+  if ((journal != nullptr) && (journal->UnitSize() > 0)) {
+    batch_size = journal->UnitSize();
+    num_batches = (nchans + batch_size - 1) / batch_size;
+    num_slots = std::min(num_slots, num_batches);
+  } else if (journal != nullptr) {
+    journal->SetUnitSize(batch_size);
+  }
 
-  std::string src = output + ".in_progress";
-  if (rename(src.c_str(), output.c_str()) != 0)
-    throw std::runtime_error(
-        "Failed to rename file '" + src + "' to '" + output + "'");
-}
+  // number of samples at the start of the batch stages, their decimation
+  // and the size of the output of the first of them that decimates
+  size_t batch_n = in_n;
+  size_t batch_factor = 1;
+  for (size_t s = 0; s < first_batch_stage; ++s) {
+    batch_n /= stages[s]->Decimation();
+    batch_factor *= stages[s]->Decimation();
+  }
+
+  size_t dec_size = 0;
+  for (size_t s = first_batch_stage; (s < stages.size()) && (dec_size == 0);
+      ++s) {
+    if ((stages[s]->Decimation() > 1) || (stages[s]->ChannelDecimation() > 1))
+      dec_size = nifs * (batch_size / stages[s]->ChannelDecimation())
+          * (batch_n / stages[s]->Decimation());
+  }
+
+  // the input and output buffers of each slot of the pipeline
+  std::vector<std::vector<float>> bufs_in(num_slots,
+      std::vector<float>(nifs * batch_size * batch_n));
+  std::vector<std::vector<float>> bufs_dec(num_slots,
+      std::vector<float>(dec_size));
+  std::vector<const float*> results(num_slots);
+
+  ScratchFiles scratch;
+  if (scatter)
+    ScatterBatches(input, output, batch_size, num_batches, stages,
+        first_batch_stage, num_threads, &scratch.names);
+
+  // the channels of batch b
+  auto batch_channels = [&](const size_t b, size_t * const first_channel,
+      size_t * const num_channels) {
+    *first_channel = b * batch_size;
+    *num_channels = std::min(batch_size, nchans - *first_channel);
+  };
+
+  // the channels batch b turns into in the output
+  auto out_channels = [&](const size_t b, size_t * const first_channel,
+      size_t * const num_channels) {
+    batch_channels(b, first_channel, num_channels);
+    *first_channel /= channel_decimation;
+    *num_channels /= channel_decimation;
+  };
+
+  // In place, the quantization of the channels of each batch goes into the
+  // journal with it, so that batches that are already done when we resume
+  // keep their scales
+  const bool quantized = (out->Header().nbits != 32);
+
+  auto batch_quantization = [&](const size_t b) {
+    size_t first_channel, num_channels;
+    out_channels(b, &first_channel, &num_channels);
+
+    std::vector<float> q;
+    for (size_t if_idx = 0; quantized && (if_idx < nifs); ++if_idx) {
+      for (size_t c = first_channel; c < first_channel + num_channels; ++c) {
+        float scale, offset;
+        out->GetChannelQuantization(if_idx, c, &scale, &offset);
+        q.push_back(scale);
+        q.push_back(offset);
+      }
+    }
 
-// explicit template instantiations
-template void SigProcUtil::DoProcess<true, true, true, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    return std::vector<char>((const char*)q.data(),
+        (const char*)(q.data() + q.size()));
+  };
 
-template void SigProcUtil::DoProcess<true, true, true, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  auto restore_quantization = [&](const size_t b,
+      const std::vector<char>& extra) {
+    size_t first_channel, num_channels;
+    out_channels(b, &first_channel, &num_channels);
 
-template void SigProcUtil::DoProcess<true, true, false, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    const float * q = (const float*)extra.data();
+    if (extra.size() != 2 * nifs * num_channels * sizeof(float))
+      return;
 
-template void SigProcUtil::DoProcess<true, true, false, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    for (size_t if_idx = 0; if_idx < nifs; ++if_idx) {
+      for (size_t c = first_channel; c < first_channel + num_channels; ++c) {
+        out->SetChannelQuantization(if_idx, c, q[0], q[1]);
+        q += 2;
+      }
+    }
+  };
 
-template void SigProcUtil::DoProcess<true, false, true, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  auto write_channels = [&](const size_t b, const float * const data) {
+    size_t first_channel, num_channels;
+    out_channels(b, &first_channel, &num_channels);
 
-template void SigProcUtil::DoProcess<true, false, true, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    out->SetChannelsAllIFs(first_channel, 0, data, num_channels, out_n,
+        mShowProgress && (num_slots == 1));
+  };
 
-template void SigProcUtil::DoProcess<true, false, false, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  auto skip = [&](const size_t b) {
+    return (journal != nullptr) && journal->IsDone(b);
+  };
 
-template void SigProcUtil::DoProcess<true, false, false, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  if (journal != nullptr) {
+    for (auto& done : journal->Done())
+      restore_quantization(done.first, done.second);
+  }
 
-template void SigProcUtil::DoProcess<false, true, true, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  replay_interrupted_unit(journal, out, write_channels, restore_quantization);
+
+  // With a single slot, the stages run one after the other and we report what
+  // is happening to the current batch. Otherwise, the stages of different
+  // batches run at the same time and we report how many batches have been
+  // through each of them.
+  std::mutex progress_mutex;
+  size_t num_done[3] = { 0, 0, 0 };
+  auto progress = [&](const size_t b, const size_t stage, const bool done) {
+    static const char * const doing[3] = { "reading", "processing", "writing" };
+
+    if (!mShowProgress)
+      return;
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    if (num_slots == 1) {
+      if (done && (stage == 2))
+        fprintf(stderr, "\33[2K\rBatch %lu of %lu: done\n", b + 1,
+            num_batches);
+      else if (!done)
+        fprintf(stderr, "\33[2K\rBatch %lu of %lu: %s... ", b + 1,
+            num_batches, doing[stage]);
+    } else if (done) {
+      ++num_done[stage];
+      fprintf(stderr, "\33[2K\rBatches of %lu: %lu read, %lu processed, "
+          "%lu written", num_batches, num_done[0], num_done[1], num_done[2]);
+      if (num_done[2] == num_batches)
+        fprintf(stderr, "\n");
+    }
+    fflush(stderr);
+  };
 
-template void SigProcUtil::DoProcess<false, true, true, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  auto read_batch = [&](const size_t b, const size_t slot) {
+    if (skip(b)) {
+      progress(b, 0, true);
+      return;
+    }
 
-template void SigProcUtil::DoProcess<false, true, false, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    size_t first_channel, num_channels;
+    batch_channels(b, &first_channel, &num_channels);
+    float * const buf_in = bufs_in[slot].data();
 
-template void SigProcUtil::DoProcess<false, true, false, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    // the progress of the read would mess up the progress of the pipeline
+    const bool print = mShowProgress && (num_slots == 1);
+    progress(b, 0, false);
 
-template void SigProcUtil::DoProcess<false, false, true, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    if (scatter) {
+      {
+        SigProc batch_input(scratch.names[b]);
+        batch_input.SetDirectIO(mDirectIO);
+        batch_input.GetChannelsAllIFs(buf_in, 0, num_channels, 0, batch_n,
+            print);
+      }
 
-template void SigProcUtil::DoProcess<false, false, true, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+      ScratchFiles::Remove(&scratch.names[b]);
+    } else {
+      input.GetChannelsAllIFs(buf_in, first_channel, num_channels, 0, in_n,
+          print);
+    }
 
-template void SigProcUtil::DoProcess<false, false, false, true>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+    progress(b, 0, true);
+  };
 
-template void SigProcUtil::DoProcess<false, false, false, false>(
-    const SigProc&, const std::string&, const int, const int, const double,
-    const double, const std::string) const;
+  auto process_batch = [&](const size_t b, const size_t slot) {
+    if (skip(b)) {
+      progress(b, 1, true);
+      return;
+    }
+
+    size_t first_channel, num_channels;
+    batch_channels(b, &first_channel, &num_channels);
+
+    progress(b, 1, false);
+    StageBlock block = { true, nifs, nchans, first_channel, num_channels, 0,
+        batch_n, batch_factor, num_threads };
+    results[slot] = run_stages(stages, first_batch_stage, stages.size(),
+        &block, bufs_in[slot].data(), bufs_in[slot].data(),
+        bufs_dec[slot].data());
+    progress(b, 1, true);
+  };
+
+  auto write_batch = [&](const size_t b, const size_t slot) {
+    if (skip(b)) {
+      progress(b, 2, true);
+      return;
+    }
+
+    size_t first_channel, num_channels;
+    out_channels(b, &first_channel, &num_channels);
+
+    progress(b, 2, false);
+    write_unit(journal, out, b, results[slot],
+        nifs * num_channels * out_n * sizeof(float), batch_quantization(b),
+        write_channels);
+    progress(b, 2, true);
+  };
+
+  Pipeline::Run(num_batches, num_slots, read_batch, process_batch,
+      write_batch);
+}
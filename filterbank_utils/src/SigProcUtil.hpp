@@ -9,28 +9,97 @@
 #define SIGPROCUTIL_HPP_
 
 #include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
+#include "ProcessingStage.hpp"
+#include "RedoJournal.hpp"
 #include "SigProc.hpp"
 #include "RFIMask.hpp"
 
 class SigProcUtil {
 public:
+  // number of standard deviations from the mean to the edges of the integer
+  // range for automatically scaled 8 and 16-bit output
+  static constexpr double AutoScaleNumSigma = 6.0;
+
+  // If the channels are processed in several batches, the next batch is read
+  // and the previous one written while the current one is processed, so up to
+  // this many batches are in memory at once
+  static constexpr size_t NumBatchesInFlight = 3;
+
+  // layout of the output of Process, see SigProcHeader::channel_major
+  enum class OutputLayout {
+    SameAsInput,
+    TimeMajor,
+    ChannelMajor
+  };
+
+  // how the measured bandpass is smoothed, see Smoothing.hpp. The bandpass
+  // smoothing parameter of Process is the variance in channels^2 of the
+  // Gaussian, or the window width in channels for the other two.
+  enum class BandpassSmoothing {
+    Gaussian,
+    Median,
+    SavitzkyGolay
+  };
+
+  // order of the polynomials of the Savitzky-Golay bandpass smoothing
+  static constexpr int BandpassSavitzkyGolayOrder = 2;
+
   SigProcUtil(bool useGPU = true) :
       mMaxAbsoluteMemKB(0),
       mMaxFracMem(0.0),
-      mUseGPU(useGPU) {
+      mUseGPU(useGPU),
+      mUseScratch(true),
+      mScratchDir(""),
+      mDirectIO(false),
+      mOutputLayout(OutputLayout::SameAsInput),
+      mOutputBits(32),
+      mAutoScale(true),
+      mOutputScale(1.0),
+      mOutputOffset(0.0),
+      mNumThreads(0),
+      mBandpassSmoothing(BandpassSmoothing::Gaussian),
+      mNumChannelsToAverage(1),
+      mShowProgress(true) {
   }
 
   SigProcUtil(const size_t maxAbsoluteMem_kB, bool useGPU = true) :
       mMaxAbsoluteMemKB(maxAbsoluteMem_kB),
       mMaxFracMem(0.0),
-      mUseGPU(useGPU) {
+      mUseGPU(useGPU),
+      mUseScratch(true),
+      mScratchDir(""),
+      mDirectIO(false),
+      mOutputLayout(OutputLayout::SameAsInput),
+      mOutputBits(32),
+      mAutoScale(true),
+      mOutputScale(1.0),
+      mOutputOffset(0.0),
+      mNumThreads(0),
+      mBandpassSmoothing(BandpassSmoothing::Gaussian),
+      mNumChannelsToAverage(1),
+      mShowProgress(true) {
   }
 
   SigProcUtil(const double maxFracMem, bool useGPU = true) :
       mMaxAbsoluteMemKB(0),
       mMaxFracMem(maxFracMem),
-      mUseGPU(useGPU) {
+      mUseGPU(useGPU),
+      mUseScratch(true),
+      mScratchDir(""),
+      mDirectIO(false),
+      mOutputLayout(OutputLayout::SameAsInput),
+      mOutputBits(32),
+      mAutoScale(true),
+      mOutputScale(1.0),
+      mOutputOffset(0.0),
+      mNumThreads(0),
+      mBandpassSmoothing(BandpassSmoothing::Gaussian),
+      mNumChannelsToAverage(1),
+      mShowProgress(true) {
     SetFractionalMemLimit(maxFracMem);
   }
 
@@ -38,7 +107,19 @@ public:
       bool useGPU = true) :
       mMaxAbsoluteMemKB(maxAbsoluteMem_kB),
       mMaxFracMem(maxFracMem),
-      mUseGPU(useGPU) {
+      mUseGPU(useGPU),
+      mUseScratch(true),
+      mScratchDir(""),
+      mDirectIO(false),
+      mOutputLayout(OutputLayout::SameAsInput),
+      mOutputBits(32),
+      mAutoScale(true),
+      mOutputScale(1.0),
+      mOutputOffset(0.0),
+      mNumThreads(0),
+      mBandpassSmoothing(BandpassSmoothing::Gaussian),
+      mNumChannelsToAverage(1),
+      mShowProgress(true) {
     SetFractionalMemLimit(maxFracMem);
   }
 
@@ -57,8 +138,95 @@ public:
     mUseGPU = useGPU;
   }
 
+  // If the input doesn't fit into memory and has to be processed in several
+  // batches of channels, it is first split into one scratch file per batch in
+  // a single pass, instead of reading the entire input once per batch. This
+  // needs as much free disk space as the input file.
+  void SetUseScratch(const bool useScratch) {
+    mUseScratch = useScratch;
+  }
+
+  // directory for the scratch files, by default they are put next to the
+  // output file
+  void SetScratchDir(const std::string& scratchDir) {
+    mScratchDir = scratchDir;
+  }
+
+  // Write the output and scratch files and read the scratch files with direct
+  // I/O, bypassing the page cache (see SigProc::SetDirectIO). Whether the
+  // input file uses direct I/O is up to the caller, who opens it.
+  void SetDirectIO(const bool directIO) {
+    mDirectIO = directIO;
+  }
+
+  void SetOutputLayout(const OutputLayout layout) {
+    mOutputLayout = layout;
+  }
+
+  // Write the output of Process with 8, 16, or 32 bits per value. With 8 and
+  // 16 bits, the values are quantized as round(value * scale + offset) and the
+  // scale and offset of each channel are written to OUTPUT.scales. By default,
+  // each channel is scaled such that its mean is in the middle of the integer
+  // range and AutoScaleNumSigma standard deviations reach the edges.
+  void SetOutputBits(const int nbits) {
+    if ((nbits != 8) && (nbits != 16) && (nbits != 32))
+      throw std::invalid_argument("Can only write 8, 16, or 32-bit output");
+
+    mOutputBits = nbits;
+  }
+
+  // use the same fixed scale and offset for all channels
+  void SetOutputScaling(const float scale, const float offset) {
+    mAutoScale = false;
+    mOutputScale = scale;
+    mOutputOffset = offset;
+  }
+
+  void SetAutoScaling() {
+    mAutoScale = true;
+  }
+
+  // Process the channels of each batch with numThreads threads (0 uses all
+  // cores). With barycentering, each thread needs a buffer for one channel of
+  // the output.
+  void SetNumThreads(const int numThreads) {
+    if (numThreads < 0)
+      throw std::invalid_argument("numThreads cannot be negative");
+
+    mNumThreads = numThreads;
+  }
+
+  void SetBandpassSmoothing(const BandpassSmoothing smoothing) {
+    mBandpassSmoothing = smoothing;
+  }
+
+  // Average groups of numChannels adjacent channels in Process, after the
+  // bandpass correction, baseline removal and masking and before
+  // barycentering. The zeroed channels and masked samples are left out of the
+  // averages. The number of channels of the input must be a multiple of
+  // numChannels.
+  void SetNumChannelsToAverage(const int numChannels) {
+    if (numChannels <= 0)
+      throw std::invalid_argument("Cannot average a non-positive number "
+          "of channels");
+
+    mNumChannelsToAverage = numChannels;
+  }
+
   void SetMask(const RFIMask& mask) {
-    mpMask = std::unique_ptr<RFIMask>(new RFIMask(mask));
+    mpMask = std::make_shared<const RFIMask>(mask);
+  }
+
+  // use a mask that is shared with other SigProcUtils
+  void SetMask(const std::shared_ptr<const RFIMask>& mask) {
+    mpMask = mask;
+  }
+
+  // Print the progress of the operations to stderr, which is best turned off
+  // when several of them are running at the same time. Results and warnings
+  // are always printed.
+  void SetShowProgress(const bool showProgress) {
+    mShowProgress = showProgress;
   }
 
   void Meminfo(size_t * const total_kB, size_t * const available_kB) const;
@@ -66,6 +234,22 @@ public:
   void ModifyHeader(const std::string& input_file,
       const std::string& output_file, const SigProcHeader newHeader) const;
 
+  // Write a copy of the input with the data stored channel by channel
+  // (channel_major = true) or spectrum by spectrum. The data is streamed
+  // through in blocks of spectra, so this works for files of any size.
+  void ConvertLayout(const SigProc& input, const std::string& output,
+      const bool channel_major) const;
+
+  void ConvertToChannelMajor(const SigProc& input,
+      const std::string& output) const {
+    ConvertLayout(input, output, true);
+  }
+
+  void ConvertToTimeMajor(const SigProc& input,
+      const std::string& output) const {
+    ConvertLayout(input, output, false);
+  }
+
   void AverageSamples(const SigProc& input, const std::string& output,
       const int num_samples_to_average) const {
     Process(input, output, num_samples_to_average, 0, 0.0, 0.0, "");
@@ -94,72 +278,96 @@ public:
       const double bandpass_smoothing_parameter,
       const double baseline_length_in_sec,
       const std::string observatoryCodeForBarycentering) const {
-    DoProcess0(input, output, num_samples_to_average,
+    DoProcess(input, nullptr, output, num_samples_to_average,
         num_samples_to_estimate_bandpass, bandpass_smoothing_parameter,
         baseline_length_in_sec, observatoryCodeForBarycentering);
   }
 
+  // Process file in place: the processed data overwrites the data of the file
+  // one batch of channels (or block of spectra) at a time, so there is never a
+  // second copy of the file on disk. This works for everything but averaging
+  // samples or channels, and the output must have as many bits per value and
+  // the same layout as the file. The batches are read straight from the file,
+  // since scratch files would take as much space as the file. The journal
+  // FILE.journal (see RedoJournal) keeps track of the batches that are done,
+  // so if the processing is interrupted, calling this again with the same
+  // parameters finishes the job.
+  void ProcessInPlace(const std::string& file,
+      const int num_samples_to_estimate_bandpass,
+      const double bandpass_smoothing_parameter,
+      const double baseline_length_in_sec,
+      const std::string observatoryCodeForBarycentering) const;
+
 private:
+  // printf and flush if the progress is shown
+  void Progress(const char * const format, ...) const
+      __attribute__((format(printf, 2, 3)));
+
   size_t BufferSize() const;
 
+  // split num_channels into batches of a multiple of channel_multiple channels
+  // such that num_in_flight batches fit into the buffer
   void GetBatches(const size_t samples_per_channel, const size_t num_channels,
+      const size_t num_in_flight, const size_t channel_multiple,
       size_t * const batch_size, size_t * const num_concurrent_batches) const;
 
-  void DoProcess0(const SigProc& input, const std::string& output,
-      const int num_avg, const int num_bp, const double bp_smooth,
-      const double base, const std::string obs) const {
-    if (num_avg == 1)
-      DoProcess1<false>(input, output, num_avg, num_bp, bp_smooth, base, obs);
-    else
-      DoProcess1<true>(input, output, num_avg, num_bp, bp_smooth, base, obs);
-  }
-
-  template<bool do_avg>
-  void DoProcess1(const SigProc& input, const std::string& output,
-      const int num_avg, const int num_bp, const double bp_smooth,
-      const double base, const std::string obs) const {
-    if (num_bp == 0)
-      DoProcess2<do_avg, false>(input, output, num_avg, num_bp, bp_smooth,
-          base, obs);
-    else
-      DoProcess2<do_avg, true>(input, output, num_avg, num_bp, bp_smooth,
-          base, obs);
-  }
-
-  template<bool do_avg, bool do_bp>
-  void DoProcess2(const SigProc& input, const std::string& output,
-      const int num_avg, const int num_bp, const double bp_smooth,
-      const double base, const std::string obs) const {
-    if (base == 0.0)
-      DoProcess3<do_avg, do_bp, false>(input, output, num_avg, num_bp,
-          bp_smooth, base, obs);
-    else
-      DoProcess3<do_avg, do_bp, true>(input, output, num_avg, num_bp, bp_smooth,
-          base, obs);
-  }
-
-  template<bool do_avg, bool do_bp, bool do_base>
-  void DoProcess3(const SigProc& input, const std::string& output,
-      const int num_avg, const int num_bp, const double bp_smooth,
-      const double base, const std::string obs) const {
-    if (obs == "")
-      DoProcess<do_avg, do_bp, do_base, false>(input, output, num_avg, num_bp,
-          bp_smooth, base, obs);
-    else
-      DoProcess<do_avg, do_bp, do_base, true>(input, output, num_avg, num_bp,
-          bp_smooth, base, obs);
-  }
-
-  template<bool do_avg, bool do_bp, bool do_base, bool do_bary>
-  void DoProcess(const SigProc& input, const std::string& output,
-      const int num_avg, const int num_bp, const double bp_smooth,
-      const double base, const std::string obs) const;
+  // Split the time-major input into one scratch file per batch of channels,
+  // after running the first num_stages stages (which must work on spectra and
+  // keep the channels). Each scratch file goes into names as soon as it is
+  // created, so that the caller can remove them even if this throws.
+  void ScatterBatches(const SigProc& input, const std::string& output,
+      const size_t batch_size, const size_t num_batches,
+      const ProcessingStages& stages, const size_t num_stages,
+      const int num_threads, std::vector<std::string> * const names) const;
+
+  // Measure the bandpass from the first num_samples spectra of input, write
+  // it to output.bandpass, and add the channels that stick out to kill_idxs
+  std::vector<float> MeasureBandpass(const SigProc& input,
+      const std::string& output, const size_t num_samples,
+      const double bandpass_smoothing_parameter,
+      std::set<size_t> * const kill_idxs) const;
+
+  // Process input into output, or into in_place (which is input opened a
+  // second time) if it isn't nullptr
+  void DoProcess(const SigProc& input, SigProc * const in_place,
+      const std::string& output, const int num_avg, const int num_bp,
+      const double bp_smooth, const double base, const std::string obs) const;
+
+  // Run the data of input through the stages and write the result to out.
+  // Depending on which stages need entire channels and on the layouts, this
+  // streams through the files in blocks of spectra, or processes batches of
+  // channels, with the stages that come first running on spectra while the
+  // input is split into scratch files. In place, the blocks or batches are
+  // written through the journal. A stream can only be streamed through.
+  void RunStages(const SigProc& input, SigProc * const out,
+      const std::string& output, const ProcessingStages& stages,
+      RedoJournal * const journal) const;
 
   size_t mMaxAbsoluteMemKB;
   double mMaxFracMem;
   bool mUseGPU;
 
-  std::unique_ptr<RFIMask> mpMask;
+  bool mUseScratch;
+  std::string mScratchDir;
+
+  bool mDirectIO;
+
+  OutputLayout mOutputLayout;
+
+  int mOutputBits;
+  bool mAutoScale;
+  float mOutputScale;
+  float mOutputOffset;
+
+  int mNumThreads;
+
+  BandpassSmoothing mBandpassSmoothing;
+
+  int mNumChannelsToAverage;
+
+  bool mShowProgress;
+
+  std::shared_ptr<const RFIMask> mpMask;
 };
 
 #endif // SIGPROCUTIL_HPP_
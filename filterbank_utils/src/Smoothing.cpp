@@ -0,0 +1,232 @@
+/*
+ * Smoothing.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Smoothing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+// solve the symmetric positive definite system A x = b of size n (row-major),
+// A and b are overwritten
+void solve(std::vector<double> * const A, std::vector<double> * const b,
+    const size_t n) {
+  std::vector<double>& a = *A;
+  std::vector<double>& x = *b;
+
+  for (size_t k = 0; k < n; ++k) {
+    size_t pivot = k;
+    for (size_t i = k + 1; i < n; ++i) {
+      if (std::abs(a[i * n + k]) > std::abs(a[pivot * n + k]))
+        pivot = i;
+    }
+
+    if (a[pivot * n + k] == 0.0)
+      throw std::runtime_error("Singular Savitzky-Golay system");
+
+    if (pivot != k) {
+      for (size_t j = 0; j < n; ++j)
+        std::swap(a[k * n + j], a[pivot * n + j]);
+      std::swap(x[k], x[pivot]);
+    }
+
+    for (size_t i = k + 1; i < n; ++i) {
+      const double f = a[i * n + k] / a[k * n + k];
+      for (size_t j = k; j < n; ++j)
+        a[i * n + j] -= f * a[k * n + j];
+      x[i] -= f * x[k];
+    }
+  }
+
+  for (size_t k = n; k-- > 0;) {
+    for (size_t j = k + 1; j < n; ++j)
+      x[k] -= a[k * n + j] * x[j];
+    x[k] /= a[k * n + k];
+  }
+}
+
+} // namespace [unnamed]
+
+std::vector<float> smooth_gaussian(const std::vector<float>& data,
+    const double variance) {
+  const size_t n = data.size();
+  if ((variance <= 0.0) || (n == 0))
+    return data;
+
+  const size_t radius = std::min((size_t)std::sqrt(2.0 * variance
+      * GaussianMaxExponent), n - 1);
+
+  std::vector<double> weights(radius + 1);
+  for (size_t d = 0; d <= radius; ++d)
+    weights[d] = std::exp(-(double)(d * d) / (2.0 * variance));
+
+  std::vector<float> res(n);
+  for (size_t i = 0; i < n; ++i) {
+    const size_t first = i >= radius ? i - radius : 0;
+    const size_t last = std::min(i + radius, n - 1);
+
+    double sum = 0.0;
+    double denom = 0.0;
+    for (size_t j = first; j <= last; ++j) {
+      const double k = weights[j > i ? j - i : i - j];
+      sum += k * data[j];
+      denom += k;
+    }
+
+    res[i] = sum / denom;
+  }
+
+  return res;
+}
+
+std::vector<float> smooth_median(const std::vector<float>& data,
+    const size_t width) {
+  const size_t n = data.size();
+  const size_t half = width / 2;
+  if ((half == 0) || (n == 0))
+    return data;
+
+  // the values in the window [first, end), split into the lower and the upper
+  // half, all values in lower are <= all values in upper and lower has as many
+  // values as upper or one more
+  std::multiset<float> lower, upper;
+  size_t first = 0;
+  size_t end = 0;
+
+  auto balance = [&]() {
+    if (lower.size() > upper.size() + 1) {
+      auto last = std::prev(lower.end());
+      upper.insert(*last);
+      lower.erase(last);
+    } else if (upper.size() > lower.size()) {
+      lower.insert(*upper.begin());
+      upper.erase(upper.begin());
+    }
+  };
+
+  std::vector<float> res(n);
+  for (size_t i = 0; i < n; ++i) {
+    const size_t new_first = i >= half ? i - half : 0;
+    const size_t new_end = std::min(i + half + 1, n);
+
+    for (; first < new_first; ++first) {
+      if (data[first] <= *lower.rbegin())
+        lower.erase(lower.find(data[first]));
+      else
+        upper.erase(upper.find(data[first]));
+      balance();
+    }
+
+    for (; end < new_end; ++end) {
+      if (lower.empty() || (data[end] <= *lower.rbegin()))
+        lower.insert(data[end]);
+      else
+        upper.insert(data[end]);
+      balance();
+    }
+
+    if (lower.size() > upper.size())
+      res[i] = *lower.rbegin();
+    else
+      res[i] = 0.5 * ((double)*lower.rbegin() + (double)*upper.begin());
+  }
+
+  return res;
+}
+
+std::vector<float> smooth_savitzky_golay(const std::vector<float>& data,
+    const size_t width, const int order) {
+  if (order < 0)
+    throw std::invalid_argument("Savitzky-Golay order must be non-negative");
+
+  const size_t n = data.size();
+  const size_t w = std::min(width | 1, n);
+  const size_t num_terms = order + 1;
+
+  // a polynomial of this order goes through all the values in the window
+  if (w <= num_terms)
+    return data;
+
+  const size_t half = w / 2;
+
+  // coordinates of the window, centered and scaled to [-1, 1] to keep the
+  // normal equations well conditioned
+  std::vector<double> powers(w * num_terms);
+  for (size_t j = 0; j < w; ++j) {
+    const double x = ((double)j - (double)half) / (double)std::max(half,
+        (size_t)1);
+    double p = 1.0;
+    for (size_t k = 0; k < num_terms; ++k) {
+      powers[j * num_terms + k] = p;
+      p *= x;
+    }
+  }
+
+  std::vector<double> normal(num_terms * num_terms, 0.0);
+  for (size_t j = 0; j < w; ++j) {
+    for (size_t k = 0; k < num_terms; ++k) {
+      for (size_t l = 0; l < num_terms; ++l)
+        normal[k * num_terms + l] += powers[j * num_terms + k]
+            * powers[j * num_terms + l];
+    }
+  }
+
+  // weights of the values in the window for the fitted value at its center
+  std::vector<double> coeffs(w);
+  {
+    std::vector<double> A = normal;
+    std::vector<double> y(powers.begin() + half * num_terms,
+        powers.begin() + (half + 1) * num_terms);
+    solve(&A, &y, num_terms);
+
+    for (size_t j = 0; j < w; ++j) {
+      double c = 0.0;
+      for (size_t k = 0; k < num_terms; ++k)
+        c += y[k] * powers[j * num_terms + k];
+      coeffs[j] = c;
+    }
+  }
+
+  std::vector<float> res(n);
+
+  // the values [begin, end) near an edge come from the polynomial fit to the w
+  // values from first on
+  auto fit_edge = [&](const size_t first, const size_t begin,
+      const size_t end) {
+    std::vector<double> A = normal;
+    std::vector<double> b(num_terms, 0.0);
+    for (size_t j = 0; j < w; ++j) {
+      for (size_t k = 0; k < num_terms; ++k)
+        b[k] += powers[j * num_terms + k] * data[first + j];
+    }
+    solve(&A, &b, num_terms);
+
+    for (size_t i = begin; i < end; ++i) {
+      double sum = 0.0;
+      for (size_t k = 0; k < num_terms; ++k)
+        sum += b[k] * powers[(i - first) * num_terms + k];
+      res[i] = sum;
+    }
+  };
+
+  // the windows that fit entirely in the data are centered on their value
+  const size_t interior_end = n - w + half + 1;
+  fit_edge(0, 0, half);
+  for (size_t i = half; i < interior_end; ++i) {
+    double sum = 0.0;
+    for (size_t j = 0; j < w; ++j)
+      sum += coeffs[j] * data[i - half + j];
+
+    res[i] = sum;
+  }
+  fit_edge(n - w, interior_end, n);
+
+  return res;
+}
@@ -0,0 +1,39 @@
+/*
+ * Smoothing.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef SMOOTHING_HPP_
+#define SMOOTHING_HPP_
+
+#include <cstddef>
+#include <vector>
+
+// Smoothers for data like a bandpass. Near the edges, all of them only use the
+// data that exists instead of padding it.
+
+// Weighted mean with the weights exp(-d^2 / (2 variance)) for the values at
+// distance d. Weights below exp(-GaussianMaxExponent) are left out, so the
+// cost is O(n sqrt(variance)). Near the edges, the weights are normalized over
+// the values that exist.
+constexpr double GaussianMaxExponent = 30.0;
+
+std::vector<float> smooth_gaussian(const std::vector<float>& data,
+    const double variance);
+
+// Median of the width values centered on each value (width is rounded up to
+// an odd number). The window is cut off at the edges, and if that leaves an
+// even number of values, the median is the mean of the middle two. The window
+// is kept in two sorted halves as it slides, so the cost is O(n log width).
+std::vector<float> smooth_median(const std::vector<float>& data,
+    const std::size_t width);
+
+// Savitzky-Golay filter: the value of the least-squares polynomial of the given
+// order through the width values around each value (width is rounded up to an
+// odd number). Near the edges, the polynomial is fit to the first or last width
+// values and evaluated at the position of the value. The cost is O(n width).
+std::vector<float> smooth_savitzky_golay(const std::vector<float>& data,
+    const std::size_t width, const int order);
+
+#endif // SMOOTHING_HPP_
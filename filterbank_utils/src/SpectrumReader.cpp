@@ -0,0 +1,174 @@
+/*
+ * SpectrumReader.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "SpectrumReader.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+// POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+
+constexpr size_t SpectrumReader::DefaultBlockSize;
+constexpr int SpectrumReader::AllIFs;
+
+namespace {
+
+// ask the kernel to read the given range of a memory mapped file ahead,
+// madvise needs a page aligned address
+void will_need(const float * const ptr, const size_t len) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t start = (size_t)ptr & ~(page_size - 1);
+  // this is only a hint, so we don't care if it fails
+  madvise((void*)start, len + ((size_t)ptr - start), MADV_WILLNEED);
+}
+
+} // namespace [unnamed]
+
+SpectrumReader::SpectrumReader(const SigProc& file, const size_t block_len,
+    const int if_idx, const size_t first_sample, const size_t num_samples) :
+    mFile(file),
+    mIF(if_idx),
+    mpData(nullptr),
+    mFirstSample(first_sample),
+    mNumSamples(0),
+    mNumBlocks(0),
+    mpMapped(nullptr),
+    mNumRead { 0, 0 } {
+  const auto& header = file.Header();
+  const size_t nsamples = std::max(header.nsamples, (int64_t)0);
+  const size_t full_size = (size_t)header.nifs * (size_t)header.nchans;
+
+  if ((if_idx != AllIFs) && ((if_idx < 0) || (if_idx >= header.nifs)))
+    throw std::out_of_range("if_idx is out of range");
+
+  mSpectrumSize = if_idx == AllIFs ? full_size : (size_t)header.nchans;
+
+  // a stream without nsamples is read with GetNextSpectra until it ends
+  mOpenEnded = file.Sequential() && (header.nsamples < 0);
+
+  if (!mOpenEnded && (first_sample + num_samples > nsamples))
+    throw std::out_of_range("Requested samples out of range");
+
+  mBegin = first_sample;
+  if (num_samples > 0)
+    mEnd = first_sample + num_samples;
+  else
+    mEnd = mOpenEnded ? SIZE_MAX : nsamples;
+
+  mBlockLen = block_len > 0 ? block_len
+      : DefaultBlockSize / std::max(full_size * sizeof(float), (size_t)1);
+  mBlockLen = std::max(mBlockLen, (size_t)1);
+
+  if (mEnd == mBegin)
+    return;
+
+  if ((file.MappedData() != nullptr) && !file.ChannelMajor()
+      && (mSpectrumSize == full_size)) {
+    mpMapped = file.MappedData();
+    will_need(mpMapped + mBegin * full_size,
+        std::min(mBlockLen, mEnd - mBegin) * full_size * sizeof(float));
+    return;
+  }
+
+  // we read entire spectra and drop the other IFs afterwards
+  size_t len = std::min(mBlockLen, mEnd - mBegin);
+  for (auto& b : mBuffers)
+    b.resize(len * full_size);
+
+  Fetch(mBegin, 0);
+}
+
+SpectrumReader::~SpectrumReader() {
+  // the background read uses our buffers
+  if (mPending.valid()) {
+    try {
+      mPending.get();
+    } catch (...) {
+      // nobody wants the block anymore
+    }
+  }
+}
+
+bool SpectrumReader::Next() {
+  size_t next = mNumBlocks == 0 ? mBegin : mFirstSample + mNumSamples;
+
+  if (next >= mEnd) {
+    mpData = nullptr;
+    mFirstSample = mEnd;
+    mNumSamples = 0;
+    return false;
+  }
+
+  mFirstSample = next;
+  mNumSamples = std::min(mBlockLen, mEnd - next);
+  size_t buf = mNumBlocks % 2;
+  ++mNumBlocks;
+
+  size_t after = mFirstSample + mNumSamples;
+
+  if (mpMapped != nullptr) {
+    mpData = mpMapped + mFirstSample * mSpectrumSize;
+    if (after < mEnd) {
+      will_need(mpMapped + after * mSpectrumSize,
+          std::min(mBlockLen, mEnd - after) * mSpectrumSize * sizeof(float));
+    }
+    return true;
+  }
+
+  // wait for this block (throws if reading it failed) and start reading the
+  // next one into the other buffer, which the caller is done with
+  mPending.get();
+  mpData = mBuffers[buf].data();
+
+  if (mNumRead[buf] < mNumSamples) {
+    // the stream ended in this block
+    mNumSamples = mNumRead[buf];
+    mEnd = mFirstSample + mNumSamples;
+    after = mEnd;
+
+    if (mNumSamples == 0) {
+      mpData = nullptr;
+      return false;
+    }
+  }
+
+  if (after < mEnd)
+    Fetch(after, 1 - buf);
+
+  return true;
+}
+
+void SpectrumReader::Fetch(const size_t first_sample, const size_t buf) {
+  const size_t len = std::min(mBlockLen, mEnd - first_sample);
+  float * const data = mBuffers[buf].data();
+
+  size_t * const num_read = &mNumRead[buf];
+
+  mPending = std::async(std::launch::async,
+      [this, first_sample, len, data, num_read] {
+    if (mOpenEnded) {
+      *num_read = mFile.GetNextSpectra(data, len);
+    } else {
+      mFile.GetSpectra(data, first_sample, len);
+      *num_read = len;
+    }
+
+    if (mIF != AllIFs) {
+      // keep only the channels of our IF, the rows only move towards the
+      // beginning of the buffer
+      const size_t full_size = (size_t)mFile.Header().nifs * mSpectrumSize;
+      for (size_t t = 0; t < *num_read; ++t) {
+        memmove(data + t * mSpectrumSize,
+            data + t * full_size + (size_t)mIF * mSpectrumSize,
+            mSpectrumSize * sizeof(float));
+      }
+    }
+  });
+}
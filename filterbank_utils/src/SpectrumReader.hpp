@@ -0,0 +1,111 @@
+/*
+ * SpectrumReader.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef SPECTRUMREADER_HPP_
+#define SPECTRUMREADER_HPP_
+
+#include <future>
+#include <vector>
+
+#include "SigProc.hpp"
+
+// Streams through consecutive spectra of a sigproc file in blocks, regardless
+// of the layout and the number of bits of the file:
+//
+//   SpectrumReader reader(file);
+//   while (reader.Next()) {
+//     // reader.NumSamples() spectra of reader.SpectrumSize() values each,
+//     // starting at spectrum reader.FirstSample()
+//     const float * spectra = reader.Data();
+//   }
+//
+// While the caller works on one block, the next one is read in the background.
+// If the file is memory mapped, time-major and 32-bit, the blocks point
+// straight into the mapped file and the kernel is asked to read the next block
+// ahead instead. A stream that doesn't say how many spectra it has is read
+// until it ends. The file must not be used for anything else while the reader
+// is reading from it.
+class SpectrumReader {
+public:
+  // default size of a block
+  static constexpr size_t DefaultBlockSize = 32 * 1024 * 1024; // 32 MB
+
+  static constexpr int AllIFs = -1;
+
+  // Read num_samples spectra starting at first_sample (num_samples = 0 reads
+  // to the end of the file or stream) in blocks of block_len spectra
+  // (block_len = 0 picks the length that gives blocks of DefaultBlockSize
+  // bytes). If if_idx is not AllIFs, the spectra only contain the channels of
+  // that IF.
+  SpectrumReader(const SigProc& file, const size_t block_len = 0,
+      const int if_idx = AllIFs, const size_t first_sample = 0,
+      const size_t num_samples = 0);
+
+  ~SpectrumReader();
+
+  SpectrumReader(const SpectrumReader&) = delete;
+  SpectrumReader& operator=(const SpectrumReader&) = delete;
+
+  // advance to the next block, returns false if there are no more spectra
+  bool Next();
+
+  const float * Data() const {
+    return mpData;
+  }
+
+  size_t FirstSample() const {
+    return mFirstSample;
+  }
+
+  size_t NumSamples() const {
+    return mNumSamples;
+  }
+
+  // number of values in each spectrum
+  size_t SpectrumSize() const {
+    return mSpectrumSize;
+  }
+
+  size_t BlockLen() const {
+    return mBlockLen;
+  }
+
+  // fraction of the spectra that have been handed out so far
+  double Progress() const {
+    return mEnd == mBegin ? 1.0 : (double)(mFirstSample + mNumSamples - mBegin)
+        / (double)(mEnd - mBegin);
+  }
+
+private:
+  // start reading the block that starts at first_sample into buffer buf
+  void Fetch(const size_t first_sample, const size_t buf);
+
+  const SigProc& mFile;
+  const int mIF;
+  size_t mSpectrumSize;
+  size_t mBlockLen;
+
+  // the spectra [mBegin, mEnd) are read, for a stream that doesn't say how
+  // long it is, mEnd is SIZE_MAX until it ends
+  size_t mBegin, mEnd;
+  bool mOpenEnded;
+
+  // the current block
+  const float * mpData;
+  size_t mFirstSample, mNumSamples;
+  size_t mNumBlocks; // number of blocks handed out so far
+
+  // the mapped data if we use it in place, nullptr otherwise
+  const float * mpMapped;
+
+  // two blocks for double buffering and the read of the next block, and the
+  // number of spectra that were read into each
+  std::vector<float> mBuffers[2];
+  size_t mNumRead[2];
+  std::future<void> mPending;
+};
+
+#endif // SPECTRUMREADER_HPP_
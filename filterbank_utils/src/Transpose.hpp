@@ -0,0 +1,42 @@
+/*
+ * Transpose.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef TRANSPOSE_HPP_
+#define TRANSPOSE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+
+// Cache-tiled out-of-place transpose of a rows x cols matrix. Element (r, c) is
+// read from in[r * in_stride + c] and written to out[c * out_stride + r]. The
+// matrix is processed in tiles of 64 rows by 32 columns. Within a tile we walk
+// down the rows of one column at a time, so that the writes (which typically
+// go to very long, page-sized or larger strides) are contiguous, while the
+// reads stay within the few cache lines of the tile.
+template<typename T>
+inline void transpose_tiled(const T * const in, const std::size_t in_stride,
+    T * const out, const std::size_t out_stride, const std::size_t rows,
+    const std::size_t cols) {
+  const std::size_t tile_rows = 64;
+  const std::size_t tile_cols = 32;
+
+  for (std::size_t r0 = 0; r0 < rows; r0 += tile_rows) {
+    const std::size_t r1 = std::min(rows, r0 + tile_rows);
+
+    for (std::size_t c0 = 0; c0 < cols; c0 += tile_cols) {
+      const std::size_t c1 = std::min(cols, c0 + tile_cols);
+
+      for (std::size_t c = c0; c < c1; ++c) {
+        const T * const src = in + c;
+        T * const dst = out + c * out_stride;
+        for (std::size_t r = r0; r < r1; ++r)
+          dst[r] = src[r * in_stride];
+      }
+    }
+  }
+}
+
+#endif // TRANSPOSE_HPP_
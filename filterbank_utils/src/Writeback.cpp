@@ -0,0 +1,100 @@
+/*
+ * Writeback.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "Writeback.hpp"
+
+#include <stdexcept>
+
+// POSIX
+#ifndef _LARGEFILE64_SOURCE
+  #define _LARGEFILE64_SOURCE 1
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+constexpr size_t Writeback::DefaultWindow;
+
+namespace {
+
+const unsigned int WaitAndWrite = SYNC_FILE_RANGE_WAIT_BEFORE
+    | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+
+} // namespace [unnamed]
+
+Writeback::Writeback(const int fd, const size_t window) :
+    mFD(fd),
+    mWindow(window),
+    mDropBehind(false),
+    mBegin(0),
+    mEnd(0),
+    mPrevBegin(0),
+    mPrevEnd(0) {}
+
+void Writeback::Written(const off64_t off, const size_t len) {
+  if (len == 0)
+    return;
+
+  if (off != mEnd) {
+    // not sequential, we leave whatever we have to the kernel
+    mBegin = off;
+  }
+
+  mEnd = off + (off64_t)len;
+
+  if (mEnd - mBegin >= (off64_t)mWindow)
+    Start();
+}
+
+void Writeback::Finish() {
+  if (mEnd > mBegin)
+    Start();
+
+  // the previous window, plus anything that was written out of sequence
+  sync_file_range(mFD, 0, 0, WaitAndWrite);
+
+  if (mDropBehind && (mPrevEnd > mPrevBegin))
+    posix_fadvise(mFD, mPrevBegin, mPrevEnd - mPrevBegin, POSIX_FADV_DONTNEED);
+
+  mPrevBegin = mPrevEnd = 0;
+}
+
+void Writeback::Start() {
+  sync_file_range(mFD, mBegin, mEnd - mBegin, SYNC_FILE_RANGE_WRITE);
+
+  if (mPrevEnd > mPrevBegin) {
+    sync_file_range(mFD, mPrevBegin, mPrevEnd - mPrevBegin, WaitAndWrite);
+
+    // only clean pages can be dropped, which these are now
+    if (mDropBehind)
+      posix_fadvise(mFD, mPrevBegin, mPrevEnd - mPrevBegin,
+          POSIX_FADV_DONTNEED);
+  }
+
+  mPrevBegin = mBegin;
+  mPrevEnd = mEnd;
+  mBegin = mEnd;
+}
+
+void Writeback::Allocate(const int fd, const off64_t size) {
+  if (size <= 0)
+    return;
+
+  if (fallocate64(fd, 0, 0, size) == 0)
+    return;
+
+  // not all file systems support fallocate, in that case we create a sparse
+  // file of the right size like we used to
+  if ((errno != EOPNOTSUPP) && (errno != ENOSYS)) {
+    perror("Failure in Writeback::Allocate");
+    throw std::runtime_error("Failed to allocate file");
+  }
+
+  if (ftruncate64(fd, size) != 0) {
+    perror("Failure in Writeback::Allocate");
+    throw std::runtime_error("Failed to allocate file");
+  }
+}
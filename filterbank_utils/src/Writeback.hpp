@@ -0,0 +1,64 @@
+/*
+ * Writeback.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef WRITEBACK_HPP_
+#define WRITEBACK_HPP_
+
+#include <cstddef>
+
+#include <sys/types.h>
+
+// Writes the dirty pages of a file back to disk while the file is being
+// written, instead of leaving gigabytes of dirty pages for a final fsync. The
+// writer reports the ranges it has written (and that have completed), and once
+// a window of consecutive bytes is complete, its writeback is started with
+// sync_file_range. Before that, we wait for the writeback of the previous
+// window, which has had a whole window's worth of time to finish, so that
+// there are never more than two windows of dirty pages per file. Optionally,
+// the pages of the previous window are dropped from the page cache, so that
+// writing a big file doesn't evict everything else.
+//
+// Only sequential writing is tracked, the writeback of scattered writes is left
+// to the kernel. Everything here is a hint, errors are ignored and show up in
+// the final fsync instead.
+class Writeback {
+public:
+  static constexpr size_t DefaultWindow = 64 * 1024 * 1024; // 64 MB
+
+  Writeback(const int fd, const size_t window = DefaultWindow);
+
+  void SetDropBehind(const bool dropBehind) {
+    mDropBehind = dropBehind;
+  }
+
+  // the bytes [off, off + len) of the file have been written
+  void Written(const off64_t off, const size_t len);
+
+  // wait until all the dirty pages of the file are written back, after this an
+  // fsync only has to write the metadata
+  void Finish();
+
+  // allocate the blocks of a file of size bytes, so that writing it doesn't
+  // allocate them piecemeal (falls back to just setting the size)
+  static void Allocate(const int fd, const off64_t size);
+
+private:
+  // start the writeback of the pending range and wait for the previous one
+  void Start();
+
+  const int mFD;
+  const size_t mWindow;
+  bool mDropBehind;
+
+  // the consecutive bytes [mBegin, mEnd) are written, but their writeback has
+  // not been started yet
+  off64_t mBegin, mEnd;
+
+  // range whose writeback has been started, but not waited for
+  off64_t mPrevBegin, mPrevEnd;
+};
+
+#endif // WRITEBACK_HPP_
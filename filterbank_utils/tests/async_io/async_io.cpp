@@ -0,0 +1,143 @@
+/*
+ * async_io.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "AsyncIO.hpp"
+
+namespace {
+
+// number of threads of the process
+int num_threads() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 8, "Threads:") == 0)
+      return atoi(line.c_str() + 8);
+  }
+
+  return -1;
+}
+
+// true if Wait throws
+bool wait_fails(AsyncIO * const io) {
+  try {
+    io->Wait();
+  } catch (std::runtime_error&) {
+    return true;
+  }
+
+  return false;
+}
+
+// Round-trip data through io: in pieces that are split into several chunks,
+// through direct I/O at an unaligned offset, and check that reading past the
+// end and writing to a read-only file fail. Returns an error message.
+std::string test_backend(AsyncIO * const io) {
+  const std::string name = "async_io_" + io->Name();
+  int fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return "Failed to create file";
+
+  const size_t len = 3 * AsyncIO::ChunkSize + 12345;
+  std::vector<char> data(len), back(len);
+  for (size_t i = 0; i < len; ++i)
+    data[i] = (char)rand();
+
+  const size_t piece = AsyncIO::ChunkSize + 1000;
+  for (size_t off = 0; off < len; off += piece)
+    io->Write(fd, data.data() + off, std::min(piece, len - off), off);
+  io->Wait();
+
+  io->Read(fd, back.data(), len, 0);
+  io->Flush();
+  io->Wait();
+  if (back != data)
+    return "Wrong data read back";
+
+  // with direct I/O, the buffers are placed at the offset in the file relative
+  // to an aligned address
+  const off64_t off = 1000;
+  const size_t direct_len = 5 * AsyncIO::DirectAlignment + 123;
+  const size_t slack = AsyncIO::DirectOffset(off);
+  AlignedBuffer src(direct_len + slack), dst(direct_len + slack);
+  for (size_t i = 0; i < direct_len; ++i)
+    src.Data()[slack + i] = (char)rand();
+
+  int direct_fd = AsyncIO::OpenDirect(fd, false);
+  io->WriteDirect(fd, direct_fd, src.Data() + slack, direct_len, off);
+  io->Wait();
+  io->ReadDirect(fd, direct_fd, dst.Data() + slack, direct_len, off);
+  io->Wait();
+  close(direct_fd);
+
+  if (memcmp(src.Data() + slack, dst.Data() + slack, direct_len) != 0)
+    return "Wrong data read back with direct I/O";
+
+  // the error is reported once, by the next Wait
+  io->Read(fd, back.data(), 100, len - 50);
+  if (!wait_fails(io))
+    return "Reading past the end didn't fail";
+  if (wait_fails(io))
+    return "Error was reported twice";
+
+  int read_only = open(name.c_str(), O_RDONLY);
+  io->Write(read_only, data.data(), 100, 0);
+  if (!wait_fails(io))
+    return "Writing to a read-only file didn't fail";
+
+  close(read_only);
+  close(fd);
+  unlink(name.c_str());
+
+  return "";
+}
+
+} // namespace [unnamed]
+
+int main(int, char**) {
+  std::vector<std::unique_ptr<AsyncIO>> backends;
+  backends.push_back(AsyncIO::CreateThreadPool(4));
+  backends.push_back(AsyncIO::Create());
+
+  auto uring = AsyncIO::CreateUring();
+  if (uring != nullptr)
+    backends.push_back(std::move(uring));
+  else
+    printf("io_uring is not available, only testing the thread pool\n");
+
+  for (auto& io : backends) {
+    std::string err = test_backend(io.get());
+    if (err != "") {
+      printf("%s (%s)\n", err.c_str(), io->Name().c_str());
+      return 1;
+    }
+  }
+
+  // the thread pools all share the same threads
+  const int threads_before = num_threads();
+  std::vector<std::unique_ptr<AsyncIO>> pools;
+  for (int i = 0; i < 100; ++i)
+    pools.push_back(AsyncIO::CreateThreadPool());
+
+  if (num_threads() != threads_before) {
+    printf("Thread pools started threads of their own\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * prepfil_manifest.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+
+std::string read_file(const std::string& name) {
+  std::ifstream istm(name, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(istm),
+      std::istreambuf_iterator<char>());
+}
+
+bool run(const std::string& cmd) {
+  printf("%s\n", cmd.c_str());
+  fflush(stdout);
+  return system((cmd + " > /dev/null").c_str()) == 0;
+}
+
+} // namespace [unnamed]
+
+// Processes the files of a manifest with prepfil, whose path is the first
+// argument, and checks that each output is the same as processing that file on
+// its own
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    printf("Usage: %s PREPFIL\n", argv[0]);
+    return 1;
+  }
+  const std::string prepfil(argv[1]);
+
+  // the options of each line are added to those on the command line, the
+  // baseline is removed from both files, so they share the FFTW plans
+  const std::string options = "--no-gpu --baseline=0.01";
+  const std::string lines[] = { "--mask=mask", "--baseline=0.02 -a 3" };
+
+  {
+    std::ofstream manifest("manifest");
+    manifest << "# two files\n\n";
+    for (int i = 0; i < 2; ++i)
+      manifest << "bandpass manifest_" << i << " " << lines[i] << "\n";
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    if (!run(prepfil + " " + options + " " + lines[i] + " bandpass single_"
+        + std::to_string(i))) {
+      printf("Processing bandpass on its own failed\n");
+      return 1;
+    }
+  }
+
+  for (int jobs : { 1, 2 }) {
+    for (int i = 0; i < 2; ++i)
+      remove(("manifest_" + std::to_string(i)).c_str());
+
+    if (!run(prepfil + " " + options + " --manifest=manifest --jobs="
+        + std::to_string(jobs))) {
+      printf("Processing the manifest with %i job(s) failed\n", jobs);
+      return 1;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+      const std::string single = read_file("single_" + std::to_string(i));
+      if (single.size() == 0) {
+        printf("No output for line %i\n", i + 1);
+        return 1;
+      }
+
+      if (read_file("manifest_" + std::to_string(i)) != single) {
+        printf("Line %i of the manifest with %i job(s) gives a different "
+            "output\n", i + 1, jobs);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -5,7 +5,16 @@
  *      Author: jlippuner
  */
 
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <unistd.h>
+
 #include "SigProc.hpp"
+#include "SigProcUtil.hpp"
+#include "SpectrumReader.hpp"
 
 int main(int, char**) {
   const SigProc original("input");
@@ -39,5 +48,438 @@ int main(int, char**) {
     return 1;
   }
 
+  // parse the header from a stream and from a pipe
+  {
+    const auto file_header = SigProcHeader::Read(original.FD());
+
+    std::ifstream ifs("input", std::ios::binary);
+    auto header = SigProcHeader::ReadStream(ifs);
+    if ((header != file_header)
+        || (header.Input_size != original.HeaderSize())
+        || (ifs.tellg() != (std::streamoff)original.HeaderSize())) {
+      printf("Wrong header read from stream\n");
+      return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+      printf("Failed to create pipe\n");
+      return 1;
+    }
+
+    // the header and a bit of data fit into the buffer of the pipe
+    std::vector<char> bytes(original.HeaderSize() + 100);
+    ifs.seekg(0);
+    ifs.read(bytes.data(), bytes.size());
+    if (write(fds[1], bytes.data(), bytes.size()) != (ssize_t)bytes.size()) {
+      printf("Failed to write to pipe\n");
+      return 1;
+    }
+    close(fds[1]);
+
+    std::vector<char> buffer;
+    header = SigProcHeader::ReadSequential(fds[0], &buffer);
+    close(fds[0]);
+
+    if ((header != file_header) || (buffer != bytes)) {
+      printf("Wrong header read from pipe\n");
+      return 1;
+    }
+  }
+
+  // stream the data through a pipe whose header doesn't say how long it is,
+  // it is written and read spectrum by spectrum until the stream ends
+  {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      printf("Failed to create pipe\n");
+      return 1;
+    }
+
+    const auto data = original.GetData();
+    const size_t nsamples = original.Header().nsamples;
+    const size_t spectrum_size = data.size() / nsamples;
+
+    auto header = original.Header();
+    header.nsamples = 0;
+
+    std::thread writer([&]() {
+      {
+        SigProc stream("/dev/fd/" + std::to_string(fds[1]), header);
+        for (size_t t = 0; t < nsamples; t += 5) {
+          stream.SetSpectra(t, data.data() + t * spectrum_size,
+              std::min((size_t)5, nsamples - t));
+        }
+      }
+      close(fds[1]);
+    });
+
+    const SigProc stream("/dev/fd/" + std::to_string(fds[0]));
+    std::vector<float> streamed((nsamples + 7) * spectrum_size);
+    size_t num = 0;
+    while (size_t n = stream.GetNextSpectra(streamed.data()
+        + num * spectrum_size, 7))
+      num += n;
+
+    writer.join();
+    close(fds[0]);
+
+    streamed.resize(num * spectrum_size);
+    if (!stream.Sequential() || (stream.Header().nsamples != -1)
+        || (streamed != data)) {
+      printf("Wrong data streamed through pipe\n");
+      return 1;
+    }
+
+    // a stream can't go back
+    try {
+      stream.GetSpectra(streamed.data(), 0, 1);
+      printf("Read from the start of a stream twice\n");
+      return 1;
+    } catch (std::runtime_error&) {}
+  }
+
+  // a SpectrumReader reads such a stream in blocks until it ends
+  {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      printf("Failed to create pipe\n");
+      return 1;
+    }
+
+    const auto data = original.GetData();
+    const size_t nsamples = original.Header().nsamples;
+    const size_t spectrum_size = data.size() / nsamples;
+
+    auto header = original.Header();
+    header.nsamples = 0;
+
+    std::thread writer([&]() {
+      {
+        SigProc stream("/dev/fd/" + std::to_string(fds[1]), header);
+        stream.SetSpectra(0, data.data(), nsamples);
+      }
+      close(fds[1]);
+    });
+
+    const SigProc stream("/dev/fd/" + std::to_string(fds[0]));
+    std::vector<float> streamed;
+    bool ok = true;
+    {
+      SpectrumReader reader(stream, 7);
+      while (reader.Next()) {
+        ok = ok && (reader.FirstSample() * spectrum_size == streamed.size())
+            && (reader.NumSamples() > 0) && (reader.NumSamples() <= 7);
+        streamed.insert(streamed.end(), reader.Data(),
+            reader.Data() + reader.NumSamples() * spectrum_size);
+      }
+
+      // and stays at the end
+      ok = ok && !reader.Next() && (reader.NumSamples() == 0);
+    }
+
+    writer.join();
+    close(fds[0]);
+
+    if (!ok || (streamed != data)) {
+      printf("Wrong blocks read from stream\n");
+      return 1;
+    }
+  }
+
+  // sample counts that don't fit into the 32-bit header field
+  {
+    auto header = original.Header();
+    header.nsamples = 3000000000;
+    if (header.Data_size() != (size_t)header.nifs * header.nchans
+        * 3000000000ul * header.nbits / 8) {
+      printf("Wrong data size for long file\n");
+      return 1;
+    }
+
+    // is written as 0, which means the file size determines the length
+    std::stringstream stm;
+    header.WriteStream(stm);
+    if (SigProcHeader::ReadStream(stm).nsamples != -1) {
+      printf("Wrong nsamples read for long file\n");
+      return 1;
+    }
+  }
+
+  // check channel reads against the raw data for a wide file, where narrow
+  // channel ranges are read strip by strip rather than as a contiguous span
+  {
+    auto header = original.Header();
+    header.nchans = 2048;
+    header.nsamples = 100;
+
+    std::vector<float> data((size_t)header.nchans * header.nsamples);
+    for (size_t i = 0; i < data.size(); ++i)
+      data[i] = (float)i;
+
+    {
+      SigProc wide("wide", header);
+      wide.SetData(data);
+    }
+
+    for (bool map : { false, true }) {
+      const SigProc wide("wide", map);
+
+      if (wide.GetData() != data) {
+        printf("Wrong data read (map = %i)\n", map);
+        return 1;
+      }
+
+      for (int num : { 1, 3, 700, 2048 }) {
+        int first = (header.nchans - num) / 2;
+        auto chans = wide.GetChannels(first, num);
+
+        for (int c = 0; c < num; ++c) {
+          for (int t = 0; t < header.nsamples; ++t) {
+            if (chans[c * header.nsamples + t]
+                != data[t * header.nchans + first + c]) {
+              printf("Wrong channel data read (map = %i)\n", map);
+              return 1;
+            }
+          }
+        }
+      }
+    }
+
+    // with direct I/O, the slots of the strips are padded to the alignment
+    const SigProc buffered("wide", false);
+    SigProc direct("wide", false);
+    direct.SetDirectIO(true);
+
+    for (int num : { 1, 3, 700, 2048 }) {
+      int first = (header.nchans - num) / 2;
+      if (direct.GetChannels(first, num) != buffered.GetChannels(first, num)) {
+        printf("Wrong channel data read with direct I/O (num = %i)\n", num);
+        return 1;
+      }
+    }
+  }
+
+  // write a file one time window at a time and read windows of channels back,
+  // in both layouts
+  {
+    auto header = original.Header();
+    header.nchans = 2048;
+    header.nsamples = 100;
+
+    // value of channel c at time t
+    auto value = [](size_t c, size_t t) { return (float)(c * 1000 + t); };
+
+    for (int major : { 0, 1 }) {
+      header.channel_major = major;
+      SigProc win("window", header);
+
+      const size_t nchans = header.nchans;
+      for (size_t t0 = 0; t0 < 100; t0 += 30) {
+        size_t len = std::min((size_t)30, 100 - t0);
+        std::vector<float> chans(nchans * len);
+        for (size_t c = 0; c < nchans; ++c) {
+          for (size_t t = 0; t < len; ++t)
+            chans[c * len + t] = value(c, t0 + t);
+        }
+        win.SetChannels(0, 0, t0, chans.data(), nchans, len);
+      }
+
+      for (size_t num : { 1, 700, 2048 }) {
+        size_t first = (nchans - num) / 2;
+        std::vector<float> chans(num * 50);
+        win.GetChannels(chans.data(), 0, first, num, 17, 50);
+
+        for (size_t c = 0; c < num; ++c) {
+          for (size_t t = 0; t < 50; ++t) {
+            if (chans[c * 50 + t] != value(first + c, 17 + t)) {
+              printf("Wrong time window read (channel_major = %i)\n", major);
+              return 1;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // write and read the channels of all IFs of a two-IF file at once and check
+  // them against the channels of each IF, in both layouts and for 8-bit data
+  {
+    auto header = original.Header();
+    header.nifs = 2;
+    header.nchans = 2048;
+    header.nsamples = 100;
+
+    // value of channel c of IF i at time t, small enough for 8 bits
+    auto value = [](size_t i, size_t c, size_t t) {
+      return (float)((i * 101 + c * 7 + t) % 256);
+    };
+
+    for (int nbits : { 32, 8 }) {
+      for (int major : { 0, 1 }) {
+        header.nbits = nbits;
+        header.channel_major = major;
+
+        {
+          SigProc multi("multi_if", header);
+
+          // a part of each spectrum that leaves a gap between the IFs, then
+          // the rest
+          for (size_t first : { (size_t)0, (size_t)700 }) {
+            size_t num = first == 0 ? 700 : 2048 - 700;
+            std::vector<float> chans(2 * num * 100);
+            for (size_t i = 0; i < 2; ++i) {
+              for (size_t c = 0; c < num; ++c) {
+                for (size_t t = 0; t < 100; ++t)
+                  chans[(i * num + c) * 100 + t] = value(i, first + c, t);
+              }
+            }
+            multi.SetChannelsAllIFs(first, 0, chans.data(), num, 100);
+          }
+        }
+
+        for (bool map : { false, true }) {
+          const SigProc multi("multi_if", map);
+
+          for (size_t num : { 1, 700, 2048 }) {
+            size_t first = (2048 - num) / 2;
+            std::vector<float> all(2 * num * 100), one(num * 100);
+            multi.GetChannelsAllIFs(all.data(), first, num, 0, 100);
+
+            for (size_t i = 0; i < 2; ++i) {
+              multi.GetChannels(one.data(), i, first, num);
+              for (size_t c = 0; c < num; ++c) {
+                for (size_t t = 0; t < 100; ++t) {
+                  if ((one[c * 100 + t] != value(i, first + c, t))
+                      || (all[(i * num + c) * 100 + t] != one[c * 100 + t])) {
+                    printf("Wrong multi-IF data (nbits = %i, channel_major = "
+                        "%i, map = %i)\n", nbits, major, map);
+                    return 1;
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // read packed low-bit and 16-bit data, written by hand since SigProc only
+  // writes 32-bit data
+  for (int nbits : { 1, 2, 4, 8, 16 }) {
+    auto header = original.Header();
+    header.nbits = nbits;
+    header.nchans = 2048;
+    header.nsamples = 37;
+
+    size_t num_values = (size_t)header.nchans * header.nsamples;
+    std::vector<float> data(num_values);
+    std::vector<unsigned char> packed(header.Data_size(), 0);
+
+    for (size_t i = 0; i < num_values; ++i) {
+      unsigned int v = (i * 7 + i / 13) % (1u << nbits);
+      data[i] = (float)v;
+
+      if (nbits == 16) {
+        packed[2 * i] = v & 0xFF;
+        packed[2 * i + 1] = v >> 8;
+      } else {
+        packed[i * nbits / 8] |= v << ((i * nbits) % 8);
+      }
+    }
+
+    {
+      std::ofstream ofs("packed", std::ios::binary);
+      header.WriteStream(ofs);
+      ofs.write((const char*)packed.data(), packed.size());
+    }
+
+    for (bool map : { false, true }) {
+      const SigProc packed_file("packed", map);
+
+      if (packed_file.GetData() != data) {
+        printf("Wrong %i-bit data read (map = %i)\n", nbits, map);
+        return 1;
+      }
+
+      for (int num : { 1, 3, 700, 2048 }) {
+        int first = (header.nchans - num) / 2;
+        auto chans = packed_file.GetChannels(first, num);
+
+        for (int c = 0; c < num; ++c) {
+          for (int t = 0; t < header.nsamples; ++t) {
+            if (chans[c * header.nsamples + t]
+                != data[t * header.nchans + first + c]) {
+              printf("Wrong %i-bit channel data read (map = %i)\n", nbits,
+                  map);
+              return 1;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // convert to channel-major layout and back
+  {
+    SigProcUtil util;
+    util.ConvertToChannelMajor(original, "channel_major");
+
+    for (bool map : { false, true }) {
+      const SigProc chan_major("channel_major", map);
+
+      if (!chan_major.ChannelMajor()) {
+        printf("Converted file is not channel-major\n");
+        return 1;
+      }
+
+      if (chan_major.GetData() != original.GetData()) {
+        printf("Wrong data read from channel-major file (map = %i)\n", map);
+        return 1;
+      }
+
+      int nchan = original.Header().nchans;
+      if (chan_major.GetChannels(nchan / 4, nchan / 2)
+          != original.GetChannels(nchan / 4, nchan / 2)) {
+        printf("Wrong channels read from channel-major file (map = %i)\n",
+            map);
+        return 1;
+      }
+
+      // stream a part of the file in odd-sized blocks
+      auto all = original.GetData();
+      size_t spectrum_size = original.Header().nchans;
+      size_t first = 11, num = original.Header().nsamples - 20;
+
+      SpectrumReader reader(chan_major, 97, 0, first, num);
+      size_t next = first;
+      while (reader.Next()) {
+        if ((reader.FirstSample() != next) || !std::equal(reader.Data(),
+            reader.Data() + reader.NumSamples() * spectrum_size,
+            all.begin() + reader.FirstSample() * spectrum_size)) {
+          printf("Wrong block streamed from channel-major file (map = %i)\n",
+              map);
+          return 1;
+        }
+        next += reader.NumSamples();
+      }
+
+      if (next != first + num) {
+        printf("Wrong number of spectra streamed (map = %i)\n", map);
+        return 1;
+      }
+
+      util.ConvertToTimeMajor(chan_major, "time_major");
+      const SigProc time_major("time_major");
+
+      if ((time_major.Header() != original.Header())
+          || (time_major.GetData() != original.GetData())) {
+        printf("Converting back to time-major changed the file\n");
+        return 1;
+      }
+    }
+  }
+
   return 0;
 }
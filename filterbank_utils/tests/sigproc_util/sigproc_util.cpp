@@ -6,9 +6,25 @@
  */
 
 #include <cmath>
-
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <unistd.h>
+
+#include "Decimate.hpp"
+#include "RedoJournal.hpp"
+#include "RFIMask.hpp"
 #include "SigProc.hpp"
 #include "SigProcUtil.hpp"
+#include "Smoothing.hpp"
 
 #include "utils.hpp"
 
@@ -32,6 +48,98 @@ int main(int, char**) {
         return 1;
       }
     }
+
+    // the time-major output is streamed, the channel-major one is processed
+    // in batches of channels, both must give the same result
+    SigProcUtil batch_util(0.1);
+    batch_util.SetOutputLayout(SigProcUtil::OutputLayout::ChannelMajor);
+    batch_util.AverageSamples(original, "input_dec_6_cm", 6);
+
+    if (SigProc("input_dec_6_cm").GetData() != vec0) {
+      printf("Wrong results in decimate with channel-major output\n");
+      return 1;
+    }
+  }
+
+  // test the decimation kernels against the double-accumulate loop, with
+  // output lengths that leave a remainder for the scalar loop
+  {
+    std::vector<float> in(37 * 40 * 8);
+    for (size_t i = 0; i < in.size(); ++i)
+      in[i] = (float)rand() / (float)RAND_MAX * powf(10.0f, i % 7 - 3.0f);
+
+    for (size_t factor = 1; factor <= 40; ++factor) {
+      size_t num_out = in.size() / factor - 3;
+      std::vector<float> out(num_out), ref(num_out);
+      decimate(in.data(), out.data(), num_out, factor);
+      decimate_scalar(in.data(), ref.data(), num_out, factor);
+
+      for (size_t i = 0; i < num_out; ++i) {
+        // the sums are added in a different order, which may change the last
+        // bit after rounding to float
+        if (fabsf(out[i] - ref[i]) > 1.2e-7 * fabsf(ref[i])) {
+          printf("%.10e != %.10e\n", out[i], ref[i]);
+          printf("Wrong results in decimate with factor %lu\n", factor);
+          return 1;
+        }
+      }
+    }
+  }
+
+  // test the bandpass smoothers: constants stay constant, Savitzky-Golay keeps
+  // a quadratic (also at the edges), and the truncated Gaussian agrees with
+  // the full sum
+  {
+    const size_t n = 1000;
+    std::vector<float> constant(n, 3.5f), quadratic(n), noisy(n);
+    for (size_t i = 0; i < n; ++i) {
+      double x = (double)i / (double)n;
+      quadratic[i] = 1.0 + 2.0 * x - 3.0 * x * x;
+      noisy[i] = 10.0f + (float)rand() / (float)RAND_MAX;
+    }
+
+    std::vector<std::vector<float>> smoothed = {
+        smooth_gaussian(constant, 50.0), smooth_median(constant, 10),
+        smooth_savitzky_golay(constant, 21, 2) };
+    for (auto& res : smoothed) {
+      for (size_t i = 0; i < n; ++i) {
+        if (fabsf(res[i] - 3.5f) > 1.0e-6) {
+          printf("Wrong smoothing of a constant\n");
+          return 1;
+        }
+      }
+    }
+
+    auto sg = smooth_savitzky_golay(quadratic, 31, 2);
+    for (size_t i = 0; i < n; ++i) {
+      if (fabsf(sg[i] - quadratic[i]) > 1.0e-5) {
+        printf("Wrong results in Savitzky-Golay smoothing\n");
+        return 1;
+      }
+    }
+
+    const double variance = 200.0;
+    auto gauss = smooth_gaussian(noisy, variance);
+    for (size_t i = 0; i < n; ++i) {
+      double sum = 0.0, denom = 0.0;
+      for (size_t j = 0; j < n; ++j) {
+        double d = (double)i - (double)j;
+        double k = exp(-d * d / (2.0 * variance));
+        sum += k * noisy[j];
+        denom += k;
+      }
+
+      if (fabs(gauss[i] - sum / denom) > 1.0e-5) {
+        printf("Wrong results in Gaussian smoothing\n");
+        return 1;
+      }
+    }
+
+    auto median = smooth_median(std::vector<float>({ 5, 1, 9, 3, 7 }), 3);
+    if (median != std::vector<float>({ 3, 5, 3, 7, 5 })) {
+      printf("Wrong results in median smoothing\n");
+      return 1;
+    }
   }
 
   // test bandpass correction
@@ -101,6 +209,277 @@ int main(int, char**) {
     }
   }
 
+  // test the RFI mask: the mask of 11 intervals of 100 samples (the last one
+  // has only 24) zaps channel 7 at all times, interval 4 in all channels, and
+  // channels 10 and 11 in interval 0, 64 in 6, 20 in 9 and 20, 30 and 90 in 10
+  {
+    const SigProc original("bandpass");
+    const size_t nchans = original.Header().nchans;
+    const size_t nsamples = original.Header().nsamples;
+    auto mask = std::make_shared<const RFIMask>("mask", original.Header());
+
+    auto zapped = [](const size_t interval, const size_t c) {
+      static const std::set<std::pair<size_t, size_t>> zaps = { { 0, 10 },
+          { 0, 11 }, { 6, 64 }, { 9, 20 }, { 10, 20 }, { 10, 30 },
+          { 10, 90 } };
+      return (c == 7) || (interval == 4) || (zaps.count({ interval, c }) > 0);
+    };
+
+    for (size_t i = 0; i < (size_t)mask->NumIntervals(); ++i) {
+      for (size_t c = 0; c < nchans; ++c) {
+        if (mask->IsZapped(i, c) != zapped(i, c)) {
+          printf("Wrong mask bitmap\n");
+          return 1;
+        }
+      }
+    }
+
+    typedef std::vector<std::pair<size_t, size_t>> Runs;
+    if ((mask->ZappedChannels() != std::set<int>({ 7 }))
+        || (mask->ZappedIntervalRuns(7) != Runs({ { 0, 11 } }))
+        || (mask->ZappedIntervalRuns(20) != Runs({ { 4, 5 }, { 9, 11 } }))
+        || (mask->ZappedIntervalRuns(10) != Runs({ { 0, 1 }, { 4, 5 } }))) {
+      printf("Wrong zapped channels or runs of the mask\n");
+      return 1;
+    }
+
+    // An output sample that averages factor input samples is zeroed if any of
+    // them is zapped, the others are the same as without the mask. The
+    // channels are compared in the channel-major order of GetChannels.
+    auto check_masked = [&](const std::string& name, const size_t factor) {
+      SigProcUtil plain_util(0.1);
+      plain_util.Process(original, name + "_plain", factor, 0, 0.0, 0.0, "");
+      const auto plain = SigProc(name + "_plain").GetChannels(0, nchans);
+      const auto masked = SigProc(name).GetChannels(0, nchans);
+      const size_t n = nsamples / factor;
+
+      if (masked.size() != nchans * n)
+        return false;
+
+      for (size_t c = 0; c < nchans; ++c) {
+        for (size_t t = 0; t < n; ++t) {
+          bool zero = false;
+          for (size_t s = t * factor; s < (t + 1) * factor; ++s)
+            zero = zero || zapped(s / 100, c);
+
+          if (masked[c * n + t] != (zero ? 0.0f : plain[c * n + t]))
+            return false;
+        }
+      }
+
+      return true;
+    };
+
+    SigProcUtil mask_util(0.1);
+    mask_util.SetMask(mask);
+    SigProcUtil batched_mask_util((size_t)100);
+    batched_mask_util.SetMask(mask);
+    batched_mask_util.SetOutputLayout(SigProcUtil::OutputLayout::ChannelMajor);
+
+    // a channel-major input masks whole channel strips at once
+    mask_util.ConvertLayout(original, "bandpass_cm", true);
+    const SigProc original_cm("bandpass_cm");
+
+    for (size_t factor : { 1, 3, 7 }) {
+      const std::string name = "out_mask_" + std::to_string(factor);
+      mask_util.Process(original, name, factor, 0, 0.0, 0.0, "");
+      batched_mask_util.Process(original, name + "_cm", factor, 0, 0.0, 0.0,
+          "");
+      batched_mask_util.Process(original_cm, name + "_cmin", factor, 0, 0.0,
+          0.0, "");
+
+      if (!check_masked(name, factor) || !check_masked(name + "_cm", factor)
+          || !check_masked(name + "_cmin", factor)) {
+        printf("Wrong results with mask (average of %lu samples)\n", factor);
+        return 1;
+      }
+    }
+
+    // the bandpass leaves out the zapped samples
+    mask_util.CorrectBandpass(original, "out_mask_bp", nsamples, 0.0);
+    auto my_bp = read_columns("out_mask_bp.bandpass", 3)[2];
+    const auto spectra = original.GetData();
+    for (size_t c = 0; c < nchans; ++c) {
+      double sum = 0.0;
+      size_t num = 0;
+      for (size_t t = 0; t < nsamples; ++t) {
+        if (!zapped(t / 100, c)) {
+          sum += spectra[t * nchans + c];
+          ++num;
+        }
+      }
+
+      if ((num > 0) && (fabs(my_bp[c] - sum / num) > 1.0e-6 * fabs(sum / num))) {
+        printf("Wrong bandpass with mask\n");
+        return 1;
+      }
+    }
+
+    // masks with channels or intervals that don't exist are refused
+    std::ifstream src("mask", std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(src)),
+        std::istreambuf_iterator<char>());
+
+    // offsets of the channel zapped at all times, the interval zapped in all
+    // channels and the channels zapped in interval 10
+    for (size_t off : { 64, 72, 140 }) {
+      for (int value : { -1, off == 72 ? 11 : 96 }) {
+        std::vector<char> bad = bytes;
+        memcpy(bad.data() + off, &value, sizeof(value));
+        std::ofstream("bad_mask", std::ios::binary).write(bad.data(),
+            bad.size());
+
+        bool refused = false;
+        try {
+          RFIMask("bad_mask", original.Header());
+        } catch (std::runtime_error&) {
+          refused = true;
+        }
+
+        if (!refused) {
+          printf("Mask with a value of %i at byte %lu was not refused\n",
+              value, off);
+          return 1;
+        }
+      }
+    }
+  }
+
+  // test resuming in-place processing from journals written by hand, as a run
+  // that was killed would have left them
+  {
+    const SigProc original("bandpass");
+    const size_t nchans = original.Header().nchans;
+    const size_t unit_size = 16;
+
+    SigProcUtil journal_util((size_t)100);
+    journal_util.RemoveBaseline(original, "out_resume_ref", 0.01);
+    const SigProc ref("out_resume_ref");
+
+    auto copy_original = [](const std::string& name) {
+      std::ifstream src("bandpass", std::ios::binary);
+      std::ofstream dst(name, std::ios::binary);
+      dst << src.rdbuf();
+    };
+
+    // the processed channels of a unit of the in-place run, which the journal
+    // saves before they overwrite the file
+    auto unit_data = [&](const size_t unit) {
+      return ref.GetChannels(unit * unit_size, unit_size);
+    };
+
+    // what SigProcUtil::DoProcess puts at the start of the preamble for a
+    // baseline removal (there is no bandpass nor zapped channels after it)
+    auto preamble = [](const double baseline) {
+      char buf[256];
+      snprintf(buf, sizeof(buf), "bandpass 0 %.17g %i baseline %.17g bits 32 "
+          "scaling 1 %.9g %.9g mask none obs ", 0.0, 0, baseline, 1.0, 0.0);
+      return std::vector<char>(buf, buf + strlen(buf) + 1);
+    };
+
+    // Start a journal with units [0, num_done) done, and unit num_done begun
+    // but not ended if begin. A begun unit is half written in place.
+    auto start = [&](const std::string& name, const size_t num_done,
+        const bool begin) {
+      copy_original(name);
+      RedoJournal journal(name + ".journal");
+      journal.Start(preamble(0.01));
+      journal.SetUnitSize(unit_size);
+
+      SigProc file(name);
+      for (size_t u = 0; u < num_done; ++u) {
+        auto data = unit_data(u);
+        journal.BeginWrite(u, data.data(), data.size() * sizeof(float),
+            std::vector<char>());
+        file.SetChannels(u * unit_size, data);
+        journal.EndWrite(u, std::vector<char>());
+      }
+
+      if (begin) {
+        auto data = unit_data(num_done);
+        journal.BeginWrite(num_done, data.data(), data.size() * sizeof(float),
+            std::vector<char>());
+        data.resize(data.size() / 2);
+        file.SetChannels(num_done * unit_size, data.data(), unit_size / 2);
+      }
+    };
+
+    auto resumed_matches = [&](const std::string& name) {
+      journal_util.ProcessInPlace(name, 0, 0.0, 0.01, "");
+
+      const SigProc file(name);
+      std::ifstream journal(name + ".journal");
+      return (file.GetData() == ref.GetData()) && !journal.good();
+    };
+
+    if (nchans < 4 * unit_size) {
+      printf("Too few channels to test resuming\n");
+      return 1;
+    }
+
+    // a unit that was begun but not ended is written again from the redo file
+    start("resume_begun", 1, true);
+    if (!resumed_matches("resume_begun")) {
+      printf("Wrong results resuming after an interrupted unit\n");
+      return 1;
+    }
+
+    // the record that was being written when the run stopped, cut off or with
+    // a wrong checksum, is ignored, so its unit is processed again
+    for (bool torn : { true, false }) {
+      start("resume_tail", 2, true);
+
+      std::fstream journal("resume_tail.journal",
+          std::ios::in | std::ios::out | std::ios::binary);
+      journal.seekg(0, std::ios::end);
+      const std::streamoff size = journal.tellg();
+      journal.close();
+
+      // the unit of the broken record is still original
+      {
+        SigProc file("resume_tail");
+        auto data = original.GetChannels(2 * unit_size, unit_size);
+        file.SetChannels(2 * unit_size, data);
+      }
+
+      if (torn) {
+        if (truncate("resume_tail.journal", size - 5) != 0) {
+          printf("Failed to truncate journal\n");
+          return 1;
+        }
+      } else {
+        // the last record is a header of 24 bytes with the unit at byte 8, and
+        // a checksum of 8 bytes, the redo file doesn't hold the changed unit
+        std::fstream last("resume_tail.journal",
+            std::ios::in | std::ios::out | std::ios::binary);
+        last.seekg(size - 24);
+        const char c = last.get() ^ 1;
+        last.seekp(size - 24);
+        last.put(c);
+      }
+
+      if (!resumed_matches("resume_tail")) {
+        printf("Wrong results resuming after a broken record (torn = %i)\n",
+            torn);
+        return 1;
+      }
+    }
+
+    // resuming with other parameters is refused
+    start("resume_other", 1, false);
+    bool refused = false;
+    try {
+      journal_util.ProcessInPlace("resume_other", 0, 0.0, 0.02, "");
+    } catch (std::runtime_error&) {
+      refused = true;
+    }
+
+    if (!refused) {
+      printf("Resumed in-place processing with other parameters\n");
+      return 1;
+    }
+  }
+
   // test barycentering
   {
     std::string obs = "GS";
@@ -153,6 +532,107 @@ int main(int, char**) {
       return 1;
     }
 
+    // with little memory the input is processed in several batches of
+    // channels via scratch files
+    SigProcUtil batched_util((size_t)100);
+    batched_util.AverageSamples(original, "out_avg_batched", 3);
+
+    const SigProc out_avg_batched("out_avg_batched");
+    if (out_avg_batched.GetData() != out_avg.GetData()) {
+      printf("Wrong results in batched average\n");
+      return 1;
+    }
+
+    // with less memory than the input of one output spectrum, the spectra
+    // that are averaged are read a few at a time
+    SigProcUtil tiny_util((size_t)1);
+    tiny_util.AverageSamples(original, "out_avg_tiny", 3);
+
+    const SigProc out_avg_tiny("out_avg_tiny");
+    if (out_avg_tiny.GetData() != out_avg.GetData()) {
+      printf("Wrong results in average with little memory\n");
+      return 1;
+    }
+
+    // a stream that doesn't say how long it is is averaged until it ends, the
+    // last spectrum, which is only one third there, is dropped
+    auto average_stream = [&](const SigProcUtil& stream_util,
+        const std::string& name) {
+      int fds[2];
+      if (pipe(fds) != 0)
+        return false;
+
+      auto header = original.Header();
+      header.nsamples = 0;
+      const auto data = original.GetData();
+
+      std::thread writer([&]() {
+        {
+          SigProc stream("/dev/fd/" + std::to_string(fds[1]), header);
+          stream.SetSpectra(0, data.data(), original.Header().nsamples);
+        }
+        close(fds[1]);
+      });
+
+      {
+        const SigProc stream("/dev/fd/" + std::to_string(fds[0]));
+        stream_util.AverageSamples(stream, name, 3);
+      }
+
+      writer.join();
+      close(fds[0]);
+
+      return SigProc(name).GetData() == out_avg.GetData();
+    };
+
+    if (!average_stream(util, "out_avg_stream")
+        || !average_stream(tiny_util, "out_avg_stream_tiny")) {
+      printf("Wrong results in average of a stream\n");
+      return 1;
+    }
+
+    // averaging groups of 8 channels in the same pass gives the mean of the
+    // channels of each group, also when the channels are processed in batches
+    SigProcUtil chan_util(0.1);
+    chan_util.SetNumChannelsToAverage(8);
+    chan_util.AverageSamples(original, "out_avg_chans", 3);
+    batched_util.SetNumChannelsToAverage(8);
+    batched_util.SetOutputLayout(SigProcUtil::OutputLayout::ChannelMajor);
+    batched_util.AverageSamples(original, "out_avg_chans_batched", 3);
+    batched_util.SetNumChannelsToAverage(1);
+    batched_util.SetOutputLayout(SigProcUtil::OutputLayout::SameAsInput);
+
+    const SigProc out_avg_chans("out_avg_chans");
+    const auto& chans_header = out_avg_chans.Header();
+    if ((chans_header.nchans != out_avg.Header().nchans / 8)
+        || (chans_header.foff != 8.0 * out_avg.Header().foff)
+        || (chans_header.fch1 != out_avg.Header().fch1
+            + 3.5 * out_avg.Header().foff)) {
+      printf("Wrong header of channel average\n");
+      return 1;
+    }
+
+    auto my_chans = convert_to_2d(out_avg_chans.GetData(),
+        chans_header.nsamples, chans_header.nchans);
+    for (size_t i = 0; i < my_chans.size(); ++i) {
+      for (size_t j = 0; j < my_chans[i].size(); ++j) {
+        double mean = 0.0;
+        for (size_t c = 8 * j; c < 8 * (j + 1); ++c)
+          mean += my_avg[i][c] / 8.0;
+
+        if (fabs(my_chans[i][j] - mean) > 1.0e-6 * fabs(mean)) {
+          printf("Wrong results in channel average\n");
+          return 1;
+        }
+      }
+    }
+
+    if (SigProc("out_avg_chans_batched").GetData()
+        != out_avg_chans.GetData()) {
+      printf("Wrong results in batched channel average\n");
+      return 1;
+    }
+
     util.Process(original, "out_bp", 3, 511, 0.0, 0.0, "");
 
     const SigProc out_bp("out_bp");
@@ -169,6 +649,29 @@ int main(int, char**) {
       }
     }
 
+    // processing a copy of the input in place, batch by batch, gives the same
+    // data as writing a new file
+    batched_util.Process(original, "out_bp_base", 1, 511, 0.0, 0.01, "");
+    {
+      std::ifstream src("bandpass", std::ios::binary);
+      std::ofstream dst("in_place", std::ios::binary);
+      dst << src.rdbuf();
+    }
+    batched_util.ProcessInPlace("in_place", 511, 0.0, 0.01, "");
+
+    const SigProc out_bp_base("out_bp_base");
+    const SigProc in_place("in_place");
+    if (in_place.GetData() != out_bp_base.GetData()) {
+      printf("Wrong results in in-place processing\n");
+      return 1;
+    }
+
+    std::ifstream journal("in_place.journal");
+    if (journal.good()) {
+      printf("Journal of in-place processing was not removed\n");
+      return 1;
+    }
+
     util.Process(original, "out_base", 3, 511, 0.0, 0.01, "");
 
     const SigProc out_base("out_base");
@@ -184,6 +687,49 @@ int main(int, char**) {
         }
       }
     }
+
+    // automatically scaled 8-bit output must be within half a quantization
+    // step of the float output (unless it was clipped)
+    SigProcUtil util_8bit(0.1);
+    util_8bit.SetOutputBits(8);
+    util_8bit.Process(original, "out_base_8bit", 3, 511, 0.0, 0.01, "");
+
+    const SigProc out_base_8bit("out_base_8bit");
+    if (out_base_8bit.Header().nbits != 8) {
+      printf("Wrong number of bits in 8-bit output\n");
+      return 1;
+    }
+
+    size_t nchans = out_base.Header().nchans;
+    std::vector<double> scales(nchans), offsets(nchans);
+    std::ifstream ifs("out_base_8bit.scales");
+    std::string line;
+    size_t num_scales = 0;
+    while (std::getline(ifs, line)) {
+      if (line[0] == '#')
+        continue;
+
+      int if_num, chan;
+      double freq;
+      sscanf(line.c_str(), "%i %i %lf %lf %lf", &if_num, &chan, &freq,
+          &scales[num_scales], &offsets[num_scales]);
+      ++num_scales;
+    }
+
+    if (num_scales != nchans) {
+      printf("Wrong number of scales\n");
+      return 1;
+    }
+
+    auto floats = out_base.GetData();
+    auto quantized = out_base_8bit.GetData();
+    for (size_t i = 0; i < floats.size(); ++i) {
+      double q = floats[i] * scales[i % nchans] + offsets[i % nchans];
+      if ((q >= 0.0) && (q <= 255.0) && (fabs(quantized[i] - q) > 0.5001)) {
+        printf("Wrong results in 8-bit output\n");
+        return 1;
+      }
+    }
   }
 
   return 0;
@@ -0,0 +1,158 @@
+/*
+ * writeback.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Writeback.hpp"
+
+namespace {
+
+// the error the next call of fallocate64 fails with, 0 to call the real one
+int fallocate_errno = 0;
+
+// Write len random bytes to fd through a Writeback with a small window, mostly
+// in sequence, but with one piece written out of order. Returns the data.
+std::vector<char> write_file(const int fd, const size_t len,
+    const bool dropBehind) {
+  std::vector<char> data(len);
+  for (size_t i = 0; i < len; ++i)
+    data[i] = (char)rand();
+
+  Writeback writeback(fd, 64 * 1024);
+  writeback.SetDropBehind(dropBehind);
+
+  const size_t piece = 10000;
+  const size_t skipped = 5 * piece;
+  for (size_t off = 0; off < len; off += piece) {
+    if (off == skipped)
+      continue;
+
+    const size_t num = std::min(piece, len - off);
+    if (pwrite64(fd, data.data() + off, num, off) != (ssize_t)num)
+      throw std::runtime_error("Failed to write");
+    writeback.Written(off, num);
+  }
+
+  if (pwrite64(fd, data.data() + skipped, piece, skipped) != (ssize_t)piece)
+    throw std::runtime_error("Failed to write");
+  writeback.Written(skipped, piece);
+  writeback.Finish();
+
+  return data;
+}
+
+bool read_back(const int fd, const std::vector<char>& data) {
+  std::vector<char> back(data.size());
+  if (pread64(fd, back.data(), back.size(), 0) != (ssize_t)back.size())
+    return false;
+
+  return back == data;
+}
+
+struct stat64 file_stat(const int fd) {
+  struct stat64 st;
+  if (fstat64(fd, &st) != 0)
+    throw std::runtime_error("Failed to stat");
+  return st;
+}
+
+} // namespace [unnamed]
+
+// Writeback::Allocate calls this instead of the one in libc, so that we can
+// make it fail like it does on file systems without fallocate
+extern "C" int fallocate64(int fd, int mode, __off64_t offset, __off64_t len) {
+  if (fallocate_errno != 0) {
+    errno = fallocate_errno;
+    return -1;
+  }
+
+  return syscall(SYS_fallocate, fd, mode, offset, len);
+}
+
+int main(int, char**) {
+  const size_t len = 1000 * 1000 + 123;
+
+  // allocate the file first, like SigProc does
+  for (bool dropBehind : { false, true }) {
+    int fd = open("writeback", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      printf("Failed to create file\n");
+      return 1;
+    }
+
+    Writeback::Allocate(fd, len);
+    if (file_stat(fd).st_size != (off64_t)len) {
+      printf("Allocated file has the wrong size\n");
+      return 1;
+    }
+
+    auto data = write_file(fd, len, dropBehind);
+    if ((file_stat(fd).st_size != (off64_t)len) || !read_back(fd, data)) {
+      printf("Wrong data read back (drop behind: %i)\n", dropBehind);
+      return 1;
+    }
+
+    close(fd);
+  }
+
+  // without fallocate, the file just gets its size and stays sparse
+  for (int err : { EOPNOTSUPP, ENOSYS }) {
+    int fd = open("writeback", O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    fallocate_errno = err;
+    try {
+      Writeback::Allocate(fd, len);
+    } catch (std::runtime_error&) {
+      printf("Allocate failed without fallocate (errno %i)\n", err);
+      return 1;
+    }
+    fallocate_errno = 0;
+
+    auto st = file_stat(fd);
+    if ((st.st_size != (off64_t)len) || (st.st_blocks != 0)) {
+      printf("Wrong fallback without fallocate (errno %i)\n", err);
+      return 1;
+    }
+
+    auto data = write_file(fd, len, true);
+    if (!read_back(fd, data)) {
+      printf("Wrong data read back without fallocate (errno %i)\n", err);
+      return 1;
+    }
+
+    close(fd);
+  }
+
+  // any other error is real
+  int read_only = open("writeback", O_RDONLY);
+  bool threw = false;
+  try {
+    Writeback::Allocate(read_only, 2 * len);
+  } catch (std::runtime_error&) {
+    threw = true;
+  }
+  close(read_only);
+
+  if (!threw) {
+    printf("Allocating a read-only file didn't fail\n");
+    return 1;
+  }
+
+  unlink("writeback");
+
+  return 0;
+}